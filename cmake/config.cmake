@@ -31,10 +31,22 @@ set(CMAKE_CXX_STANDARD 20)
 set(CMAKE_CXX_STANDARD_REQUIRED ON)
 
 
+# ============================================================================
+# Optional instruction sets
+# ============================================================================
+# AVX2+FMA enables the 8-wide vertex transform kernel (see include/cura/vertex_stream.h).
+# Off by default so that binaries run on any x86-64 machine; a scalar loop is used instead.
+option(CURA_ENABLE_AVX2 "Compile with AVX2 and FMA" OFF)
+
+
 set(CURA_DEPEND)
 set(CURA_PRIVATE_LIBS)
 set(CURA_PUBLIC_LIBS)
 
+# The renderer spreads tiles and frames across a std::thread pool
+find_package(Threads REQUIRED)
+list(APPEND CURA_PUBLIC_LIBS Threads::Threads)
+
 # ============================================================================
 # Add dependencies via CPM (cmake/tools.cmake includes cmake/CPM.cmake)
 #
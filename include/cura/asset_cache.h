@@ -0,0 +1,183 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <cura/binary_io.h>
+#include <cura/buffer.h>
+#include <cura/lod.h>
+#include <cura/meshlet.h>
+#include <cura/model.h>
+#include <cura/texture.h>
+
+//Bump whenever the processing of models or textures, or the layout of the cache files, changes. Old entries are then never read.
+inline constexpr std::uint32_t kAssetCacheVersion{1};
+
+//64-bit FNV-1a hash, continuing from 'hash'.
+[[nodiscard]] inline std::uint64_t HashBytes(std::string_view bytes, std::uint64_t hash = 0xcbf29ce484222325ull) {
+    for(const auto c : bytes) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+template<typename T>
+[[nodiscard]] std::uint64_t HashValue(const T& value, std::uint64_t hash) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    return HashBytes(std::string_view(reinterpret_cast<const char*>(&value), sizeof(T)), hash);
+}
+
+//Hash of a file's contents. Returns nullopt if it cannot be read.
+[[nodiscard]] inline std::optional<std::uint64_t> HashFile(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    if(!file) return std::nullopt;
+    std::uint64_t hash = HashBytes({});
+    std::array<char, 1<<16> chunk;
+    while(file.read(chunk.data(), chunk.size()) || file.gcount()>0) {
+        hash = HashBytes(std::string_view(chunk.data(), static_cast<std::size_t>(file.gcount())), hash);
+    }
+    return hash;
+}
+
+
+/// @brief An on-disk cache of processed models and textures.
+/// @brief Entries are keyed by a hash of the source file's contents together with the processing options and kAssetCacheVersion,
+/// @brief so editing an .obj or .ppm (or changing how assets are processed) simply misses the old entry. A hit skips parsing,
+/// @brief LOD simplification and meshlet building: the entry is the processed form, read back with a few bulk reads.
+/// @brief Safe to use from several threads (and processes): entries are written to a temporary file and renamed into place.
+class AssetCache {
+public:
+    explicit AssetCache(std::filesystem::path directory) : directory_{std::move(directory)} {
+        std::error_code error;
+        std::filesystem::create_directories(directory_, error);
+        if(error) std::cerr<<"Error creating asset cache directory "<<directory_<<": "<<error.message()<<'\n';
+    }
+
+    //Loads a processed model from the cache, or parses and processes the .obj and stores the result.
+    [[nodiscard]] Model LoadModel(std::string_view path) {
+        const auto entry = EntryPath(path, ModelOptionsHash(), ".model");
+        if(entry) {
+            if(std::ifstream in{*entry, std::ios::binary}; in && ReadHeader(in)) {
+                if(auto model = Model::Read(in)) {
+                    ++hits_;
+                    return std::move(*model);
+                }
+            }
+        }
+        ++misses_;
+        Model model(path);
+        if(entry) Store(*entry, [&](std::ostream& out) { model.Write(out); });
+        return model;
+    }
+
+    //Loads a texture from the cache, or parses the .ppm and stores the result.
+    [[nodiscard]] FrameBuffer LoadTexture(std::string_view path) {
+        const auto entry = EntryPath(path, HashBytes({}), ".texture");
+        if(entry) {
+            if(std::ifstream in{*entry, std::ios::binary}; in && ReadHeader(in)) {
+                if(auto texture = ReadTexture(in)) {
+                    ++hits_;
+                    return std::move(*texture);
+                }
+            }
+        }
+        ++misses_;
+        auto texture = ParsePPMTexture(path);
+        if(entry) Store(*entry, [&](std::ostream& out) { WriteTexture(out, texture); });
+        return texture;
+    }
+
+    [[nodiscard]] const std::filesystem::path& Directory() const noexcept { return directory_; }
+    [[nodiscard]] std::uint64_t Hits() const noexcept { return hits_; }
+    [[nodiscard]] std::uint64_t Misses() const noexcept { return misses_; }
+
+private:
+    static constexpr std::uint32_t kmagic{0x41525543}; //'CURA'
+
+    //Every option that changes the processed form of a model
+    [[nodiscard]] static std::uint64_t ModelOptionsHash() {
+        auto hash = HashValue(kLodMinFaces, HashBytes({}));
+        hash = HashValue(kMeshletMaxFaces, hash);
+        return HashValue(kMeshletMinNormalAlignment, hash);
+    }
+
+    //Path of the entry for a source file, or nullopt if the source cannot be read (in which case the cache is bypassed)
+    [[nodiscard]] std::optional<std::filesystem::path> EntryPath(std::string_view source, std::uint64_t options, std::string_view extension) const {
+        const auto content = HashFile(std::filesystem::path(source));
+        if(!content) return std::nullopt;
+        auto key = HashValue(*content, HashValue(kAssetCacheVersion, options));
+        key = HashBytes(extension, key);
+
+        std::array<char, 17> hex{};
+        constexpr std::string_view kdigits{"0123456789abcdef"};
+        for(int i = 0; i < 16; ++i) hex[i] = kdigits[(key >> (60 - 4*i)) & 15];
+        return directory_ / (std::string(hex.data()) + std::string(extension));
+    }
+
+    [[nodiscard]] static bool ReadHeader(std::istream& in) {
+        std::uint32_t magic = 0, version = 0;
+        return ReadPod(in, magic) && ReadPod(in, version) && magic==kmagic && version==kAssetCacheVersion;
+    }
+
+    template<typename WriteBody>
+    void Store(const std::filesystem::path& entry, WriteBody write_body) const {
+        //A unique temporary name per thread and process, so concurrent writers of the same entry never interleave. Thread ids are only
+        //unique within a process, so they are paired with a random token drawn once per process.
+        static const auto kprocess_token = std::random_device{}();
+        auto temporary = entry;
+        temporary += ".tmp" + std::to_string(kprocess_token) + "-" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        {
+            std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+            if(!out) {
+                std::cerr<<"Error writing asset cache entry "<<temporary<<'\n';
+                return;
+            }
+            WritePod(out, kmagic);
+            WritePod(out, kAssetCacheVersion);
+            write_body(out);
+            if(!out) {
+                std::cerr<<"Error writing asset cache entry "<<temporary<<'\n';
+                return;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(temporary, entry, error);
+        if(error) {
+            std::cerr<<"Error writing asset cache entry "<<entry<<": "<<error.message()<<'\n';
+            std::filesystem::remove(temporary, error);
+        }
+    }
+
+    static void WriteTexture(std::ostream& out, const FrameBuffer& texture) {
+        WritePod(out, texture.height);
+        WritePod(out, texture.width);
+        WriteArray(out, texture.colors);
+    }
+
+    [[nodiscard]] static std::optional<FrameBuffer> ReadTexture(std::istream& in) {
+        std::int32_t height = 0, width = 0;
+        if(!ReadPod(in, height) || !ReadPod(in, width) || height<=0 || width<=0) return std::nullopt;
+        FrameBuffer texture(height, width);
+        if(!ReadArray(in, texture.colors) || texture.colors.size()!=static_cast<std::size_t>(height)*width) return std::nullopt;
+        return texture;
+    }
+
+private:
+    std::filesystem::path directory_;
+    std::atomic<std::uint64_t> hits_{0};
+    std::atomic<std::uint64_t> misses_{0};
+};
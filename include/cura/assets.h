@@ -0,0 +1,123 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <cura/asset_cache.h>
+#include <cura/buffer.h>
+#include <cura/model.h>
+#include <cura/texture.h>
+#include <cura/thread_pool.h>
+
+/// @brief A handle to an asset that may still be loading. Copies refer to the same load.
+/// @brief The asset itself is shared, never copied: it stays alive while any handle or pointer obtained from Get() refers to it.
+template<typename T>
+class AssetHandle {
+public:
+    AssetHandle() = default;
+
+    //Whether the asset has finished loading (or failed to), without blocking.
+    [[nodiscard]] bool Ready() const {
+        return state_->wait_for(std::chrono::seconds{0})==std::future_status::ready;
+    }
+
+    //Blocks until the asset is loaded. Rethrows any exception thrown while loading it.
+    [[nodiscard]] std::shared_ptr<const T> Get() const { return state_->get(); }
+
+    [[nodiscard]] bool Empty() const noexcept { return !state_; }
+
+private:
+    friend class AssetManager;
+    using State = std::shared_future<std::shared_ptr<const T>>;
+
+    explicit AssetHandle(std::shared_ptr<const State> state) : state_{std::move(state)} {}
+
+    std::shared_ptr<const State> state_;
+};
+
+/// @brief Loads meshes and textures on a thread pool.
+/// @brief Requests are de-duplicated by path: asking for an asset that is loaded (or loading) returns a handle to the same object.
+/// @brief The manager holds a reference to every asset it has loaded until ReleaseUnused() is called.
+class AssetManager {
+public:
+    /// @param cache_directory If given, processed assets are kept in an AssetCache there, so later runs skip processing them.
+    explicit AssetManager(ThreadPool& pool, std::optional<std::filesystem::path> cache_directory = std::nullopt) : pool_{pool} {
+        if(cache_directory) cache_.emplace(std::move(*cache_directory));
+    }
+
+    AssetManager(const AssetManager&) = delete;
+    AssetManager& operator=(const AssetManager&) = delete;
+
+    //Starts loading an obj file, unless it has already been requested.
+    [[nodiscard]] AssetHandle<Model> LoadModel(std::string_view path) {
+        return Load(models_, path, [this](const std::string& p) { return cache_ ? cache_->LoadModel(p) : Model(p); });
+    }
+
+    //Starts loading a ppm texture, unless it has already been requested.
+    [[nodiscard]] AssetHandle<FrameBuffer> LoadTexture(std::string_view path) {
+        return Load(textures_, path, [this](const std::string& p) { return cache_ ? cache_->LoadTexture(p) : ParsePPMTexture(p); });
+    }
+
+    //Drops the assets that have finished loading and are no longer referenced outside the manager.
+    //Returns the number of assets released.
+    std::size_t ReleaseUnused() {
+        std::scoped_lock lock(mutex_);
+        return ReleaseUnused(models_) + ReleaseUnused(textures_);
+    }
+
+    //The on-disk cache, if there is one
+    [[nodiscard]] const AssetCache* Cache() const noexcept { return cache_ ? &*cache_ : nullptr; }
+
+    //Number of distinct assets requested and not yet released
+    [[nodiscard]] std::size_t Size() const {
+        std::scoped_lock lock(mutex_);
+        return models_.size() + textures_.size();
+    }
+
+private:
+    template<typename T>
+    using AssetMap = std::map<std::string, AssetHandle<T>, std::less<>>;
+
+    template<typename T, typename Loader>
+    AssetHandle<T> Load(AssetMap<T>& cache, std::string_view path, Loader loader) {
+        std::scoped_lock lock(mutex_);
+        if(const auto it = cache.find(path); it!=cache.end()) return it->second;
+
+        auto future = pool_.Submit([path = std::string(path), loader] {
+            return std::shared_ptr<const T>(std::make_shared<T>(loader(path)));
+        });
+        AssetHandle<T> handle(std::make_shared<const typename AssetHandle<T>::State>(future.share()));
+        cache.emplace(std::string(path), handle);
+        return handle;
+    }
+
+    template<typename T>
+    static std::size_t ReleaseUnused(AssetMap<T>& cache) {
+        return std::erase_if(cache, [](const auto& entry) {
+            //Unused when the cache holds the only handle and the only pointer (the one inside the future).
+            //Loads that are still running, or that failed, are kept.
+            const auto& handle = entry.second;
+            if(handle.state_.use_count()!=1 || !handle.Ready()) return false;
+            try {
+                return handle.Get().use_count()==2; //The future's copy and the temporary returned by Get()
+            }
+            catch(...) {
+                return false;
+            }
+        });
+    }
+
+private:
+    ThreadPool& pool_;
+    mutable std::mutex mutex_;
+    std::optional<AssetCache> cache_;
+    AssetMap<Model> models_;
+    AssetMap<FrameBuffer> textures_;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <ostream>
+#include <span>
+#include <vector>
+
+#include <cura/buffer.h>
+#include <cura/math.h>
+#include <cura/model.h>
+#include <cura/renderer.h>
+#include <cura/shader.h>
+#include <cura/thread_pool.h>
+
+//Rendering of images too large to hold in memory: the image is drawn one horizontal band at a time into a reused band buffer,
+//and each band is written out as binary PPM rows before the next is drawn. Peak memory is one band, whatever the image height.
+
+//Rows per band. A multiple of the tile size, so a band is a whole row of tiles.
+inline constexpr std::int32_t kDefaultBandHeight{4*kDefaultTileSize};
+
+//Writes the header of a binary (P6) PPM image with 8 bits per channel.
+inline void WritePPMHeader(std::ostream& out, std::int32_t height, std::int32_t width) {
+    out<<"P6\n"<<width<<" "<<height<<"\n255\n";
+}
+
+/// @brief Writes the rows of a band as binary PPM pixels, resolving multisampled pixels with a box filter (as FrameBuffer::Resolve does).
+/// @param row Scratch space for one row of bytes, reused across calls.
+inline void WritePPMRows(std::ostream& out, const TileBuffer& band, std::vector<char>& row) {
+    const auto& tile = band.tile;
+    const auto weight = 1.f/static_cast<float>(band.samples);
+    const auto to_byte = [](float c) { return static_cast<char>(static_cast<unsigned char>(255.999f*std::clamp(c, 0.f, 1.f))); };
+    row.resize(3*static_cast<std::size_t>(band.width));
+    for(auto y = tile.y0; y < tile.y1; ++y) {
+        for(auto x = tile.x0; x < tile.x1; ++x) {
+            Color3f sum{0.f,0.f,0.f};
+            for(std::int32_t s = 0; s < band.samples; ++s) sum += band.Color(x,y,s);
+            const auto color = sum*weight;
+            const auto i = 3*static_cast<std::size_t>(x - tile.x0);
+            row[i] = to_byte(color.x);
+            row[i+1] = to_byte(color.y);
+            row[i+2] = to_byte(color.z);
+        }
+        out.write(row.data(), static_cast<std::streamsize>(row.size()));
+    }
+}
+
+/// @brief Draws the binned triangles of every tile inside 'region.tile' into 'region', in parallel. Tiles own disjoint pixels of the region,
+/// @brief so they are drawn straight into it. The pixels are identical to those DrawBatches produces for the same tiles of a cleared image.
+/// @param tiles,bins The tiles of the whole image and the triangles binned to them (see SplitIntoTiles and BinTriangles).
+/// @param region Cleared, and covering whole tiles: its corners lie on tile boundaries or the image edge.
+inline void DrawRegion(std::span<const DrawBatch> batches, std::span<const Tile> tiles, std::span<const std::vector<BinnedTriangle>> bins,
+                       std::int32_t width, std::int32_t tile_size, TileBuffer& region, ThreadPool& pool) {
+    const auto& area = region.tile;
+    assert(area.x0%tile_size==0 && area.y0%tile_size==0 && "Error: a region must start on a tile boundary!");
+    const auto tiles_x = (width + tile_size - 1)/tile_size;
+    const auto tx0 = area.x0/tile_size;
+    const auto ty0 = area.y0/tile_size;
+    const auto region_tiles_x = (area.x1 - area.x0 + tile_size - 1)/tile_size;
+    const auto region_tiles_y = (area.y1 - area.y0 + tile_size - 1)/tile_size;
+    pool.ParallelFor(0, region_tiles_x*region_tiles_y, [&](std::int32_t i) {
+        const auto t = (ty0 + i/region_tiles_x)*tiles_x + tx0 + i%region_tiles_x;
+        for(const auto& [b, v] : bins[t]) {
+            const auto& batch = batches[b];
+            DrawTriangle(batch.vertices[v], batch.vertices[v+1], batch.vertices[v+2], region, batch.texture, tiles[t], batch.tint);
+        }
+    });
+}
+
+/// @brief Renders a set of batches band by band and streams the image to 'out' as a binary PPM, without ever holding the whole image.
+/// @brief Triangles are binned by tile once (see BinTriangles). Each band is cleared, its tiles are drawn in parallel (see DrawRegion),
+/// @brief and its rows are written out on the calling thread.
+/// @brief The output is identical to drawing the batches into a cleared FrameBuffer with DrawBatches and writing that.
+/// @param batches Vertices processed for an image of 'height' x 'width'.
+/// @param band_height Rows per band; a multiple of tile_size. Memory is width*band_height*samples*16 bytes, plus the bins.
+/// @return False if writing failed.
+inline bool RenderBandedPPM(std::span<const DrawBatch> batches, std::int32_t height, std::int32_t width, std::ostream& out, ThreadPool& pool,
+                            std::int32_t samples = 1, std::int32_t band_height = kDefaultBandHeight, std::int32_t tile_size = kDefaultTileSize) {
+    assert(band_height>0 && band_height%tile_size==0 && "Error: band height must be a multiple of the tile size!");
+    const auto tiles = SplitIntoTiles(height, width, tile_size);
+    const auto bins = BinTriangles(batches, height, width, tile_size);
+
+    WritePPMHeader(out, height, width);
+    TileBuffer band;
+    std::vector<char> row;
+    for(std::int32_t y0 = 0; y0 < height; y0 += band_height) {
+        band.Reset(Tile{0, y0, width, std::min(y0 + band_height, height)}, samples);
+        band.Clear();
+        DrawRegion(batches, tiles, bins, width, tile_size, band, pool);
+
+        WritePPMRows(out, band, row);
+        if(!out) {
+            std::cerr<<"Error writing banded image\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief Renders every face of a model band by band and streams it to 'out' as a binary PPM (see RenderBandedPPM).
+inline bool RenderBandedPPM(const Model& model, TextureRef texture, const Mat44f& view, const Mat44f& projection, std::int32_t height, std::int32_t width,
+                            std::ostream& out, ThreadPool& pool, std::int32_t samples = 1, std::int32_t band_height = kDefaultBandHeight) {
+    const DrawBatch batch{ProcessVertices(model, view, projection, height, width), texture};
+    return RenderBandedPPM(std::span(&batch, 1), height, width, out, pool, samples, band_height);
+}
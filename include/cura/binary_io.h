@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+//Raw binary reading and writing of trivially copyable values and arrays of them, in native byte order.
+//Used for cache files that are only ever read back on the machine that wrote them.
+
+//Refuse to allocate more than this many bytes for one array, so a corrupt length fails cleanly.
+inline constexpr std::uint64_t kMaxBinaryArrayBytes{std::uint64_t{1}<<32};
+
+template<typename T>
+void WritePod(std::ostream& out, const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+//Writes the element count, then the elements.
+template<typename T>
+void WriteArray(std::ostream& out, const std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    WritePod(out, static_cast<std::uint64_t>(values.size()));
+    out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size()*sizeof(T)));
+}
+
+//Returns false if the stream ran out.
+template<typename T>
+[[nodiscard]] bool ReadPod(std::istream& in, T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return static_cast<bool>(in);
+}
+
+//Reads an array written by WriteArray(). Returns false if the stream ran out or the length is implausible.
+template<typename T>
+[[nodiscard]] bool ReadArray(std::istream& in, std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    std::uint64_t size = 0;
+    if(!ReadPod(in, size) || size > kMaxBinaryArrayBytes/sizeof(T)) return false;
+    values.resize(static_cast<std::size_t>(size));
+    in.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(size*sizeof(T)));
+    return static_cast<bool>(in);
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <span>
+
+#include <cura/math.h>
+
+/// @brief Axis-aligned bounding box. An empty box has min > max.
+struct AABB {
+    Vec3f min{std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+    Vec3f max{std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+
+    [[nodiscard]] bool Empty() const noexcept { return min.x>max.x || min.y>max.y || min.z>max.z; }
+    [[nodiscard]] Vec3f Center() const noexcept { return 0.5f*(min+max); }
+    [[nodiscard]] Vec3f Extent() const noexcept { return max-min; }
+
+    void Extend(const Vec3f& p) noexcept {
+        min = la::min(min, p);
+        max = la::max(max, p);
+    }
+    void Extend(const AABB& b) noexcept {
+        min = la::min(min, b.min);
+        max = la::max(max, b.max);
+    }
+
+    //Returns the box that contains this box after it has been transformed by m.
+    [[nodiscard]] AABB Transformed(const Mat44f& m) const noexcept {
+        AABB out;
+        for(int i = 0; i < 8; ++i) {
+            const Vec3f corner{i&1 ? max.x : min.x, i&2 ? max.y : min.y, i&4 ? max.z : min.z};
+            out.Extend(la::mul(m, Vec4f(corner,1.f)).xyz());
+        }
+        return out;
+    }
+};
+
+/// @brief Bounding sphere.
+struct BoundingSphere {
+    Vec3f center{0.f,0.f,0.f};
+    float radius{0.f};
+};
+
+//Sphere centered on the box that encloses a set of points. Not minimal, but cheap and always conservative.
+[[nodiscard]] inline BoundingSphere ComputeBoundingSphere(std::span<const Vec3f> points, const AABB& box) {
+    BoundingSphere sphere{box.Center(), 0.f};
+    for(const auto& p : points) {
+        sphere.radius = std::max(sphere.radius, la::length(p - sphere.center));
+    }
+    return sphere;
+}
+
+/// @brief A plane in the form dot(normal,p) + d = 0, with a unit normal pointing towards the 'inside'.
+struct Plane {
+    Vec3f normal;
+    float d;
+
+    [[nodiscard]] float SignedDistance(const Vec3f& p) const noexcept { return la::dot(normal,p) + d; }
+};
+
+//Result of testing a volume against a frustum.
+enum class Containment { kOutside, kIntersecting, kInside };
+
+/// @brief The six planes of a view frustum, in world space.
+struct Frustum {
+    std::array<Plane,6> planes; //left, right, bottom, top, near, far
+
+    [[nodiscard]] Containment Test(const BoundingSphere& s) const noexcept {
+        auto result = Containment::kInside;
+        for(const auto& plane : planes) {
+            const auto dist = plane.SignedDistance(s.center);
+            if(dist < -s.radius) return Containment::kOutside;
+            if(dist < s.radius) result = Containment::kIntersecting;
+        }
+        return result;
+    }
+
+    [[nodiscard]] Containment Test(const AABB& b) const noexcept {
+        auto result = Containment::kInside;
+        for(const auto& plane : planes) {
+            //The corners of the box that are furthest along (p) and against (n) the plane normal
+            const Vec3f p{plane.normal.x>=0 ? b.max.x : b.min.x, plane.normal.y>=0 ? b.max.y : b.min.y, plane.normal.z>=0 ? b.max.z : b.min.z};
+            const Vec3f n{plane.normal.x>=0 ? b.min.x : b.max.x, plane.normal.y>=0 ? b.min.y : b.max.y, plane.normal.z>=0 ? b.min.z : b.max.z};
+            if(plane.SignedDistance(p) < 0) return Containment::kOutside;
+            if(plane.SignedDistance(n) < 0) result = Containment::kIntersecting;
+        }
+        return result;
+    }
+};
+
+//Builds a normalized plane from the coefficients (a,b,c,d) of a*x + b*y + c*z + d >= 0
+[[nodiscard]] inline Plane MakePlane(const Vec4f& coeffs) {
+    const auto len = la::length(coeffs.xyz());
+    return Plane{coeffs.xyz()/len, coeffs.w/len};
+}
+
+/// @brief Extracts the world-space view frustum of a camera.
+/// @brief The side planes come from the rows of the combined projection*view matrix (Gribb & Hartmann).
+/// @brief The near and far planes are built directly in camera space, so they do not depend on the depth convention of the projection.
+/// @param view World-to-camera matrix.
+/// @param projection Camera-to-clip matrix.
+/// @param near Distance to the near plane (the sign is ignored).
+/// @param far Distance to the far plane (the sign is ignored).
+[[nodiscard]] inline Frustum MakeFrustum(const Mat44f& view, const Mat44f& projection, float near, float far) {
+    const auto clip = la::mul(projection, view);
+    const auto r0 = clip.row(0);
+    const auto r1 = clip.row(1);
+    const auto r3 = clip.row(3);
+
+    //In camera space the camera looks down -z, so visible points satisfy -far <= z <= -near.
+    const auto z = view.row(2);
+    const auto w = view.row(3);
+
+    return Frustum{{
+        MakePlane(r3 + r0),                  //left:   -w <= x
+        MakePlane(r3 - r0),                  //right:   x <= w
+        MakePlane(r3 + r1),                  //bottom: -w <= y
+        MakePlane(r3 - r1),                  //top:     y <= w
+        MakePlane(-z - std::abs(near)*w),    //near:    z <= -near
+        MakePlane(z + std::abs(far)*w)       //far:     z >= -far
+    }};
+}
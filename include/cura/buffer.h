@@ -1,64 +1,334 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstdint>
 #include <fstream>
+#include <limits>
 #include <numeric>
 #include <vector>
 
 #include <cura/math.h>
 
+/// @brief A rectangular region of pixels, [x0,x1) x [y0,y1).
+/// @brief Used to restrict rasterization to part of an image (e.g. when splitting a frame across threads).
+struct Tile {
+    std::int32_t x0;
+    std::int32_t y0;
+    std::int32_t x1;
+    std::int32_t y1;
+
+    [[nodiscard]] bool Empty() const noexcept { return x0>=x1 || y0>=y1; }
+    [[nodiscard]] bool operator==(const Tile&) const noexcept = default;
+};
+
+/// @brief Splits an image into square tiles of a given size, in row-major order.
+/// @brief Tiles on the right and bottom borders are cropped to the image.
+[[nodiscard]] inline std::vector<Tile> SplitIntoTiles(std::int32_t height, std::int32_t width, std::int32_t tile_size) {
+    assert(tile_size>0);
+    std::vector<Tile> tiles;
+    for(std::int32_t y = 0; y < height; y += tile_size) {
+        for(std::int32_t x = 0; x < width; x += tile_size) {
+            tiles.push_back(Tile{x, y, std::min(x+tile_size, width), std::min(y+tile_size, height)});
+        }
+    }
+    return tiles;
+}
+
+//Sample offsets from the pixel center, in pixels, for 4x and 8x multisampling.
+//These are the standard rotated-grid (4x) and sparse (8x) D3D patterns: no two samples share a row or a column,
+//so near-horizontal and near-vertical edges get as many coverage levels as there are samples.
+inline constexpr std::array<Vec2f,4> kSamplePositions4{{
+    {-2.f/16.f,-6.f/16.f}, {6.f/16.f,-2.f/16.f}, {-6.f/16.f,2.f/16.f}, {2.f/16.f,6.f/16.f}
+}};
+inline constexpr std::array<Vec2f,8> kSamplePositions8{{
+    {1.f/16.f,-3.f/16.f}, {-1.f/16.f,3.f/16.f}, {5.f/16.f,1.f/16.f}, {-3.f/16.f,-5.f/16.f},
+    {-5.f/16.f,5.f/16.f}, {-7.f/16.f,-1.f/16.f}, {3.f/16.f,7.f/16.f}, {7.f/16.f,-7.f/16.f}
+}};
+
+//Side of the square tiles whose clears are tracked (see FrameBuffer::Clear). Regions drawn concurrently must not share one of these tiles,
+//so tiled drawing uses tile sizes that are multiples of it.
+inline constexpr std::int32_t kClearTileSize{16};
+
 /// @brief A framebuffer is a 2D buffer that contains data used for rendering.
 /// @brief Follows the 'top-left origin' convention
 class FrameBuffer {
 public:
 
-    //Construct with empty values
-    FrameBuffer(std::int32_t h, std::int32_t w)
-        : height{h}, width{w} 
+    //Construct with empty values.
+    //A multisampled buffer stores 'samples' colors and depths per pixel (see kSamplePositions4/8). Resolve it before writing it out.
+    FrameBuffer(std::int32_t h, std::int32_t w, std::int32_t s = 1)
+        : height{h}, width{w}, samples{s}
         {
             assert(h%2==0 && w%2==0 &&"Error: Framebuffer dimensions must be even!");
+            assert((s==1 || s==4 || s==8) && "Error: Framebuffer must have 1, 4 or 8 samples per pixel!");
 
-            colors.resize(h*w, Color3f(0.f,0.f,0.f));
-            depths.resize(h*w, std::numeric_limits<float>::lowest());
+            colors.resize(h*w*s, Color3f(0.f,0.f,0.f));
+            depths.resize(h*w*s, std::numeric_limits<float>::lowest());
         }
 
     // helpers that look up colors and depths for sample s of pixel (x,y):
-	Color3f& Color(std::int32_t x, std::int32_t y) {
-		return colors[y*width+ x];
+	Color3f& Color(std::int32_t x, std::int32_t y, std::int32_t s = 0) {
+        assert(!Cleared(x,y) && "Error: Touch() a cleared region before accessing its pixels!");
+		return colors[(y*width+ x)*samples + s];
 	}
-	const Color3f& Color(std::int32_t x, std::int32_t y) const {
-		return colors[y*width+ x];
+	const Color3f& Color(std::int32_t x, std::int32_t y, std::int32_t s = 0) const {
+        assert(!Cleared(x,y) && "Error: Touch() a cleared region before accessing its pixels!");
+		return colors[(y*width+ x)*samples + s];
 	}
-	float& Depth(std::int32_t x, std::int32_t y) {
-		return depths[y*width+ x];
+	float& Depth(std::int32_t x, std::int32_t y, std::int32_t s = 0) {
+        assert(!Cleared(x,y) && "Error: Touch() a cleared region before accessing its pixels!");
+		return depths[(y*width+ x)*samples + s];
 	}
-	const float& Depth(std::int32_t x, std::int32_t y) const {
-		return depths[y*width+ x];
+	const float& Depth(std::int32_t x, std::int32_t y, std::int32_t s = 0) const {
+        assert(!Cleared(x,y) && "Error: Touch() a cleared region before accessing its pixels!");
+		return depths[(y*width+ x)*samples + s];
 	}
 
-    //Write depth values to output stream in PPM format
+    //Fast clear: every pixel becomes 'color' at the farthest depth, without writing any memory.
+    //Each kClearTileSize tile is only flagged as cleared. The rasterizer fills a tile on first touch (see Touch and TileBuffer),
+    //and tiles that are never touched are written out as the clear color without their memory being read.
+    void Clear(const Color3f& color = Color3f(0.f,0.f,0.f)) {
+        clear_color_ = color;
+        clear_tiles_x_ = (width + kClearTileSize - 1)/kClearTileSize;
+        pending_.assign(static_cast<std::size_t>(clear_tiles_x_)*((height + kClearTileSize - 1)/kClearTileSize), 1);
+        any_pending_ = true;
+    }
+
+    //True if pixel (x,y) lies in a tile that is still cleared, i.e. its memory holds stale values.
+    [[nodiscard]] bool Cleared(std::int32_t x, std::int32_t y) const noexcept {
+        return any_pending_ && pending_[ClearTileIndex(x,y)];
+    }
+
+    //True if any pixel of 'region' is still cleared.
+    [[nodiscard]] bool Cleared(const Tile& region) const noexcept {
+        if(!any_pending_) return false;
+        for(auto ty = region.y0/kClearTileSize; ty*kClearTileSize < region.y1; ++ty) {
+            for(auto tx = region.x0/kClearTileSize; tx*kClearTileSize < region.x1; ++tx) {
+                if(pending_[ty*clear_tiles_x_ + tx]) return true;
+            }
+        }
+        return false;
+    }
+
+    [[nodiscard]] const Color3f& ClearColor() const noexcept { return clear_color_; }
+
+    //Fills the cleared tiles that overlap 'region', so that its pixels can be accessed directly.
+    //Regions touched concurrently must not share a kClearTileSize tile.
+    void Touch(const Tile& region) {
+        if(!any_pending_) return;
+        for(auto ty = region.y0/kClearTileSize; ty*kClearTileSize < region.y1; ++ty) {
+            for(auto tx = region.x0/kClearTileSize; tx*kClearTileSize < region.x1; ++tx) {
+                auto& pending = pending_[ty*clear_tiles_x_ + tx];
+                if(!pending) continue;
+                const auto x0 = tx*kClearTileSize;
+                const auto x1 = std::min(x0 + kClearTileSize, width);
+                for(auto y = ty*kClearTileSize; y < std::min((ty+1)*kClearTileSize, height); ++y) {
+                    const auto first = static_cast<std::size_t>(y*width + x0)*samples;
+                    const auto count = static_cast<std::size_t>(x1 - x0)*samples;
+                    std::fill_n(colors.begin() + first, count, clear_color_);
+                    std::fill_n(depths.begin() + first, count, std::numeric_limits<float>::lowest());
+                }
+                pending = 0;
+            }
+        }
+    }
+
+    //Fills every cleared tile. Call before handing 'colors' or 'depths' to code that reads them directly.
+    void Touch() {
+        if(!any_pending_) return;
+        Touch(Tile{0, 0, width, height});
+        any_pending_ = false;
+    }
+
+    //Marks the tiles of 'region' as filled, after the caller has overwritten every pixel of it (see TileBuffer::Store).
+    //'region' must be made of whole kClearTileSize tiles (cropped at the image border).
+    void MarkWritten(const Tile& region) {
+        if(!any_pending_) return;
+        assert(region.x0%kClearTileSize==0 && region.y0%kClearTileSize==0 && "Error: region is not aligned to kClearTileSize!");
+        assert((region.x1%kClearTileSize==0 || region.x1==width) && (region.y1%kClearTileSize==0 || region.y1==height) && "Error: region is not aligned to kClearTileSize!");
+        for(auto ty = region.y0/kClearTileSize; ty*kClearTileSize < region.y1; ++ty) {
+            for(auto tx = region.x0/kClearTileSize; tx*kClearTileSize < region.x1; ++tx) {
+                pending_[ty*clear_tiles_x_ + tx] = 0;
+            }
+        }
+    }
+
+    //Averages the samples of each pixel into a single-sampled buffer (a box filter). The resolved depth is the closest sample.
+    //Cleared tiles stay cleared in the result, so they are not read here either.
+    [[nodiscard]] FrameBuffer Resolve() const {
+        FrameBuffer out(height, width);
+        if(any_pending_) {
+            out.clear_color_ = clear_color_;
+            out.clear_tiles_x_ = clear_tiles_x_;
+            out.pending_ = pending_;
+            out.any_pending_ = true;
+        }
+        const auto weight = 1.f/static_cast<float>(samples);
+        for(std::size_t p = 0; p < out.colors.size(); ++p) {
+            if(Cleared(static_cast<std::int32_t>(p%width), static_cast<std::int32_t>(p/width))) continue;
+            Color3f sum{0.f,0.f,0.f};
+            float depth = std::numeric_limits<float>::lowest();
+            for(std::int32_t s = 0; s < samples; ++s) {
+                sum += colors[p*samples + s];
+                depth = std::max(depth, depths[p*samples + s]);
+            }
+            out.colors[p] = sum*weight;
+            out.depths[p] = depth;
+        }
+        return out;
+    }
+
+    //Write depth values to output stream in PPM format. Multisampled images must be resolved first.
     void WriteDepthsPPM(std::ofstream& out) {
+        assert(samples==1 && "Error: resolve a multisampled image before writing it!");
         out<<"P3\n"<<height<<" "<<width<<"\n255\n"; 
-        for(const auto& pixel : depths) {
-            out<<pixel<<'\n';
+        for(std::size_t i = 0; i < depths.size(); ++i) {
+            out<<(ClearedSample(i) ? std::numeric_limits<float>::lowest() : depths[i])<<'\n';
         }
     }
 
-    //Write color values to output stream in PPM format
+    //Write color values to output stream in PPM format. Multisampled images must be resolved first.
     void WriteColorsPPM(std::ofstream& out) { 
+        assert(samples==1 && "Error: resolve a multisampled image before writing it!");
         out<<"P3\n"<<height<<" "<<width<<"\n255\n"; 
-        for(const auto& [r,g,b] : colors) {
+        for(std::size_t i = 0; i < colors.size(); ++i) {
+            const auto& [r,g,b] = ClearedSample(i) ? clear_color_ : colors[i];
             out<< static_cast<int>(255.999*r)<< " "<< static_cast<int>(255.999*g)<<" "<<static_cast<int>(255.999*b)<<'\n'; //Scale and write to file
             }
     }
 
+private:
+    [[nodiscard]] std::size_t ClearTileIndex(std::int32_t x, std::int32_t y) const noexcept {
+        return static_cast<std::size_t>(y/kClearTileSize)*clear_tiles_x_ + x/kClearTileSize;
+    }
 
+    //Whether element i of 'colors' or 'depths' lies in a cleared tile
+    [[nodiscard]] bool ClearedSample(std::size_t i) const noexcept {
+        const auto pixel = i/samples;
+        return Cleared(static_cast<std::int32_t>(pixel%width), static_cast<std::int32_t>(pixel/width));
+    }
 
 public:
     std::int32_t height;
     std::int32_t width;
+    std::int32_t samples;
     std::vector<Color3f> colors;
     std::vector<float>   depths;
+
+private:
+    //Clear state (see Clear). pending_ holds one flag per kClearTileSize tile, row-major; a set flag means the tile's memory is stale.
+    Color3f clear_color_{0.f,0.f,0.f};
+    std::int32_t clear_tiles_x_{0};
+    std::vector<std::uint8_t> pending_;
+    bool any_pending_{false};
 };
 
+
+/// @brief Color and depth for one tile of a FrameBuffer, stored contiguously like on-chip tile memory.
+/// @brief A 64x64 tile is 64KB (256KB at 4x), small enough to stay in L2 while every triangle of the tile is drawn into it,
+/// @brief whereas the same pixels of a full-size FrameBuffer are spread over 64 rows of the image.
+/// @brief Addressed with image coordinates, so code that draws into a FrameBuffer can draw into a TileBuffer unchanged.
+class TileBuffer {
+public:
+    //Resizes the buffer for a tile of an image with 'samples' samples per pixel. Storage is reused; the contents are left
+    //unspecified until Load() or Clear().
+    void Reset(const Tile& t, std::int32_t s) {
+        tile = t;
+        samples = s;
+        width = t.x1 - t.x0;
+        const auto size = static_cast<std::size_t>(width)*(t.y1 - t.y0)*s;
+        colors.resize(size);
+        depths.resize(size);
+    }
+
+    //Sets every sample to 'color' at the farthest depth, like a new or cleared FrameBuffer.
+    void Clear(const Color3f& color = Color3f(0.f,0.f,0.f)) {
+        std::fill(colors.begin(), colors.end(), color);
+        std::fill(depths.begin(), depths.end(), std::numeric_limits<float>::lowest());
+    }
+
+    //Copies the tile's pixels in from an image. Pixels in cleared tiles of the image are set to the clear values instead of being read.
+    void Load(const FrameBuffer& image) {
+        assert(image.samples==samples);
+        const auto row = static_cast<std::size_t>(width)*samples;
+        const auto any_cleared = image.Cleared(tile);
+        for(auto y = tile.y0; y < tile.y1; ++y) {
+            const auto dst_row = static_cast<std::size_t>(y - tile.y0)*row;
+            ForEachClearSpan(image, any_cleared, y, [&](std::int32_t x0, std::int32_t x1, bool cleared) {
+                const auto src = static_cast<std::size_t>(y*image.width + x0)*samples;
+                const auto dst = dst_row + static_cast<std::size_t>(x0 - tile.x0)*samples;
+                const auto count = static_cast<std::size_t>(x1 - x0)*samples;
+                if(cleared) {
+                    std::fill_n(colors.begin() + dst, count, image.ClearColor());
+                    std::fill_n(depths.begin() + dst, count, std::numeric_limits<float>::lowest());
+                    return;
+                }
+                std::copy_n(image.colors.begin() + src, count, colors.begin() + dst);
+                std::copy_n(image.depths.begin() + src, count, depths.begin() + dst);
+            });
+        }
+    }
+
+    //Copies the tile's pixels back out to an image. Leaving out depth saves 4 of every 16 bytes written.
+    //Depth is still written where the image was cleared, since the tile now owns that memory. The tile must be aligned to kClearTileSize.
+    void Store(FrameBuffer& image, bool store_depth = true) const {
+        assert(image.samples==samples);
+        const auto row = static_cast<std::size_t>(width)*samples;
+        const auto any_cleared = image.Cleared(tile);
+        for(auto y = tile.y0; y < tile.y1; ++y) {
+            const auto src_row = static_cast<std::size_t>(y - tile.y0)*row;
+            ForEachClearSpan(image, any_cleared, y, [&](std::int32_t x0, std::int32_t x1, bool cleared) {
+                const auto src = src_row + static_cast<std::size_t>(x0 - tile.x0)*samples;
+                const auto dst = static_cast<std::size_t>(y*image.width + x0)*samples;
+                const auto count = static_cast<std::size_t>(x1 - x0)*samples;
+                std::copy_n(colors.begin() + src, count, image.colors.begin() + dst);
+                if(store_depth || cleared) std::copy_n(depths.begin() + src, count, image.depths.begin() + dst);
+            });
+        }
+        image.MarkWritten(tile);
+    }
+
+    //Color and depth of sample s of pixel (x,y), in image coordinates. The pixel must lie in the tile.
+    Color3f& Color(std::int32_t x, std::int32_t y, std::int32_t s = 0) {
+        return colors[Index(x,y,s)];
+    }
+    const Color3f& Color(std::int32_t x, std::int32_t y, std::int32_t s = 0) const {
+        return colors[Index(x,y,s)];
+    }
+    float& Depth(std::int32_t x, std::int32_t y, std::int32_t s = 0) {
+        return depths[Index(x,y,s)];
+    }
+    const float& Depth(std::int32_t x, std::int32_t y, std::int32_t s = 0) const {
+        return depths[Index(x,y,s)];
+    }
+
+private:
+    [[nodiscard]] std::size_t Index(std::int32_t x, std::int32_t y, std::int32_t s) const noexcept {
+        return static_cast<std::size_t>((y - tile.y0)*width + (x - tile.x0))*samples + s;
+    }
+
+    //Calls span(x0, x1, cleared) for the pieces of row y of the tile that lie in one kClearTileSize tile of the image each,
+    //or once for the whole row if nothing in the image is cleared.
+    //'any_cleared' is image.Cleared(tile), computed once per tile by the caller.
+    template<typename Span>
+    void ForEachClearSpan(const FrameBuffer& image, bool any_cleared, std::int32_t y, Span&& span) const {
+        if(!any_cleared) {
+            span(tile.x0, tile.x1, false);
+            return;
+        }
+        for(auto x0 = tile.x0; x0 < tile.x1;) {
+            const auto x1 = std::min((x0/kClearTileSize + 1)*kClearTileSize, tile.x1);
+            span(x0, x1, image.Cleared(x0, y));
+            x0 = x1;
+        }
+    }
+
+public:
+    Tile tile{0,0,0,0};
+    std::int32_t width{0}; //Of the tile
+    std::int32_t samples{1};
+    std::vector<Color3f> colors;
+    std::vector<float>   depths;
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <cura/buffer.h>
+#include <cura/math.h>
+
+//Block-compressed textures. Texels are stored in 4x4 blocks of fixed size that can be decoded independently,
+//so a lookup reads 8 or 16 bytes instead of a row of 12-byte Color3f texels.
+//The bit layouts follow BC1 (DXT1) and BC5 (two BC4 channels), so encoded blocks are compatible with GPU formats.
+
+enum class TextureFormat {
+    kBC1, //RGB. Two RGB565 endpoints and a 2-bit index per texel: 8 bytes per block (0.5 bytes per texel).
+    kBC5, //Two channels (RG). Per channel, two 8-bit endpoints and a 3-bit index per texel: 16 bytes per block (1 byte per texel).
+          //Meant for normal maps: the third channel is reconstructed as the z of a unit vector.
+};
+
+//Texels along each side of a block.
+inline constexpr std::int32_t kTextureBlockSize{4};
+
+namespace bc {
+
+//Packs a color with channels in [0,1] into RGB565.
+[[nodiscard]] inline std::uint16_t PackRGB565(const Color3f& c) {
+    const auto r = static_cast<std::uint16_t>(std::lround(std::clamp(c.x, 0.f, 1.f)*31.f));
+    const auto g = static_cast<std::uint16_t>(std::lround(std::clamp(c.y, 0.f, 1.f)*63.f));
+    const auto b = static_cast<std::uint16_t>(std::lround(std::clamp(c.z, 0.f, 1.f)*31.f));
+    return static_cast<std::uint16_t>((r<<11) | (g<<5) | b);
+}
+
+[[nodiscard]] inline Color3f UnpackRGB565(std::uint16_t c) {
+    return Color3f{static_cast<float>(c>>11)/31.f, static_cast<float>((c>>5) & 63)/63.f, static_cast<float>(c & 31)/31.f};
+}
+
+//The four colors a BC1 block can represent. Always uses the four-color mode: the encoder orders the endpoints so that c0 > c1.
+[[nodiscard]] inline std::array<Color3f,4> PaletteBC1(std::uint16_t c0, std::uint16_t c1) {
+    const auto a = UnpackRGB565(c0);
+    const auto b = UnpackRGB565(c1);
+    return {a, b, (2.f*a + b)/3.f, (a + 2.f*b)/3.f};
+}
+
+//Value of entry i of a BC4 palette with endpoints r0 > r1 (six interpolated values between them), in [0,1].
+[[nodiscard]] inline float PaletteBC4(std::uint8_t r0, std::uint8_t r1, std::uint32_t i) {
+    //Weight of r0, in sevenths, for each index
+    constexpr std::array<float,8> kweights{7.f, 0.f, 6.f, 5.f, 4.f, 3.f, 2.f, 1.f};
+    const auto w = kweights[i];
+    return (w*r0 + (7.f-w)*r1)/(7.f*255.f);
+}
+
+/// @brief Encodes 16 texels (row-major) as a BC1 block.
+/// @brief The endpoints are the extremes of the texels projected onto their principal axis, which is the usual 'range fit'.
+[[nodiscard]] inline std::uint64_t EncodeBC1(const std::array<Color3f,16>& texels) {
+    Color3f mean{0.f,0.f,0.f};
+    for(const auto& t : texels) mean += t;
+    mean /= 16.f;
+
+    //Principal axis of the colors, by power iteration on their covariance
+    std::array<float,6> cov{}; //xx, xy, xz, yy, yz, zz
+    for(const auto& t : texels) {
+        const auto d = t - mean;
+        cov[0] += d.x*d.x; cov[1] += d.x*d.y; cov[2] += d.x*d.z;
+        cov[3] += d.y*d.y; cov[4] += d.y*d.z; cov[5] += d.z*d.z;
+    }
+    Vec3f axis{1.f,1.f,1.f};
+    for(int i = 0; i < 8; ++i) {
+        const Vec3f next{cov[0]*axis.x + cov[1]*axis.y + cov[2]*axis.z,
+                         cov[1]*axis.x + cov[3]*axis.y + cov[4]*axis.z,
+                         cov[2]*axis.x + cov[4]*axis.y + cov[5]*axis.z};
+        const auto len = la::length(next);
+        if(len < 1e-12f) break; //Flat block: any axis will do
+        axis = next/len;
+    }
+
+    float lo = 0.f, hi = 0.f;
+    for(const auto& t : texels) {
+        const auto p = la::dot(t - mean, axis);
+        lo = std::min(lo, p);
+        hi = std::max(hi, p);
+    }
+    auto c0 = PackRGB565(mean + hi*axis);
+    auto c1 = PackRGB565(mean + lo*axis);
+    if(c0 < c1) std::swap(c0, c1);
+
+    std::uint64_t indices = 0;
+    if(c0 != c1) {
+        const auto palette = PaletteBC1(c0, c1);
+        for(std::uint32_t i = 0; i < 16; ++i) {
+            std::uint32_t best = 0;
+            float best_distance = la::length2(texels[i] - palette[0]);
+            for(std::uint32_t k = 1; k < 4; ++k) {
+                const auto distance = la::length2(texels[i] - palette[k]);
+                if(distance < best_distance) { best_distance = distance; best = k; }
+            }
+            indices |= static_cast<std::uint64_t>(best) << (2*i);
+        }
+    }
+    return static_cast<std::uint64_t>(c0) | (static_cast<std::uint64_t>(c1) << 16) | (indices << 32);
+}
+
+/// @brief Encodes 16 values in [0,1] (row-major) as a BC4 block, using the eight-value mode.
+[[nodiscard]] inline std::uint64_t EncodeBC4(const std::array<float,16>& values) {
+    const auto [lo_it, hi_it] = std::minmax_element(values.begin(), values.end());
+    const auto r0 = static_cast<std::uint8_t>(std::lround(std::clamp(*hi_it, 0.f, 1.f)*255.f));
+    const auto r1 = static_cast<std::uint8_t>(std::lround(std::clamp(*lo_it, 0.f, 1.f)*255.f));
+
+    std::uint64_t indices = 0;
+    if(r0 > r1) {
+        for(std::uint32_t i = 0; i < 16; ++i) {
+            //Position between the endpoints in sevenths, where step 0 is r0 (index 0), step 7 is r1 (index 1) and step k is index k+1
+            const auto t = (static_cast<float>(r0) - values[i]*255.f)/static_cast<float>(r0 - r1);
+            const auto step = static_cast<std::uint32_t>(std::clamp(std::lround(t*7.f), 0L, 7L));
+            const auto index = step==0 ? 0u : (step==7 ? 1u : step+1);
+            indices |= static_cast<std::uint64_t>(index) << (3*i);
+        }
+    }
+    return static_cast<std::uint64_t>(r0) | (static_cast<std::uint64_t>(r1) << 8) | (indices << 16);
+}
+
+[[nodiscard]] inline Color3f DecodeBC1(std::uint64_t block, std::uint32_t texel) {
+    const auto c0 = static_cast<std::uint16_t>(block);
+    const auto c1 = static_cast<std::uint16_t>(block >> 16);
+    const auto index = static_cast<std::uint32_t>(block >> (32 + 2*texel)) & 3u;
+    //Weight of c0 for each index. A table rather than a switch: indices vary from texel to texel, so a branch would mispredict often.
+    constexpr std::array<float,4> kweights{1.f, 0.f, 2.f/3.f, 1.f/3.f};
+    const auto w = kweights[index];
+    return w*UnpackRGB565(c0) + (1.f-w)*UnpackRGB565(c1);
+}
+
+[[nodiscard]] inline float DecodeBC4(std::uint64_t block, std::uint32_t texel) {
+    const auto r0 = static_cast<std::uint8_t>(block);
+    const auto r1 = static_cast<std::uint8_t>(block >> 8);
+    const auto index = static_cast<std::uint32_t>(block >> (16 + 3*texel)) & 7u;
+    return PaletteBC4(r0, r1, index);
+}
+
+} //namespace bc
+
+
+/// @brief An immutable texture stored in 4x4 compressed blocks.
+/// @brief Texels are decoded on the fly when sampled; nothing is ever decompressed in bulk.
+class CompressedTexture {
+public:
+    /// @brief Encodes a texture. Done once, at load time.
+    /// @brief Sizes that are not a multiple of 4 are padded by repeating the last row and column.
+    CompressedTexture(const FrameBuffer& image, TextureFormat format)
+        : height{image.height}, width{image.width}, format{format},
+          blocks_x_{(image.width + kTextureBlockSize - 1)/kTextureBlockSize},
+          blocks_y_{(image.height + kTextureBlockSize - 1)/kTextureBlockSize}
+    {
+        assert(image.samples==1);
+        const auto words = format==TextureFormat::kBC1 ? 1 : 2;
+        blocks_.resize(static_cast<std::size_t>(blocks_x_)*blocks_y_*words);
+
+        for(std::int32_t by = 0; by < blocks_y_; ++by) {
+            for(std::int32_t bx = 0; bx < blocks_x_; ++bx) {
+                std::array<Color3f,16> texels;
+                for(std::int32_t i = 0; i < 16; ++i) {
+                    const auto x = std::min(bx*kTextureBlockSize + i%kTextureBlockSize, width-1);
+                    const auto y = std::min(by*kTextureBlockSize + i/kTextureBlockSize, height-1);
+                    texels[i] = image.Color(x,y);
+                }
+                const auto block = static_cast<std::size_t>(by*blocks_x_ + bx)*words;
+                if(format==TextureFormat::kBC1) {
+                    blocks_[block] = bc::EncodeBC1(texels);
+                }
+                else {
+                    std::array<float,16> r, g;
+                    for(std::int32_t i = 0; i < 16; ++i) { r[i] = texels[i].x; g[i] = texels[i].y; }
+                    blocks_[block] = bc::EncodeBC4(r);
+                    blocks_[block+1] = bc::EncodeBC4(g);
+                }
+            }
+        }
+    }
+
+    //Decodes the texel at (x,y), top-left origin.
+    [[nodiscard]] Color3f Color(std::int32_t x, std::int32_t y) const {
+        const auto block = static_cast<std::size_t>((y/kTextureBlockSize)*blocks_x_ + x/kTextureBlockSize);
+        const auto texel = static_cast<std::uint32_t>((y%kTextureBlockSize)*kTextureBlockSize + x%kTextureBlockSize);
+        if(format==TextureFormat::kBC1) {
+            return bc::DecodeBC1(blocks_[block], texel);
+        }
+        //Two channels of a unit vector stored in [0,1]; rebuild the third
+        const auto r = bc::DecodeBC4(blocks_[2*block], texel);
+        const auto g = bc::DecodeBC4(blocks_[2*block+1], texel);
+        const auto nx = 2.f*r - 1.f;
+        const auto ny = 2.f*g - 1.f;
+        const auto nz = std::sqrt(std::max(1.f - nx*nx - ny*ny, 0.f));
+        return Color3f{r, g, 0.5f*(nz + 1.f)};
+    }
+
+    //Size of the encoded blocks
+    [[nodiscard]] std::size_t Bytes() const noexcept { return blocks_.size()*sizeof(std::uint64_t); }
+
+public:
+    std::int32_t height;
+    std::int32_t width;
+    TextureFormat format;
+
+private:
+    std::int32_t blocks_x_;
+    std::int32_t blocks_y_;
+    std::vector<std::uint64_t> blocks_; //One word per BC1 block; two per BC5 block (red, then green)
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+//Storage formats for reverse-Z depth (see ReverseZPerspectiveProjection): values in [0,1], 1 at the near plane, greater wins.
+enum class DepthFormat {
+    kFloat32,         //32-bit float
+    kUnorm24Stencil8, //24-bit unsigned normalized depth in the high bits, 8-bit stencil in the low bits
+    kUnorm16,         //16-bit unsigned normalized depth. Half the bandwidth of the others.
+};
+
+[[nodiscard]] inline constexpr std::size_t BytesPerDepth(DepthFormat format) noexcept {
+    return format==DepthFormat::kUnorm16 ? 2 : 4;
+}
+
+/// @brief A depth (and optionally stencil) buffer for reverse-Z depth, in one of the DepthFormat layouts.
+/// @brief Every format is compared as unsigned integers: unorm values trivially, and float32 through its bit pattern, which orders
+/// @brief non-negative floats correctly. So the test is the same few integer instructions per pixel in every format, and the
+/// @brief fixed-width loops in Test() vectorize.
+class DepthBuffer {
+public:
+    //Cleared to the far plane (0).
+    DepthBuffer(std::int32_t h, std::int32_t w, DepthFormat f = DepthFormat::kFloat32)
+        : height{h}, width{w}, format{f}
+    {
+        const auto size = static_cast<std::size_t>(h)*w;
+        if(format==DepthFormat::kUnorm16) data16_.resize(size, 0);
+        else data32_.resize(size, 0);
+    }
+
+    //Sets every pixel to 'depth' (0 is the far plane) and 'stencil'. The stencil is only stored by kUnorm24Stencil8.
+    void Clear(float depth = 0.f, std::uint8_t stencil = 0) {
+        switch(format) {
+        case DepthFormat::kFloat32: std::ranges::fill(data32_, EncodeFloat32(depth)); break;
+        case DepthFormat::kUnorm24Stencil8: std::ranges::fill(data32_, EncodeUnorm24(depth) | stencil); break;
+        case DepthFormat::kUnorm16: std::ranges::fill(data16_, EncodeUnorm16(depth)); break;
+        }
+    }
+
+    //Depth of pixel (x,y), decoded to [0,1].
+    [[nodiscard]] float Depth(std::int32_t x, std::int32_t y) const {
+        const auto i = Index(x,y);
+        switch(format) {
+        case DepthFormat::kFloat32: return std::bit_cast<float>(data32_[i]);
+        case DepthFormat::kUnorm24Stencil8: return static_cast<float>(data32_[i] >> 8)*(1.f/kmax24);
+        case DepthFormat::kUnorm16: return static_cast<float>(data16_[i])*(1.f/kmax16);
+        }
+        return 0.f;
+    }
+
+    [[nodiscard]] std::uint8_t Stencil(std::int32_t x, std::int32_t y) const {
+        return format==DepthFormat::kUnorm24Stencil8 ? static_cast<std::uint8_t>(data32_[Index(x,y)]) : 0;
+    }
+
+    /// @brief Depth-tests the pixels (x+i, y) for i < count against 'depth[i]': a fragment passes if it is at least as close as what is stored.
+    /// @brief Lanes whose bit in 'mask' is clear are neither tested nor written. Depth writes keep the stencil.
+    /// @param count Lanes that lie in the image, at most N. Only these pixels are read or written, so concurrent tests of other pixels are safe.
+    /// @param write Store the depth of passing lanes.
+    /// @return Mask of the lanes that passed.
+    template<std::size_t N>
+    std::uint32_t Test(std::int32_t x, std::int32_t y, std::size_t count, const std::array<float,N>& depth, std::uint32_t mask, bool write = true) {
+        static_assert(N<=32);
+        assert(count<=N && x + static_cast<std::int32_t>(count)<=width);
+        const auto i = Index(x,y);
+        switch(format) {
+        case DepthFormat::kFloat32:
+            return TestLanes(data32_.data() + i, count, depth, mask, write, EncodeFloat32,
+                             [](std::uint32_t stored) { return stored; },
+                             [](std::uint32_t encoded, std::uint32_t) { return encoded; });
+        case DepthFormat::kUnorm24Stencil8:
+            return TestLanes(data32_.data() + i, count, depth, mask, write, EncodeUnorm24,
+                             [](std::uint32_t stored) { return stored & ~0xffu; },
+                             [](std::uint32_t encoded, std::uint32_t stored) { return encoded | (stored & 0xffu); });
+        case DepthFormat::kUnorm16:
+            return TestLanes(data16_.data() + i, count, depth, mask, write, EncodeUnorm16,
+                             [](std::uint16_t stored) { return stored; },
+                             [](std::uint16_t encoded, std::uint16_t) { return encoded; });
+        }
+        return 0;
+    }
+
+    //Bytes of depth storage
+    [[nodiscard]] std::size_t Bytes() const noexcept { return static_cast<std::size_t>(height)*width*BytesPerDepth(format); }
+
+private:
+    static constexpr float kmax24{16777215.f};
+    static constexpr float kmax16{65535.f};
+
+    //Depths are clamped to [0,1], which also keeps float32 bit patterns non-negative and so ordered as integers
+    [[nodiscard]] static std::uint32_t EncodeFloat32(float d) { return std::bit_cast<std::uint32_t>(std::clamp(d, 0.f, 1.f)); }
+    [[nodiscard]] static std::uint32_t EncodeUnorm24(float d) { return static_cast<std::uint32_t>(std::clamp(d, 0.f, 1.f)*kmax24 + 0.5f) << 8; }
+    [[nodiscard]] static std::uint16_t EncodeUnorm16(float d) { return static_cast<std::uint16_t>(std::clamp(d, 0.f, 1.f)*kmax16 + 0.5f); }
+
+    [[nodiscard]] std::size_t Index(std::int32_t x, std::int32_t y) const noexcept { return static_cast<std::size_t>(y)*width + x; }
+
+    //The test for one format. Encoding and comparing run over all N lanes unconditionally; only loads and stores are limited to 'count'.
+    //Key() strips bits that are not depth from a stored value, Merge() combines a new depth with the bits it must keep.
+    template<std::size_t N, typename T, typename Encode, typename Key, typename Merge>
+    [[nodiscard]] static std::uint32_t TestLanes(T* stored, std::size_t count, const std::array<float,N>& depth, std::uint32_t mask, bool write,
+                                                 Encode encode, Key key, Merge merge) {
+        std::array<T,N> encoded, keys{};
+        if(count==N) {
+            for(std::size_t i = 0; i < N; ++i) keys[i] = key(stored[i]);
+        }
+        else {
+            for(std::size_t i = 0; i < count; ++i) keys[i] = key(stored[i]);
+        }
+        for(std::size_t i = 0; i < N; ++i) encoded[i] = encode(depth[i]);
+        std::uint32_t passed = 0;
+        for(std::size_t i = 0; i < N; ++i) passed |= static_cast<std::uint32_t>(encoded[i] >= keys[i]) << i;
+        passed &= count==N ? mask : mask & ((1u << count) - 1u);
+
+        if(write) {
+            for(std::size_t i = 0; i < count; ++i) {
+                if(passed >> i & 1u) stored[i] = merge(encoded[i], stored[i]);
+            }
+        }
+        return passed;
+    }
+
+public:
+    std::int32_t height;
+    std::int32_t width;
+    DepthFormat format;
+
+private:
+    std::vector<std::uint32_t> data32_; //kFloat32 and kUnorm24Stencil8
+    std::vector<std::uint16_t> data16_; //kUnorm16
+};
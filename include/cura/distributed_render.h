@@ -0,0 +1,364 @@
+#pragma once
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <cura/buffer.h>
+#include <cura/json.h>
+#include <cura/render_server.h>
+#include <cura/socket.h>
+#include <cura/tile_codec.h>
+
+//Rendering spread over several render_server processes, on this machine or others. A coordinator splits frames into work items,
+//sends each to a worker as a region job (see render_server.h), and assembles the returned pixels into FrameBuffers.
+
+//How frames are divided into work items.
+enum class WorkSplit {
+    kFrames, //One item per frame. Suits long sequences of frames that each fit on a worker.
+    kTiles   //Square regions of each frame. Suits a few huge frames, and lets shadowless frames use every worker.
+};
+
+struct DistributedOptions {
+    WorkSplit split{WorkSplit::kFrames};
+    std::int32_t tile_size{4*kDefaultTileSize}; //Side of a work item in kTiles mode. A multiple of kDefaultTileSize.
+    std::size_t in_flight{2};    //Items sent to a worker before waiting for a reply, so that it never idles between items
+    std::size_t max_attempts{3}; //Tries per item, across all workers, before the render fails
+    std::size_t reconnects{2};   //Times a worker whose connection failed is reconnected before it is given up
+    std::chrono::milliseconds reconnect_delay{200};
+    //A worker with items outstanding that sends nothing for this long is given up and its items requeued. Zero waits forever.
+    std::chrono::milliseconds reply_timeout{60000};
+};
+
+struct WorkerStats {
+    std::string address;
+    std::size_t items{0};         //Items rendered
+    std::size_t failures{0};      //Items that failed on this worker, or were outstanding when its connection failed
+    std::uint64_t pixels{0};      //Pixels rendered
+    std::uint64_t bytes{0};       //Encoded pixel data received
+    double render_ms{0.};         //Rendering and encoding time reported by the worker
+    bool lost{false};             //The worker could not be reached, or stopped replying, and was given up
+
+    //Throughput over the 'wall_ms' of a render
+    [[nodiscard]] double PixelsPerSecond(double wall_ms) const { return wall_ms > 0. ? 1000.*static_cast<double>(pixels)/wall_ms : 0.; }
+};
+
+struct DistributedStats {
+    std::vector<WorkerStats> workers;
+    std::size_t items{0};
+    std::size_t retries{0};
+    std::uint64_t raw_bytes{0};     //Size of the received pixels as 8-bit RGB
+    std::uint64_t encoded_bytes{0}; //What was sent for them
+    double wall_ms{0.};
+
+    [[nodiscard]] double CompressionRatio() const { return encoded_bytes > 0 ? static_cast<double>(raw_bytes)/static_cast<double>(encoded_bytes) : 0.; }
+};
+
+/// @brief Coordinates a render over a set of worker processes (render_server listening on a Unix socket path or host:port).
+/// @brief Each worker gets its own connection and thread. Items are handed out from a shared queue, so faster workers take more of them.
+/// @brief An item that fails, or was outstanding on a connection that broke, goes back to the queue for any worker to retry.
+class DistributedRenderer {
+public:
+    //Called on the calling thread of Render() as each frame is complete, in the order frames complete.
+    using FrameFn = std::function<void(std::size_t frame, FrameBuffer& image)>;
+
+    DistributedRenderer(std::vector<std::string> workers, DistributedOptions options = {})
+        : addresses_{std::move(workers)}, options_{options}
+    {
+        assert(options_.tile_size>0 && options_.tile_size%kDefaultTileSize==0 && "Error: work item size must be a multiple of kDefaultTileSize!");
+    }
+
+    /// @brief Renders jobs (in the render server's format; "output" is ignored) and hands each finished frame to 'done'.
+    /// @return False if a job is invalid, an item failed max_attempts times, or every worker was lost. The reason is on std::cerr.
+    bool Render(std::span<const JsonValue> jobs, const FrameFn& done) {
+        const auto start = std::chrono::steady_clock::now();
+        if(!Plan(jobs)) return false;
+
+        std::vector<std::thread> drivers;
+        live_ = addresses_.size();
+        for(std::size_t w = 0; w < addresses_.size(); ++w) drivers.emplace_back([this, w]{ Drive(w); });
+
+        //Hand frames over as they complete, until every frame is done or the render has failed
+        bool ok = true;
+        for(std::size_t delivered = 0; delivered < frames_.size();) {
+            std::unique_lock lock(mutex_);
+            changed_.wait(lock, [this]{ return !ready_.empty() || failed_; });
+            if(failed_) {
+                ok = false;
+                break;
+            }
+            const auto frame = ready_.front();
+            ready_.pop_front();
+            lock.unlock();
+            done(frame, *frames_[frame].image);
+            frames_[frame].image.reset();
+            ++delivered;
+        }
+        {
+            std::scoped_lock lock(mutex_);
+            finished_ = true;
+        }
+        changed_.notify_all();
+        for(auto& driver : drivers) driver.join();
+        if(!ok) std::cerr<<"Error: distributed render failed: "<<error_<<"\n";
+
+        stats_.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return ok;
+    }
+
+    //Renders a single frame and returns it.
+    [[nodiscard]] std::optional<FrameBuffer> RenderFrame(const JsonValue& job) {
+        std::optional<FrameBuffer> result;
+        if(!Render(std::span(&job, 1), [&](std::size_t, FrameBuffer& image) { result = std::move(image); })) return std::nullopt;
+        return result;
+    }
+
+    //Of the last Render()
+    [[nodiscard]] const DistributedStats& Stats() const noexcept { return stats_; }
+
+private:
+    struct Item {
+        std::size_t frame;
+        Tile region;
+        std::size_t attempts{0};
+    };
+
+    struct Frame {
+        JsonValue request; //The job, without its output
+        std::int32_t height;
+        std::int32_t width;
+        std::size_t remaining; //Items not yet assembled
+        std::optional<FrameBuffer> image;
+    };
+
+    //Validates the jobs and splits them into items.
+    bool Plan(std::span<const JsonValue> jobs) {
+        frames_.clear();
+        items_.clear();
+        queue_.clear();
+        ready_.clear();
+        failed_ = false;
+        finished_ = false;
+        error_.clear();
+        stats_ = DistributedStats{};
+        for(const auto& address : addresses_) stats_.workers.push_back(WorkerStats{address});
+        if(addresses_.empty()) {
+            std::cerr<<"Error: no workers to render on\n";
+            return false;
+        }
+
+        for(std::size_t f = 0; f < jobs.size(); ++f) {
+            if(!jobs[f].Members()) {
+                std::cerr<<"Error in job "<<f<<": a job must be a JSON object\n";
+                return false;
+            }
+            //Workers are sent the job without its output; the region is added per item
+            auto request = jobs[f];
+            std::erase_if(std::get<JsonValue::Object>(request.value), [](const auto& member) { return member.first=="output" || member.first=="region"; });
+            auto checked = request;
+            checked.Set("output", JsonValue{std::string{}});
+            std::string error;
+            const auto job = ParseRenderJob(checked, error);
+            if(!job) {
+                std::cerr<<"Error in job "<<f<<": "<<error<<"\n";
+                return false;
+            }
+            if(job->light && options_.split==WorkSplit::kTiles) {
+                std::cerr<<"Error in job "<<f<<": shadows need whole frames, split by frames instead\n";
+                return false;
+            }
+            const auto size = options_.split==WorkSplit::kTiles ? options_.tile_size : std::max(job->width, job->height);
+            const auto regions = SplitIntoTiles(job->height, job->width, size);
+            for(const auto& region : regions) {
+                queue_.push_back(items_.size());
+                items_.push_back(Item{f, region});
+            }
+            frames_.push_back(Frame{std::move(request), job->height, job->width, regions.size(), std::nullopt});
+        }
+        stats_.items = items_.size();
+        return true;
+    }
+
+    [[nodiscard]] std::string Request(std::size_t item) const {
+        const auto& [frame, region, attempts] = items_[item];
+        auto request = frames_[frame].request;
+        request.Set("id", JsonValue{"item " + std::to_string(item)});
+        request.Set("region", JsonValue{JsonValue::Array{JsonValue{static_cast<double>(region.x0)}, JsonValue{static_cast<double>(region.y0)},
+                                                         JsonValue{static_cast<double>(region.x1)}, JsonValue{static_cast<double>(region.y1)}}});
+        std::string line;
+        AppendJson(line, request);
+        line += '\n';
+        return line;
+    }
+
+    //Puts an item back in the queue, or fails the render if it has used up its attempts. Called with mutex_ held.
+    void Retry(std::size_t item, std::string_view reason) {
+        if(++items_[item].attempts >= options_.max_attempts) {
+            if(!failed_) error_ = "item " + std::to_string(item) + " of frame " + std::to_string(items_[item].frame) + " failed: " + std::string(reason);
+            failed_ = true;
+        }
+        else {
+            ++stats_.retries;
+            queue_.push_front(item);
+        }
+        changed_.notify_all();
+    }
+
+    //Decodes a reply and copies its pixels into the frame. Returns an error message on failure.
+    std::optional<std::string> Assemble(std::size_t item, const JsonValue& reply, WorkerStats& stats) {
+        const auto* ok = reply.Find("ok");
+        if(!ok || !ok->Bool() || !*ok->Bool()) {
+            const auto* error = reply.Find("error");
+            return error && error->String() ? *error->String() : std::string("the worker failed");
+        }
+        const auto& [frame_index, region, attempts] = items_[item];
+        const auto* encoded = reply.Find("pixels");
+        if(!encoded || !encoded->String()) return std::string("the reply has no pixels");
+        const auto width = region.x1 - region.x0;
+        const auto pixels = static_cast<std::size_t>(width)*(region.y1 - region.y0);
+        const auto runs = DecodeBase64(*encoded->String());
+        const auto rgb = runs ? DecodePixelRuns(*runs, pixels) : std::nullopt;
+        if(!rgb) return std::string("the reply's pixels are malformed");
+
+        FrameBuffer* image;
+        {
+            std::scoped_lock lock(mutex_);
+            auto& frame = frames_[frame_index];
+            if(!frame.image) frame.image.emplace(frame.height, frame.width);
+            image = &*frame.image;
+        }
+        //Items of a frame cover disjoint pixels, so they are copied in without holding the lock
+        for(auto y = region.y0; y < region.y1; ++y) {
+            for(auto x = region.x0; x < region.x1; ++x) {
+                const auto i = 3*(static_cast<std::size_t>(y - region.y0)*width + (x - region.x0));
+                image->Color(x,y) = Color3f{(*rgb)[i]/255.f, (*rgb)[i+1]/255.f, (*rgb)[i+2]/255.f};
+            }
+        }
+
+        std::scoped_lock lock(mutex_);
+        ++stats.items;
+        stats.pixels += pixels;
+        stats.bytes += encoded->String()->size();
+        stats_.raw_bytes += 3*pixels;
+        stats_.encoded_bytes += encoded->String()->size();
+        for(const auto* key : {"render_ms", "write_ms"}) {
+            if(const auto* ms = reply.Find(key); ms && ms->Number()) stats.render_ms += *ms->Number();
+        }
+        if(--frames_[frame_index].remaining==0) {
+            ready_.push_back(frame_index);
+            changed_.notify_all();
+        }
+        return std::nullopt;
+    }
+
+    //The thread of one worker: keeps up to in_flight items outstanding on its connection and reconnects when it breaks.
+    void Drive(std::size_t w) {
+        auto& stats = stats_.workers[w];
+        for(std::size_t reconnects = 0;; ++reconnects) {
+            if(reconnects > 0) std::this_thread::sleep_for(options_.reconnect_delay);
+            {
+                std::scoped_lock lock(mutex_);
+                if(finished_ || failed_) return;
+            }
+            if(reconnects > options_.reconnects) break;
+            const int fd = ConnectTo(addresses_[w]);
+            if(fd < 0) continue;
+            SetTimeout(fd, options_.reply_timeout);
+
+            LineReader reader(fd);
+            std::map<std::string, std::size_t> outstanding; //Request id to item
+            std::string reason = "lost the connection";
+            bool hung = false;
+            for(;;) {
+                //Top up the worker, or wait for work if there is none and nothing is outstanding
+                std::string requests;
+                {
+                    std::unique_lock lock(mutex_);
+                    if(outstanding.empty()) changed_.wait(lock, [this]{ return !queue_.empty() || finished_ || failed_; });
+                    if(finished_ || failed_) break;
+                    while(outstanding.size() < std::max<std::size_t>(options_.in_flight, 1) && !queue_.empty()) {
+                        const auto item = queue_.front();
+                        queue_.pop_front();
+                        outstanding.emplace("item " + std::to_string(item), item);
+                        requests += Request(item);
+                    }
+                }
+                if(!requests.empty() && !SendAll(fd, requests)) break;
+
+                std::string line;
+                if(!reader.ReadLine(line)) {
+                    hung = reader.TimedOut();
+                    if(hung) reason = "no reply within the timeout";
+                    break;
+                }
+                std::string error;
+                const auto reply = ParseJson(line, &error);
+                const auto* id = reply ? reply->Find("id") : nullptr;
+                const auto it = id && id->String() ? outstanding.find(*id->String()) : outstanding.end();
+                if(it==outstanding.end()) {
+                    reason = "unexpected reply";
+                    break;
+                }
+                const auto item = it->second;
+                outstanding.erase(it);
+                if(const auto failure = Assemble(item, *reply, stats)) {
+                    std::scoped_lock lock(mutex_);
+                    ++stats.failures;
+                    Retry(item, *failure);
+                }
+            }
+            ::close(fd);
+
+            std::scoped_lock lock(mutex_);
+            for(const auto& [id, item] : outstanding) {
+                ++stats.failures;
+                Retry(item, reason);
+            }
+            if(finished_ || failed_) return;
+            if(hung) break; //Reachable but not working: reconnecting would only hand it more items to sit on
+            reconnects = 0; //It was reachable; only consecutive failures to connect count
+        }
+
+        //Given up. If it was the last worker, nothing can finish the remaining items.
+        std::scoped_lock lock(mutex_);
+        stats.lost = true;
+        if(--live_==0 && !finished_ && !failed_) {
+            error_ = "every worker was lost";
+            failed_ = true;
+        }
+        changed_.notify_all();
+    }
+
+private:
+    std::vector<std::string> addresses_;
+    DistributedOptions options_;
+
+    std::mutex mutex_; //Guards everything below, except the pixels of frames being assembled
+    std::condition_variable changed_;
+    std::vector<Frame> frames_;
+    std::vector<Item> items_;
+    std::deque<std::size_t> queue_; //Items waiting for a worker
+    std::deque<std::size_t> ready_; //Frames complete but not yet handed over
+    std::size_t live_{0};           //Workers not yet given up
+    bool failed_{false};
+    bool finished_{false};
+    std::string error_;
+    DistributedStats stats_;
+};
+
+#endif
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cura/buffer.h>
+#include <cura/camera.h>
+#include <cura/light.h>
+#include <cura/math.h>
+#include <cura/scene.h>
+#include <cura/shadow.h>
+#include <cura/thread_pool.h>
+
+//Wall-clock time spent in one pass of a frame graph.
+struct PassTiming {
+    std::string name;
+    double start_ms{0.};    //Since Execute() was called
+    double duration_ms{0.};
+};
+
+struct FrameGraphTimings {
+    std::vector<PassTiming> passes; //In the order the passes were added
+    double wall_ms{0.};             //From the start of Execute() to the end of the last pass
+
+    //Time spent in passes. Divided by wall_ms this is how many passes ran at once on average.
+    [[nodiscard]] double BusyMs() const {
+        return std::accumulate(passes.begin(), passes.end(), 0., [](double sum, const PassTiming& p) { return sum + p.duration_ms; });
+    }
+};
+
+/// @brief A set of render passes that declare the resources they read and write, run as a dependency graph on a ThreadPool.
+/// @brief Resources are just names for whatever the passes share (a shadow map, a framebuffer, a file); the graph does not own them.
+/// @brief Dependencies follow the order passes are added in, as if they ran one after another: a pass runs after the last earlier pass
+/// @brief that wrote anything it reads or writes, and after every earlier pass that read something it writes since it was last written.
+/// @brief Passes with no path between them run concurrently, so work that sequential passes would serialize (a shadow map and the color
+/// @brief pass it does not feed, or writing out the previous frame while the next renders) overlaps instead of leaving cores idle.
+/// @brief Passes may use the pool themselves (e.g. ParallelFor), which is safe from inside a pass.
+class FrameGraph {
+public:
+    using ResourceId = std::size_t;
+    using PassId = std::size_t;
+    using PassFn = std::function<void(ThreadPool& pool)>;
+
+    [[nodiscard]] ResourceId AddResource(std::string name) {
+        resources_.push_back(Resource{std::move(name), kNoPass, {}});
+        return resources_.size() - 1;
+    }
+
+    PassId AddPass(std::string name, const std::vector<ResourceId>& reads, const std::vector<ResourceId>& writes, PassFn run) {
+        const auto id = passes_.size();
+        Pass pass{std::move(name), std::move(run), {}, {}};
+        const auto depend = [&](PassId on) {
+            if(on==kNoPass || std::find(pass.dependencies.begin(), pass.dependencies.end(), on)!=pass.dependencies.end()) return;
+            pass.dependencies.push_back(on);
+        };
+        for(const auto r : reads) {
+            assert(r < resources_.size() && "Error: unknown frame graph resource!");
+            depend(resources_[r].writer);
+        }
+        for(const auto w : writes) {
+            assert(w < resources_.size() && "Error: unknown frame graph resource!");
+            depend(resources_[w].writer);
+            for(const auto reader : resources_[w].readers) depend(reader);
+        }
+        for(const auto d : pass.dependencies) passes_[d].dependents.push_back(id);
+        passes_.push_back(std::move(pass));
+
+        //A pass that reads and writes a resource is its writer
+        for(const auto r : reads) resources_[r].readers.push_back(id);
+        for(const auto w : writes) {
+            resources_[w].writer = id;
+            resources_[w].readers.clear();
+        }
+        return id;
+    }
+
+    [[nodiscard]] const std::vector<PassId>& Dependencies(PassId pass) const { return passes_[pass].dependencies; }
+    [[nodiscard]] std::size_t PassCount() const noexcept { return passes_.size(); }
+
+    /// @brief Runs every pass once and waits for them all. Each pass is queued on the pool as soon as its dependencies have finished.
+    /// @brief Must not be called from a task of 'pool': the caller only waits, so it would hold a worker the passes may need.
+    /// @brief If passes throw, the passes that depend on them are skipped and the first exception (in pass order) is rethrown.
+    FrameGraphTimings Execute(ThreadPool& pool) {
+        using Clock = std::chrono::steady_clock;
+        const auto start = Clock::now();
+        const auto since_start = [&](Clock::time_point t) { return std::chrono::duration<double, std::milli>(t - start).count(); };
+
+        struct PassState {
+            std::size_t waiting_on{0}; //Dependencies that have not finished
+            bool skip{false};          //A dependency failed
+            std::exception_ptr error;
+            std::future<void> done;
+        };
+        std::vector<PassState> states(passes_.size());
+        FrameGraphTimings timings;
+        timings.passes.resize(passes_.size());
+        std::mutex mutex; //Guards every PassState and 'remaining'
+        std::condition_variable finished;
+        auto remaining = passes_.size();
+
+        //Called with 'mutex' held
+        std::function<void(PassId)> submit = [&](PassId id) {
+            states[id].done = pool.Submit([&, id] {
+                auto& pass = passes_[id];
+                auto& timing = timings.passes[id];
+                timing.name = pass.name;
+                bool skip;
+                {
+                    std::scoped_lock lock(mutex);
+                    skip = states[id].skip;
+                }
+                std::exception_ptr error;
+                const auto pass_start = Clock::now();
+                if(!skip) {
+                    try {
+                        pass.run(pool);
+                    }
+                    catch(...) {
+                        error = std::current_exception();
+                    }
+                }
+                const auto pass_end = Clock::now();
+                timing.start_ms = since_start(pass_start);
+                timing.duration_ms = skip ? 0. : std::chrono::duration<double, std::milli>(pass_end - pass_start).count();
+
+                std::scoped_lock lock(mutex);
+                states[id].error = error;
+                for(const auto dependent : pass.dependents) {
+                    if(skip || error) states[dependent].skip = true;
+                    if(--states[dependent].waiting_on==0) submit(dependent);
+                }
+                if(--remaining==0) finished.notify_all();
+            });
+        };
+
+        {
+            std::unique_lock lock(mutex);
+            for(PassId id = 0; id < passes_.size(); ++id) states[id].waiting_on = passes_[id].dependencies.size();
+            for(PassId id = 0; id < passes_.size(); ++id) {
+                if(states[id].waiting_on==0) submit(id);
+            }
+            finished.wait(lock, [&] { return remaining==0; });
+        }
+        timings.wall_ms = since_start(Clock::now());
+
+        for(auto& state : states) {
+            state.done.wait();
+            if(state.error) std::rethrow_exception(state.error);
+        }
+        return timings;
+    }
+
+private:
+    static constexpr PassId kNoPass{static_cast<PassId>(-1)};
+
+    struct Resource {
+        std::string name;
+        PassId writer;                //Last pass to write it
+        std::vector<PassId> readers;  //Passes that read it since
+    };
+
+    struct Pass {
+        std::string name;
+        PassFn run;
+        std::vector<PassId> dependencies;
+        std::vector<PassId> dependents;
+    };
+
+    std::vector<Resource> resources_;
+    std::vector<Pass> passes_;
+};
+
+
+//What changes from one frame of a shadowed sequence to the next.
+struct ShadowedFrameSetup {
+    Camera camera;
+    DistantLight light;
+};
+
+/// @brief Renders a sequence of frames of a scene lit by a distant light, with a frame graph per frame:
+/// @brief the shadow map and color pass of a frame run concurrently, the shadows are applied once both are done, and the frame is
+/// @brief written out while the next frame renders. Two framebuffers and shadow maps alternate between consecutive frames.
+/// @param setup Called on the calling thread, once per frame and in frame order, before the frame renders.
+/// @param write Called once per frame, in frame order, on a worker of 'pool'.
+/// @return The timings of each frame's graph. Graph i renders frame i and writes frame i-1; there is one more graph than frames.
+inline std::vector<FrameGraphTimings> RenderShadowedFrames(const Scene& scene, std::int32_t frame_count, const std::function<ShadowedFrameSetup(std::int32_t frame)>& setup,
+                                                          const Mat44f& projection, float near, float far, std::int32_t height, std::int32_t width,
+                                                          std::int32_t shadow_size, std::int32_t pcf_radius, ThreadPool& pool,
+                                                          const std::function<void(std::int32_t frame, const FrameBuffer& image)>& write) {
+    std::array<FrameBuffer, 2> images{FrameBuffer{height, width}, FrameBuffer{height, width}};
+    std::array<ShadowMap, 2> maps;
+    std::vector<FrameGraphTimings> timings;
+
+    for(std::int32_t frame = 0; frame <= frame_count; ++frame) {
+        FrameGraph graph;
+        const auto slot = static_cast<std::size_t>(frame%2);
+        if(frame > 0) {
+            const auto previous = graph.AddResource("image " + std::to_string(frame - 1));
+            graph.AddPass("write " + std::to_string(frame - 1), {previous}, {}, [&](ThreadPool&) {
+                write(frame - 1, images[1 - slot]);
+            });
+        }
+
+        std::optional<ShadowedFrameSetup> current;
+        if(frame < frame_count) {
+            current = setup(frame);
+            const auto suffix = " " + std::to_string(frame);
+            const auto image = graph.AddResource("image" + suffix);
+            const auto map = graph.AddResource("shadow map" + suffix);
+            graph.AddPass("shadow map" + suffix, {}, {map}, [&](ThreadPool& p) {
+                maps[slot] = RenderShadowMap(scene, current->light, shadow_size, p);
+            });
+            graph.AddPass("color" + suffix, {}, {image}, [&](ThreadPool& p) {
+                images[slot].Clear();
+                DrawScene(scene, current->camera, projection, near, far, images[slot], p);
+            });
+            graph.AddPass("shadows" + suffix, {map}, {image}, [&](ThreadPool& p) {
+                ApplyShadows(images[slot], current->camera.view, projection, maps[slot], current->light, pcf_radius, p);
+            });
+        }
+        timings.push_back(graph.Execute(pool));
+    }
+    return timings;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <cura/buffer.h>
+#include <cura/thread_pool.h>
+
+/// @brief A recycling pool of framebuffers of one size.
+/// @brief Buffers handed back via Release are reused by the next Acquire instead of being reallocated.
+class FrameBufferPool {
+public:
+    FrameBufferPool(std::int32_t h, std::int32_t w)
+        : height_{h}, width_{w} {}
+
+    //Returns a buffer with cleared colors and depths. A recycled buffer is fast-cleared (see FrameBuffer::Clear), so its memory is only
+    //rewritten where the next frame draws.
+    [[nodiscard]] std::unique_ptr<FrameBuffer> Acquire() {
+        {
+            std::scoped_lock lock(mutex_);
+            if(!free_.empty()) {
+                auto buffer = std::move(free_.back());
+                free_.pop_back();
+                buffer->Clear();
+                return buffer;
+            }
+        }
+        return std::make_unique<FrameBuffer>(height_, width_);
+    }
+
+    void Release(std::unique_ptr<FrameBuffer> buffer) {
+        assert(buffer && buffer->height==height_ && buffer->width==width_);
+        std::scoped_lock lock(mutex_);
+        free_.push_back(std::move(buffer));
+    }
+
+private:
+    std::int32_t height_;
+    std::int32_t width_;
+    std::vector<std::unique_ptr<FrameBuffer>> free_;
+    std::mutex mutex_;
+};
+
+
+//How the cores are spent when rendering a batch of frames.
+enum class FrameParallelism {
+    kIntraFrame, //Frames are rendered one after another, each split into tiles rendered in parallel.
+    kInterFrame  //Several whole frames are rendered at once, each on a single thread.
+};
+
+/// @brief Picks a parallelisation strategy for a batch of frames.
+/// @brief Inter-frame parallelism has no per-tile overhead and scales perfectly, but needs enough frames to keep every core busy
+/// @brief and holds one framebuffer per frame in flight. Large frames or short batches are better served by tiling each frame.
+[[nodiscard]] inline FrameParallelism ChooseFrameParallelism(std::int32_t height, std::int32_t width, std::int32_t frame_count, std::size_t thread_count) {
+    constexpr std::int64_t klarge_frame_pixels{2048*2048};
+    const auto pixels = static_cast<std::int64_t>(height)*width;
+    if(thread_count<=1 || frame_count<=1) return FrameParallelism::kIntraFrame;
+    if(pixels>klarge_frame_pixels) return FrameParallelism::kIntraFrame;
+    if(static_cast<std::size_t>(frame_count) < thread_count) return FrameParallelism::kIntraFrame;
+    return FrameParallelism::kInterFrame;
+}
+
+
+/// @brief Renders a batch of independent frames (e.g. a camera path) on a thread pool.
+/// @brief Each frame gets its own framebuffer from a recycled pool; scene data must be shared read-only between frames.
+/// @brief At most max_frames_in_flight framebuffers exist at once, and frames are written out strictly in order.
+class FrameScheduler {
+public:
+    //Renders frame 'frame' into 'image'. If 'tile_pool' is non-null the frame may split itself into tiles and use it.
+    using RenderFn = std::function<void(std::int32_t frame, FrameBuffer& image, ThreadPool* tile_pool)>;
+    //Called on the scheduling thread, once per frame, in frame order.
+    using WriteFn = std::function<void(std::int32_t frame, const FrameBuffer& image)>;
+
+    explicit FrameScheduler(ThreadPool& pool, std::size_t max_frames_in_flight = 0)
+        : pool_{pool}, max_frames_in_flight_{max_frames_in_flight==0 ? 2*pool.Size() : max_frames_in_flight} {}
+
+    void Run(std::int32_t frame_count, std::int32_t height, std::int32_t width, const RenderFn& render, const WriteFn& write) {
+        Run(frame_count, height, width, render, write, ChooseFrameParallelism(height, width, frame_count, pool_.Size()));
+    }
+
+    void Run(std::int32_t frame_count, std::int32_t height, std::int32_t width, const RenderFn& render, const WriteFn& write, FrameParallelism mode) {
+        FrameBufferPool buffers(height, width);
+
+        if(mode==FrameParallelism::kIntraFrame) {
+            for(std::int32_t frame = 0; frame < frame_count; ++frame) {
+                auto image = buffers.Acquire();
+                render(frame, *image, &pool_);
+                write(frame, *image);
+                buffers.Release(std::move(image));
+            }
+            return;
+        }
+
+        //Frames in flight, oldest first. The scheduling thread blocks on the oldest one, so output stays in order
+        //and a slow frame only delays submission of new work once the in-flight window is full.
+        std::deque<std::future<std::unique_ptr<FrameBuffer>>> in_flight;
+        std::int32_t next_frame = 0;
+
+        auto submit = [&] {
+            const auto frame = next_frame++;
+            in_flight.push_back(pool_.Submit([&render, &buffers, frame] {
+                auto image = buffers.Acquire();
+                render(frame, *image, nullptr);
+                return image;
+            }));
+        };
+
+        try {
+            for(std::int32_t written = 0; written < frame_count; ++written) {
+                while(next_frame < frame_count && in_flight.size() < max_frames_in_flight_) {
+                    submit();
+                }
+                //Taken off the queue before get(), which may rethrow, so that cleanup only waits on futures still outstanding
+                auto oldest = std::move(in_flight.front());
+                in_flight.pop_front();
+                auto image = oldest.get();
+                write(written, *image);
+                buffers.Release(std::move(image));
+            }
+        }
+        catch(...) {
+            //The queued frames reference locals of this function, so they must finish before we unwind
+            for(auto& f : in_flight) f.wait();
+            throw;
+        }
+    }
+
+private:
+    ThreadPool& pool_;
+    std::size_t max_frames_in_flight_;
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include <cura/bounds.h>
+#include <cura/buffer.h>
+#include <cura/camera.h>
+#include <cura/math.h>
+#include <cura/model.h>
+#include <cura/renderer.h>
+#include <cura/scene.h>
+#include <cura/shader.h>
+#include <cura/thread_pool.h>
+
+/// @brief The pixels that a world-space box can cover when drawn with 'view_projection', grown by a pixel so that multisampled
+/// @brief coverage is included. Returns the whole image if part of the box is behind the camera (its projection is then unbounded).
+[[nodiscard]] inline Tile ScreenBounds(const AABB& box, const Mat44f& view_projection, std::int32_t height, std::int32_t width) {
+    const Tile full{0, 0, width, height};
+    if(box.Empty()) return Tile{0, 0, 0, 0};
+
+    //Triangles inside the box project inside the convex hull of its projected corners, as long as every corner is in front of the camera
+    Vec2f min{std::numeric_limits<float>::max(), std::numeric_limits<float>::max()};
+    Vec2f max{std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+    for(int i = 0; i < 8; ++i) {
+        const Vec3f corner{i&1 ? box.max.x : box.min.x, i&2 ? box.max.y : box.min.y, i&4 ? box.max.z : box.min.z};
+        const auto clip = la::mul(view_projection, Vec4f(corner,1.f));
+        if(clip.w <= 0.f) return full;
+        //Viewport transform, as in ProcessVertex
+        const Vec2f pixel{(clip.x/clip.w + 1.f)*width/2.f, (1.f - clip.y/clip.w)*height/2.f};
+        min = la::min(min, pixel);
+        max = la::max(max, pixel);
+    }
+    const auto clamp_x = [&](float f) { return static_cast<std::int32_t>(std::clamp(f, 0.f, static_cast<float>(width))); };
+    const auto clamp_y = [&](float f) { return static_cast<std::int32_t>(std::clamp(f, 0.f, static_cast<float>(height))); };
+    return Tile{clamp_x(std::floor(min.x) - 1.f), clamp_y(std::floor(min.y) - 1.f), clamp_x(std::ceil(max.x) + 1.f), clamp_y(std::ceil(max.y) + 1.f)};
+}
+
+//What an incremental frame redrew.
+struct IncrementalStats {
+    std::size_t objects_changed{0}; //Objects added, removed, moved, or given a new model or texture since the last frame
+    std::size_t objects_redrawn{0}; //Objects that overlap a redrawn tile, and so went through the vertex stage
+    std::size_t tiles_redrawn{0};
+    std::size_t tiles{0};
+    CullStats cull;                 //Of the redrawn objects
+};
+
+/// @brief Renders a sequence of frames of a scene seen from a fixed camera, redrawing only the tiles that changed.
+/// @brief The screen-space bounds of every object are kept from the previous frame. A tile is redrawn if the old or new bounds of an object
+/// @brief that changed overlap it; it is then cleared and every object overlapping it is drawn again, moved or not. All other tiles keep
+/// @brief their color and depth from the previous frame. So the cost of a frame follows the area that changed, not the size of the scene,
+/// @brief and every frame is identical to drawing the whole scene with DrawScene.
+/// @brief Changes are found by comparing each object's model, texture and transform with the last frame, so objects must keep their index
+/// @brief in the scene. A change of camera, projection or anything else the renderer cannot see (e.g. a texture's texels) needs Invalidate().
+class IncrementalRenderer {
+public:
+    IncrementalRenderer(std::int32_t height, std::int32_t width, std::int32_t samples = 1, std::int32_t tile_size = kDefaultTileSize)
+        : image_{height, width, samples}, tiles_{SplitIntoTiles(height, width, tile_size)}, tile_size_{tile_size}
+    {
+        assert(tile_size%kClearTileSize==0 && "Error: tile size must be a multiple of kClearTileSize!");
+    }
+
+    //Makes the next frame redraw every tile.
+    void Invalidate() { valid_ = false; }
+
+    /// @brief Brings the image up to date with the scene.
+    /// @param near Distance to the near plane used to build 'projection' (the sign is ignored).
+    /// @param far Distance to the far plane used to build 'projection' (the sign is ignored).
+    IncrementalStats Render(const Scene& scene, const Camera& camera, const Mat44f& projection, float near, float far, ThreadPool& pool) {
+        IncrementalStats stats;
+        stats.tiles = tiles_.size();
+        if(!SameMatrix(camera.view, view_) || !SameMatrix(projection, projection_)) valid_ = false;
+        view_ = camera.view;
+        projection_ = projection;
+
+        //Mark the tiles under the old and new bounds of every object that changed
+        const auto view_projection = la::mul(projection, camera.view);
+        const auto& objects = scene.Objects();
+        std::vector<ObjectState> current(objects.size());
+        std::vector<std::uint8_t> dirty(tiles_.size(), valid_ ? 0 : 1);
+        for(std::size_t i = 0; i < objects.size(); ++i) {
+            const auto& object = objects[i];
+            current[i] = ObjectState{object.model, object.texture, object.transform, ScreenBounds(object.world_bounds, view_projection, image_.height, image_.width)};
+            if(i < previous_.size() && previous_[i].Same(current[i])) continue;
+            ++stats.objects_changed;
+            if(i < previous_.size()) MarkTiles(previous_[i].screen, dirty);
+            MarkTiles(current[i].screen, dirty);
+        }
+        for(auto i = objects.size(); i < previous_.size(); ++i) {
+            ++stats.objects_changed;
+            MarkTiles(previous_[i].screen, dirty);
+        }
+        previous_ = std::move(current);
+        valid_ = true;
+
+        std::vector<std::int32_t> redraw;
+        for(std::int32_t t = 0; t < static_cast<std::int32_t>(tiles_.size()); ++t) {
+            if(dirty[t]) redraw.push_back(t);
+        }
+        stats.tiles_redrawn = redraw.size();
+        if(redraw.empty()) return stats;
+
+        //Only objects that reach a redrawn tile are processed. The others contribute no triangles to those tiles.
+        std::vector<std::uint8_t> include(objects.size(), 0);
+        for(std::size_t i = 0; i < objects.size(); ++i) {
+            include[i] = OverlapsTiles(previous_[i].screen, dirty);
+            stats.objects_redrawn += include[i];
+        }
+        const auto batches = BuildSceneBatches(scene, camera, projection, near, far, image_.height, image_.width, pool, stats.cull, include);
+        const auto bins = BinTriangles(batches, image_.height, image_.width, tile_size_);
+
+        //Redrawn tiles start cleared, so nothing of the old frame survives in them
+        std::vector<std::uint64_t> shaded(redraw.size(), 0);
+        pool.ParallelFor(0, static_cast<std::int32_t>(redraw.size()), [&](std::int32_t r) {
+            const auto t = redraw[r];
+            shaded[r] = DrawBinnedTile(batches, bins[t], tiles_[t], image_, TileMemory{false, true});
+        });
+        stats.cull.fragments_shaded = std::accumulate(shaded.begin(), shaded.end(), std::uint64_t{0});
+        return stats;
+    }
+
+    [[nodiscard]] const FrameBuffer& Image() const noexcept { return image_; }
+
+private:
+    struct ObjectState {
+        const Model* model;
+        TextureRef texture;
+        Mat44f transform;
+        Tile screen; //Pixels the object can cover
+
+        [[nodiscard]] bool Same(const ObjectState& other) const {
+            return model==other.model && texture==other.texture && SameMatrix(transform, other.transform);
+        }
+    };
+
+    [[nodiscard]] static bool SameMatrix(const Mat44f& a, const Mat44f& b) {
+        for(int c = 0; c < 4; ++c) {
+            for(int r = 0; r < 4; ++r) {
+                if(a[c][r]!=b[c][r]) return false;
+            }
+        }
+        return true;
+    }
+
+    //Calls f(t) for every tile that 'region' overlaps, until f returns true. Returns whether it did.
+    template<typename F>
+    bool AnyTile(const Tile& region, F&& f) const {
+        if(region.Empty()) return false;
+        const auto tiles_x = (image_.width + tile_size_ - 1)/tile_size_;
+        for(auto ty = region.y0/tile_size_; ty <= (region.y1-1)/tile_size_; ++ty) {
+            for(auto tx = region.x0/tile_size_; tx <= (region.x1-1)/tile_size_; ++tx) {
+                if(f(ty*tiles_x + tx)) return true;
+            }
+        }
+        return false;
+    }
+
+    void MarkTiles(const Tile& region, std::vector<std::uint8_t>& dirty) const {
+        AnyTile(region, [&](std::int32_t t) { dirty[t] = 1; return false; });
+    }
+
+    [[nodiscard]] bool OverlapsTiles(const Tile& region, const std::vector<std::uint8_t>& dirty) const {
+        return AnyTile(region, [&](std::int32_t t) { return dirty[t]!=0; });
+    }
+
+private:
+    FrameBuffer image_;
+    std::vector<Tile> tiles_;
+    std::int32_t tile_size_;
+    std::vector<ObjectState> previous_;
+    Mat44f view_{la::identity};
+    Mat44f projection_{la::identity};
+    bool valid_{false};
+};
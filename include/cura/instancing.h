@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <cura/bounds.h>
+#include <cura/buffer.h>
+#include <cura/camera.h>
+#include <cura/math.h>
+#include <cura/model.h>
+#include <cura/renderer.h>
+#include <cura/scene.h>
+#include <cura/thread_pool.h>
+
+/// @brief Per-instance data for instanced drawing.
+struct Instance {
+    Mat44f transform; //Object-to-world matrix
+    Color3f tint{1.f,1.f,1.f}; //Per-instance uniform that modulates the texture color
+};
+
+/// @brief Runs the vertex stage for one instance of a model, emitting only the triangles of the given meshlets of one level of detail.
+/// @brief Each unique vertex position is transformed once, by the SIMD stream kernel; face corners then gather the transformed position by index.
+/// @brief The model's vertex arrays are only read, so any number of threads can process instances of the same model at once.
+[[nodiscard]] inline std::vector<ClippedVertex> ProcessInstance(const Model& model, std::size_t lod, std::span<const Meshlet* const> meshlets, const Mat44f& model_view, const Mat44f& projection, std::int32_t height, std::int32_t width) {
+    //Transform the unique positions (texture coordinates are attached per corner below)
+    thread_local ScreenStream transformed;
+    TransformVertexStream(model.PositionStream(), model_view, projection, height, width, transformed);
+
+    std::size_t face_count = 0;
+    for(const auto* meshlet : meshlets) face_count += meshlet->count;
+
+    std::vector<ClippedVertex> out;
+    out.reserve(3*face_count);
+    for(const auto* meshlet : meshlets) {
+        for(auto k = meshlet->first; k < meshlet->first+meshlet->count; ++k) {
+            const auto& face = model.Faces(lod)[model.MeshletFaces(lod)[k]];
+            for(int i = 0; i < 3; ++i) {
+                out.push_back(transformed.Vertex(face.pos_idx[i], model.TexCoords()[face.tex_idx[i]]));
+            }
+        }
+    }
+    return out;
+}
+
+/// @brief Draws many instances of one model, each with its own transform and tint.
+/// @brief Instances are culled (whole instance, then per meshlet), given a level of detail and transformed in parallel, then rasterized together by tile.
+/// @param near Distance to the near plane used to build 'projection' (the sign is ignored).
+/// @param far Distance to the far plane used to build 'projection' (the sign is ignored).
+inline CullStats DrawInstanced(const Model& model, TextureRef texture, std::span<const Instance> instances, const Camera& camera, const Mat44f& projection, float near, float far, FrameBuffer& image, ThreadPool& pool) {
+    const auto frustum = MakeFrustum(camera.view, projection, near, far);
+
+    std::vector<DrawBatch> batches(instances.size());
+    std::vector<CullStats> instance_stats(instances.size());
+
+    pool.ParallelFor(0, static_cast<std::int32_t>(instances.size()), [&](std::int32_t i) {
+        const auto& instance = instances[i];
+        auto& stats = instance_stats[i];
+        batches[i].texture = texture;
+        batches[i].tint = instance.tint;
+
+        const auto containment = frustum.Test(model.Bounds().Transformed(instance.transform));
+        if(containment==Containment::kOutside) return;
+        stats.objects_visible = 1;
+
+        const auto model_view = la::mul(camera.view, instance.transform);
+        const auto lod = SelectLod(model, instance.transform, camera.view, projection, image.height);
+        std::vector<const Meshlet*> meshlets;
+        CullMeshlets(model, lod, instance.transform, model_view, frustum, containment==Containment::kInside, stats, meshlets);
+        batches[i].vertices = ProcessInstance(model, lod, meshlets, model_view, projection, image.height, image.width);
+    });
+    CullStats total;
+    total.fragments_shaded = DrawBatches(batches, image, pool);
+    total.objects = instances.size();
+    for(const auto& stats : instance_stats) {
+        total.objects_visible += stats.objects_visible;
+        total.meshlets_tested += stats.meshlets_tested;
+        total.meshlets_frustum_culled += stats.meshlets_frustum_culled;
+        total.meshlets_backface_culled += stats.meshlets_backface_culled;
+        total.faces_drawn += stats.faces_drawn;
+    }
+    return total;
+}
+
+/// @brief Draws many instances of one model that differ only in their transform.
+inline CullStats DrawInstanced(const Model& model, TextureRef texture, std::span<const Mat44f> transforms, const Camera& camera, const Mat44f& projection, float near, float far, FrameBuffer& image, ThreadPool& pool) {
+    std::vector<Instance> instances;
+    instances.reserve(transforms.size());
+    for(const auto& transform : transforms) instances.push_back(Instance{transform});
+    return DrawInstanced(model, texture, instances, camera, projection, near, far, image, pool);
+}
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+//A minimal JSON reader and writer, enough for job descriptions and replies. Numbers are doubles; object keys keep their order.
+
+struct JsonValue {
+    using Array = std::vector<JsonValue>;
+    using Object = std::vector<std::pair<std::string, JsonValue>>;
+
+    std::variant<std::nullptr_t, bool, double, std::string, Array, Object> value{nullptr};
+
+    [[nodiscard]] bool IsNull() const noexcept { return std::holds_alternative<std::nullptr_t>(value); }
+    [[nodiscard]] const bool* Bool() const noexcept { return std::get_if<bool>(&value); }
+    [[nodiscard]] const double* Number() const noexcept { return std::get_if<double>(&value); }
+    [[nodiscard]] const std::string* String() const noexcept { return std::get_if<std::string>(&value); }
+    [[nodiscard]] const Array* Elements() const noexcept { return std::get_if<Array>(&value); }
+    [[nodiscard]] const Object* Members() const noexcept { return std::get_if<Object>(&value); }
+
+    //Sets the member named 'key' of an object, adding it if there is none. A null value becomes an empty object first.
+    void Set(std::string_view key, JsonValue member) {
+        if(IsNull()) value = Object{};
+        auto& members = std::get<Object>(value);
+        for(auto& [name, existing] : members) {
+            if(name==key) {
+                existing = std::move(member);
+                return;
+            }
+        }
+        members.emplace_back(std::string(key), std::move(member));
+    }
+
+    //The member named 'key' of an object, or nullptr if there is none (or this is not an object).
+    [[nodiscard]] const JsonValue* Find(std::string_view key) const noexcept {
+        if(const auto* members = Members()) {
+            for(const auto& [name, member] : *members) {
+                if(name==key) return &member;
+            }
+        }
+        return nullptr;
+    }
+};
+
+namespace json_detail {
+
+//Recursive-descent parser over a string. Nesting is limited so that hostile input cannot overflow the stack.
+class Parser {
+public:
+    explicit Parser(std::string_view text) : text_{text} {}
+
+    [[nodiscard]] std::optional<JsonValue> Document() {
+        auto value = Value(0);
+        SkipSpace();
+        if(value && pos_!=text_.size()) return Fail("unexpected characters after the value");
+        return value;
+    }
+
+    [[nodiscard]] const std::string& Error() const noexcept { return error_; }
+
+private:
+    static constexpr int kmax_depth{64};
+
+    std::nullopt_t Fail(std::string_view what) {
+        if(error_.empty()) error_ = std::string(what) + " at offset " + std::to_string(pos_);
+        return std::nullopt;
+    }
+
+    void SkipSpace() {
+        while(pos_ < text_.size() && (text_[pos_]==' ' || text_[pos_]=='\t' || text_[pos_]=='\n' || text_[pos_]=='\r')) ++pos_;
+    }
+
+    bool Consume(std::string_view token) {
+        if(text_.substr(pos_, token.size())!=token) return false;
+        pos_ += token.size();
+        return true;
+    }
+
+    std::optional<JsonValue> Value(int depth) {
+        if(depth > kmax_depth) return Fail("nesting too deep");
+        SkipSpace();
+        if(pos_>=text_.size()) return Fail("unexpected end of input");
+        switch(text_[pos_]) {
+        case '{': return ParseObject(depth);
+        case '[': return ParseArray(depth);
+        case '"': {
+            auto s = ParseString();
+            if(!s) return std::nullopt;
+            return JsonValue{std::move(*s)};
+        }
+        case 't': if(Consume("true")) return JsonValue{true}; break;
+        case 'f': if(Consume("false")) return JsonValue{false}; break;
+        case 'n': if(Consume("null")) return JsonValue{nullptr}; break;
+        default: return ParseNumber();
+        }
+        return Fail("invalid literal");
+    }
+
+    std::optional<JsonValue> ParseNumber() {
+        //JSON numbers start with '-' or a digit. from_chars would also take "inf" and "nan", and is laxer about leading zeros.
+        const auto c = text_[pos_];
+        if(c!='-' && (c<'0' || c>'9')) return Fail("unexpected character");
+        double d{};
+        const auto* begin = text_.data() + pos_;
+        const auto [end, ec] = std::from_chars(begin, text_.data() + text_.size(), d);
+        if(ec!=std::errc{} || !std::isfinite(d)) return Fail("invalid number");
+        pos_ += static_cast<std::size_t>(end - begin);
+        return JsonValue{d};
+    }
+
+    static void AppendUtf8(std::string& out, std::uint32_t cp) {
+        if(cp < 0x80) out += static_cast<char>(cp);
+        else if(cp < 0x800) {
+            out += static_cast<char>(0xc0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+        else if(cp < 0x10000) {
+            out += static_cast<char>(0xe0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+        else {
+            out += static_cast<char>(0xf0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+    }
+
+    std::optional<std::uint32_t> Hex4() {
+        if(pos_ + 4 > text_.size()) return Fail("truncated \\u escape");
+        std::uint32_t cp{};
+        const auto [end, ec] = std::from_chars(text_.data() + pos_, text_.data() + pos_ + 4, cp, 16);
+        if(ec!=std::errc{} || end!=text_.data() + pos_ + 4) return Fail("invalid \\u escape");
+        pos_ += 4;
+        return cp;
+    }
+
+    std::optional<std::string> ParseString() {
+        ++pos_; //Opening quote
+        std::string out;
+        while(pos_ < text_.size()) {
+            const auto c = text_[pos_++];
+            if(c=='"') return out;
+            if(static_cast<unsigned char>(c) < 0x20) return Fail("control character in string");
+            if(c!='\\') {
+                out += c;
+                continue;
+            }
+            if(pos_>=text_.size()) break;
+            switch(text_[pos_++]) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                auto cp = Hex4();
+                if(!cp) return std::nullopt;
+                //A high surrogate followed by an escaped low surrogate encodes one code point beyond the BMP
+                if(*cp>=0xd800 && *cp<0xdc00 && Consume("\\u")) {
+                    const auto low = Hex4();
+                    if(!low) return std::nullopt;
+                    if(*low<0xdc00 || *low>=0xe000) return Fail("invalid surrogate pair");
+                    *cp = 0x10000 + ((*cp - 0xd800) << 10) + (*low - 0xdc00);
+                }
+                else if(*cp>=0xd800 && *cp<0xe000) return Fail("unpaired surrogate");
+                AppendUtf8(out, *cp);
+                break;
+            }
+            default: return Fail("invalid escape");
+            }
+        }
+        return Fail("unterminated string");
+    }
+
+    std::optional<JsonValue> ParseArray(int depth) {
+        ++pos_;
+        JsonValue::Array elements;
+        SkipSpace();
+        if(Consume("]")) return JsonValue{std::move(elements)};
+        for(;;) {
+            auto element = Value(depth + 1);
+            if(!element) return std::nullopt;
+            elements.push_back(std::move(*element));
+            SkipSpace();
+            if(Consume("]")) return JsonValue{std::move(elements)};
+            if(!Consume(",")) return Fail("expected ',' or ']'");
+        }
+    }
+
+    std::optional<JsonValue> ParseObject(int depth) {
+        ++pos_;
+        JsonValue::Object members;
+        SkipSpace();
+        if(Consume("}")) return JsonValue{std::move(members)};
+        for(;;) {
+            SkipSpace();
+            if(pos_>=text_.size() || text_[pos_]!='"') return Fail("expected a member name");
+            auto name = ParseString();
+            if(!name) return std::nullopt;
+            SkipSpace();
+            if(!Consume(":")) return Fail("expected ':'");
+            auto member = Value(depth + 1);
+            if(!member) return std::nullopt;
+            members.emplace_back(std::move(*name), std::move(*member));
+            SkipSpace();
+            if(Consume("}")) return JsonValue{std::move(members)};
+            if(!Consume(",")) return Fail("expected ',' or '}'");
+        }
+    }
+
+    std::string_view text_;
+    std::size_t pos_{0};
+    std::string error_;
+};
+
+} //namespace json_detail
+
+/// @brief Parses a JSON document.
+/// @param error If given, receives a description of the first error. Otherwise errors are reported on std::cerr.
+[[nodiscard]] inline std::optional<JsonValue> ParseJson(std::string_view text, std::string* error = nullptr) {
+    json_detail::Parser parser(text);
+    auto value = parser.Document();
+    if(!value) {
+        if(error) *error = parser.Error();
+        else std::cerr<<"Error parsing JSON: "<<parser.Error()<<"\n";
+    }
+    return value;
+}
+
+//Appends 's' to 'out' as a quoted JSON string.
+inline void AppendJsonString(std::string& out, std::string_view s) {
+    constexpr std::string_view khex{"0123456789abcdef"};
+    out += '"';
+    for(const auto c : s) {
+        switch(c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if(static_cast<unsigned char>(c) < 0x20) {
+                out += "\\u00";
+                out += khex[(c >> 4) & 0xf];
+                out += khex[c & 0xf];
+            }
+            else out += c;
+        }
+    }
+    out += '"';
+}
+
+//Appends 'value' to 'out' as compact JSON. Numbers are written in the shortest form that reads back to the same double.
+inline void AppendJson(std::string& out, const JsonValue& value) {
+    if(value.IsNull()) out += "null";
+    else if(const auto* b = value.Bool()) out += *b ? "true" : "false";
+    else if(const auto* d = value.Number()) {
+        char digits[32];
+        const auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), *d);
+        out.append(digits, end);
+    }
+    else if(const auto* s = value.String()) AppendJsonString(out, *s);
+    else if(const auto* elements = value.Elements()) {
+        out += '[';
+        for(std::size_t i = 0; i < elements->size(); ++i) {
+            if(i > 0) out += ',';
+            AppendJson(out, (*elements)[i]);
+        }
+        out += ']';
+    }
+    else if(const auto* members = value.Members()) {
+        out += '{';
+        for(std::size_t i = 0; i < members->size(); ++i) {
+            if(i > 0) out += ',';
+            AppendJsonString(out, (*members)[i].first);
+            out += ':';
+            AppendJson(out, (*members)[i].second);
+        }
+        out += '}';
+    }
+}
@@ -1,7 +1,21 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <span>
+#include <vector>
+
 #include <cura/buffer.h>
 #include <cura/math.h>
+#include <cura/model.h>
+#include <cura/renderer.h>
+#include <cura/thread_pool.h>
+#include <cura/vertex.h>
 
 /// @brief Evaluates the implicit equation of a line at a particular point.
 /// @brief The point lies on the line if the return value is zero.
@@ -14,133 +28,217 @@
     return (y0 - y1)*x_at + (x1-x0)*y_at + x0*y1 - x1*y0;
 }
 
-//Subroutine for drawing a line that mostly decreases in y 
-inline void DrawNLine(int x0, int y0, int x1, int y1, Buffer<Color3f>& image, const Color3f& col) {
-
-    auto x_curr{x0};
-    auto y_curr{y0};
-
-    while(y_curr>=y1) {
-        image.Set(x_curr,y_curr, col);
-        auto shared_midpoint_x{x_curr+ 0.5f};
-        auto shared_midpoint_y{y_curr-1.f};
-
-        //If the line passes below the midpoint, we also move along x
-        if(ImplicitLine(x0,y0,x1,y1,shared_midpoint_x,shared_midpoint_y) < 0) { ++x_curr;}
-        --y_curr;
+//Lines are depth-tested with this much slack (relative to the depth), so that edges drawn over their own filled triangles are not hidden.
+inline constexpr float kLineDepthBias{1e-3f};
+
+/// @brief Clips a line segment to a rectangle with the Liang-Barsky algorithm.
+/// @brief The segment is written as p0 + t*(p1-p0); each side of the rectangle bounds t from one side.
+/// @param bounds Rectangle [x0,x1] x [y0,y1] to clip against.
+/// @return The parameters (t0,t1) of the part of the segment inside the rectangle, or nothing if the segment misses it.
+[[nodiscard]] inline std::optional<Vec2f> ClipLine(const Vec2f& p0, const Vec2f& p1, float x0, float y0, float x1, float y1) {
+    const auto d = p1 - p0;
+    float t0 = 0.f;
+    float t1 = 1.f;
+
+    //For each side, p is the rate at which the segment moves towards the outside and q is the distance from p0 to the side
+    const std::array<float,4> p{-d.x, d.x, -d.y, d.y};
+    const std::array<float,4> q{p0.x - x0, x1 - p0.x, p0.y - y0, y1 - p0.y};
+    for(int i = 0; i < 4; ++i) {
+        if(p[i]==0.f) {
+            if(q[i]<0.f) return std::nullopt; //Parallel to this side and outside it
+            continue;
+        }
+        const auto t = q[i]/p[i];
+        if(p[i]<0.f) t0 = std::max(t0, t); //Entering
+        else         t1 = std::min(t1, t); //Leaving
+        if(t0>t1) return std::nullopt;
     }
+    return Vec2f{t0, t1};
 }
 
-//Subroutine for drawing a line that moves mostly increases in x but slightly decreases in y
-inline void DrawNELine(int x0, int y0, int x1, int y1, Buffer<Color3f>& image, const Color3f& col) {
-
-    auto x_curr{x0};
-    auto y_curr{y0};
-
-    while(x_curr<=x1) {
-        image.Set(x_curr,y_curr, col);
-        auto shared_midpoint_x{x_curr+ 1.f};
-        auto shared_midpoint_y{y_curr-0.5f};
-
-        //If line passes above midpoint, we also move along y
-        if(ImplicitLine(x0,y0,x1,y1,shared_midpoint_x,shared_midpoint_y) > 0) { --y_curr;}
-        ++x_curr;
+/// @brief A line between two pixels, set up for drawing with Bresenham's algorithm.
+/// @brief The pixel at step i along the major axis is offset along the minor axis by floor((2*i*minor + major) / (2*major)),
+/// @brief i.e. the line is rounded to the nearest pixel. Because that offset has a closed form, the walk can start at any step,
+/// @brief so a line split across tiles lights exactly the same pixels as the whole line.
+struct PixelLine {
+    std::int32_t x0, y0;      //First pixel
+    std::int32_t steps;       //Number of pixels minus one
+    std::int32_t major;       //|dx| if the line is x-major, |dy| otherwise
+    std::int32_t minor;
+    std::int32_t sx, sy;      //Step direction along x and y (+1 or -1)
+    bool x_major;
+    float inv_z0, inv_z1;     //Reciprocal of the camera-space depth at the endpoints, interpolated linearly in screen space
+
+    PixelLine(std::int32_t ax, std::int32_t ay, std::int32_t bx, std::int32_t by, float iz0 = 0.f, float iz1 = 0.f)
+        : x0{ax}, y0{ay}, sx{bx>=ax ? 1 : -1}, sy{by>=ay ? 1 : -1}, inv_z0{iz0}, inv_z1{iz1}
+    {
+        const auto dx = std::abs(bx-ax);
+        const auto dy = std::abs(by-ay);
+        x_major = dx>=dy;
+        major = x_major ? dx : dy;
+        minor = x_major ? dy : dx;
+        steps = major;
     }
-}
-
 
-//Subroutine for drawing a line that moves mostly increases in x but slightly increases in y
-inline void DrawSELine(int x0, int y0, int x1, int y1, Buffer<Color3f>& image, const Color3f& col) {
-
-    auto f = [x0,y0, x1, y1](float x, float y) {
-            return (y0 - y1)*x + (x1-x0)*y + x0*y1 - x1*y0;
-    };
-
-    while(x0<=x1) {
-        image.Set(x0,y0, col);
-        auto shared_midpoint_x{x0+ 1.f};
-        auto shared_midpoint_y{y0-0.5f};
-
-        //If the line passes below the midpoint, we also move along y
-        if(f(shared_midpoint_x,shared_midpoint_y) < 0) { ++y0;}
-        ++x0;
+    /// @brief Calls plot(x, y, inv_z) for the pixels of the line that lie in a tile.
+    template<typename Plot>
+    void Walk(const Tile& tile, Plot&& plot) const {
+        //Steps whose major coordinate lies in the tile
+        std::int32_t first = 0;
+        std::int32_t last = steps;
+        const auto start = x_major ? x0 : y0;
+        const auto s = x_major ? sx : sy;
+        const auto lo = x_major ? tile.x0 : tile.y0;
+        const auto hi = (x_major ? tile.x1 : tile.y1) - 1;
+        if(s>0) { first = std::max(first, lo - start); last = std::min(last, hi - start); }
+        else    { first = std::max(first, start - hi); last = std::min(last, start - lo); }
+        if(first>last) return;
+
+        //Jump to the first step: offset = n / (2*major), with the remainder carried between steps
+        const std::int64_t denominator = 2*static_cast<std::int64_t>(std::max(major, 1));
+        const std::int64_t n = 2*static_cast<std::int64_t>(first)*minor + major;
+        std::int64_t offset = n/denominator;
+        std::int64_t remainder = n%denominator;
+
+        const auto inv_steps = steps>0 ? 1.f/static_cast<float>(steps) : 0.f;
+        for(auto i = first; i <= last; ++i) {
+            const auto x = x_major ? x0 + sx*i : x0 + sx*static_cast<std::int32_t>(offset);
+            const auto y = x_major ? y0 + sy*static_cast<std::int32_t>(offset) : y0 + sy*i;
+            if(x>=tile.x0 && x<tile.x1 && y>=tile.y0 && y<tile.y1) {
+                const auto t = static_cast<float>(i)*inv_steps;
+                plot(x, y, inv_z0 + t*(inv_z1 - inv_z0));
+            }
+            remainder += 2*static_cast<std::int64_t>(minor);
+            if(remainder>=denominator) {
+                remainder -= denominator;
+                ++offset;
+            }
+        }
     }
-}
-
-//Subroutine for drawing a line that mostly increases in y 
-inline void DrawSLine(int x0, int y0, int x1, int y1, Buffer<Color3f>& image, const Color3f& col) {
-
-    auto f = [x0,y0, x1, y1](float x, float y) {
-            return (y0 - y1)*x + (x1-x0)*y + x0*y1 - x1*y0;
+};
+
+/// @brief Clips a screen-space segment to an image and snaps it to pixels.
+/// @param p0,p1 Endpoints in pixel coordinates (pixel (x,y) covers [x,x+1) x [y,y+1)).
+/// @param clip_z0,clip_z1 Camera-space depths of the endpoints (any nonzero value if the line is not depth-tested).
+[[nodiscard]] inline std::optional<PixelLine> SetupLine(const Vec2f& p0, const Vec2f& p1, float clip_z0, float clip_z1, std::int32_t height, std::int32_t width) {
+    //Keep the endpoints just inside the image, so that they round to valid pixels
+    constexpr float kinset{1e-3f};
+    const auto range = ClipLine(p0, p1, 0.f, 0.f, static_cast<float>(width) - kinset, static_cast<float>(height) - kinset);
+    if(!range) return std::nullopt;
+
+    const auto [t0, t1] = *range;
+    const auto a = p0 + t0*(p1-p0);
+    const auto b = p0 + t1*(p1-p0);
+    const auto iz0 = 1.f/clip_z0;
+    const auto iz1 = 1.f/clip_z1;
+    return PixelLine{
+        static_cast<std::int32_t>(std::floor(a.x)), static_cast<std::int32_t>(std::floor(a.y)),
+        static_cast<std::int32_t>(std::floor(b.x)), static_cast<std::int32_t>(std::floor(b.y)),
+        iz0 + t0*(iz1 - iz0), iz0 + t1*(iz1 - iz0)
     };
-
-    while(y0<=y1) {
-        image.Set(x0,y0, col);
-        auto shared_midpoint_x{x0 + 0.5f};
-        auto shared_midpoint_y{y0+1.f};
-
-        //Line passes above the midpoint, then we also move along x
-        if(f(shared_midpoint_x,shared_midpoint_y) > 0) { ++x0;}
-        ++y0;
-    }
 }
 
-
-/// @brief Draws a line from one pixel to another. Implemented using the midpoint algorithm.
-/// @brief The idea is that we move from left to right, and at each step we decide whether to move up/down or not.
-/// @brief This decision is based upon the value of f evaluated at the shared edge of the candidate pixels
+/// @brief Draws a line from one pixel to another with Bresenham's algorithm.
+/// @brief Only integer additions are done per pixel. Endpoints outside the image are clipped.
 /// @param x0 Initial x coordinate
 /// @param y0 Initial y coordinate
 /// @param x1 Final x coordinate
 /// @param y1 Final y coordinates
 /// @param image The image that the line is drawn on
-inline void DrawLine(int x0, int y0, int x1, int y1, Buffer<Color3f>& image) {
-
-    Color3f white{1.f,1.f,1.f};
+inline void DrawLine(int x0, int y0, int x1, int y1, FrameBuffer& image, const Color3f& col = Color3f(1.f,1.f,1.f)) {
+    //Pixel centers are at +0.5
+    const auto line = SetupLine(Vec2f(x0 + 0.5f, y0 + 0.5f), Vec2f(x1 + 0.5f, y1 + 0.5f), 1.f, 1.f, image.height, image.width);
+    if(!line) return;
+    image.Touch(Tile{std::clamp(std::min(x0,x1), 0, image.width), std::clamp(std::min(y0,y1), 0, image.height),
+                     std::clamp(std::max(x0,x1) + 1, 0, image.width), std::clamp(std::max(y0,y1) + 1, 0, image.height)});
+    line->Walk(Tile{0, 0, image.width, image.height}, [&](std::int32_t x, std::int32_t y, float) {
+        for(std::int32_t s = 0; s < image.samples; ++s) image.Color(x,y,s) = col;
+    });
+}
 
-    //First evaluate special cases (horizontal/vertical) lines
-    //Horizontal
-    if(y0==y1) {
-        while(x0<=x1) {
-            image.Set(x0,y0,white);
-            ++x0;
+/// @brief Draws a line between two vertices produced by the vertex stage, restricted to one tile of the image.
+/// @param depth_test If set, pixels are only written where the line is in front of (or within kLineDepthBias of) what is already drawn. Depths are not written.
+inline void DrawLine(const ClippedVertex& v0, const ClippedVertex& v1, FrameBuffer& image, const Color3f& col, const Tile& tile, bool depth_test) {
+    //Without clipping against the near plane (TODO), a vertex behind the camera projects to garbage
+    if(v0.clip_z>=0.f || v1.clip_z>=0.f) return;
+    const auto line = SetupLine(v0.pixel_coords.xy(), v1.pixel_coords.xy(), v0.clip_z, v1.clip_z, image.height, image.width);
+    if(!line) return;
+
+    image.Touch(tile);
+    line->Walk(tile, [&](std::int32_t x, std::int32_t y, float inv_z) {
+        const auto z = 1.f/inv_z;
+        for(std::int32_t s = 0; s < image.samples; ++s) {
+            if(depth_test && z + kLineDepthBias*std::abs(z) < image.Depth(x,y,s)) continue;
+            image.Color(x,y,s) = col;
         }
-        return;
-    }
+    });
+}
 
-    //Vertical
-    if(x0==x1) {
-        if(y1<y0) {std::swap(y0,y1);} //want to be increasing in y
-        while(y0<=y1) {
-            image.Set(x0,y0,white);
-            ++y0;
+/// @brief Lists every edge of a mesh once, however many faces share it.
+/// @return Pairs of position indices, smaller index first, sorted.
+[[nodiscard]] inline std::vector<std::array<std::int32_t,2>> UniqueEdges(std::span<const Face> faces) {
+    std::vector<std::array<std::int32_t,2>> edges;
+    for(const auto& face : faces) {
+        const auto n = face.pos_idx.size();
+        for(std::size_t i = 0; i < n; ++i) {
+            const auto a = face.pos_idx[i];
+            const auto b = face.pos_idx[(i+1)%n];
+            if(a!=b) edges.push_back({std::min(a,b), std::max(a,b)});
         }
-        return;
-    }
-
-    //Although the idea of the algorithm is the same in all cases, there are some slight differences depending on the gradient of the line.
-    //Remember that the y axis points downwards here...
-    //We want the gradient to be defined starting from the leftmost (smalller x) point
-
-    if(x1<x0) {
-        std::swap(x0,x1);
-        std::swap(y0,y1);
-    }
-    const auto grad = float{static_cast<float>(y1-y0)/static_cast<float>(x1-x0)};
-    if(grad<-1.f) {
-        DrawNLine(x0, y0, x1, y1, image, white);
     }
+    std::ranges::sort(edges);
+    const auto duplicates = std::ranges::unique(edges);
+    edges.erase(duplicates.begin(), duplicates.end());
+    return edges;
+}
 
-    else if(grad>=-1.f && grad<0.f) {
-        DrawNELine(x0, y0, x1, y1, image, white);
+/// @brief Draws the edges of a model as lines, e.g. as a debug overlay over a shaded image.
+/// @brief Vertices are transformed once and lines are binned by tile, then tiles are drawn in parallel. Each tile only writes its own pixels.
+/// @param edges Edges to draw, as returned by UniqueEdges (computing them once per model avoids drawing shared edges twice).
+/// @param view Object-to-camera matrix.
+/// @param projection Camera-to-clip matrix.
+/// @param depth_test Hide edges behind what is already in the image.
+inline void DrawWireframe(const Model& model, std::span<const std::array<std::int32_t,2>> edges, const Mat44f& view, const Mat44f& projection, FrameBuffer& image, ThreadPool& pool, const Color3f& col = Color3f(1.f,1.f,1.f), bool depth_test = false, std::int32_t tile_size = kDefaultTileSize) {
+    std::vector<ClippedVertex> vertices(model.Vertices().size());
+    pool.ParallelFor(0, static_cast<std::int32_t>(vertices.size()), [&](std::int32_t v) {
+        vertices[v] = ProcessVertex(model.Vertices()[v], Vec2f{0.f,0.f}, view, projection, image.height, image.width);
+    });
+
+    //Bin each edge into the tiles that its bounding box overlaps
+    assert(tile_size%kClearTileSize==0 && "Error: tile size must be a multiple of kClearTileSize!");
+    const auto tiles = SplitIntoTiles(image.height, image.width, tile_size);
+    const auto tiles_x = (image.width + tile_size - 1)/tile_size;
+    std::vector<std::vector<std::uint32_t>> bins(tiles.size());
+    for(std::uint32_t e = 0; e < edges.size(); ++e) {
+        const auto& a = vertices[edges[e][0]];
+        const auto& b = vertices[edges[e][1]];
+        if(a.clip_z>=0.f || b.clip_z>=0.f) continue;
+        const auto min = la::min(a.pixel_coords.xy(), b.pixel_coords.xy());
+        const auto max = la::max(a.pixel_coords.xy(), b.pixel_coords.xy());
+        //Vertices very close to the camera plane can project to huge or non-finite coordinates
+        if(!std::isfinite(min.x) || !std::isfinite(min.y) || !std::isfinite(max.x) || !std::isfinite(max.y)) continue;
+        if(max.x < 0.f || max.y < 0.f || min.x >= image.width || min.y >= image.height) continue;
+
+        const auto tx0 = TileCoordinate(min.x, image.width, tile_size);
+        const auto ty0 = TileCoordinate(min.y, image.height, tile_size);
+        const auto tx1 = TileCoordinate(max.x, image.width, tile_size);
+        const auto ty1 = TileCoordinate(max.y, image.height, tile_size);
+        for(auto ty = ty0; ty <= ty1; ++ty) {
+            for(auto tx = tx0; tx <= tx1; ++tx) {
+                bins[ty*tiles_x + tx].push_back(e);
+            }
+        }
     }
 
-    else if(grad>0.f && grad<=1.f) {
-        DrawSELine(x0, y0, x1, y1, image, white);
-
-    }
-    else {
-        DrawSLine(x0, y0, x1, y1, image, white);
-    }
+    pool.ParallelFor(0, static_cast<std::int32_t>(tiles.size()), [&](std::int32_t t) {
+        for(auto e : bins[t]) {
+            DrawLine(vertices[edges[e][0]], vertices[edges[e][1]], image, col, tiles[t], depth_test);
+        }
+    });
+}
 
+/// @brief Draws every edge of one level of detail of a model.
+inline void DrawWireframe(const Model& model, const Mat44f& view, const Mat44f& projection, FrameBuffer& image, ThreadPool& pool, const Color3f& col = Color3f(1.f,1.f,1.f), bool depth_test = false, std::size_t lod = 0) {
+    const auto edges = UniqueEdges(model.Faces(lod));
+    DrawWireframe(model, edges, view, projection, image, pool, col, depth_test);
 }
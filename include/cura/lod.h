@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <span>
+#include <vector>
+
+#include <cura/math.h>
+
+//LOD chains stop once a level has fewer faces than this.
+inline constexpr std::uint32_t kLodMinFaces{128};
+
+/// @brief A simplified version of a triangle mesh that reuses the original vertex positions.
+struct LodLevel {
+    std::vector<std::int32_t> indices;        //Three position indices per triangle
+    std::vector<std::uint32_t> source_faces;  //Index of the original face each triangle came from (for its other attributes)
+    float error;                              //Object-space geometric error: RMS distance of the worst collapsed vertex from its original planes
+};
+
+/// @brief Symmetric 4x4 error quadric (Garland & Heckbert), stored as its upper triangle.
+struct Quadric {
+    std::array<double,10> q{};
+    double weight{0.0}; //Total weight of the planes summed into this quadric
+
+    //Quadric measuring the squared distance to the plane a*x + b*y + c*z + d = 0 (with a unit normal), scaled by 'weight'
+    static Quadric FromPlane(double a, double b, double c, double d, double weight) {
+        Quadric out;
+        out.q = {a*a, a*b, a*c, a*d,
+                      b*b, b*c, b*d,
+                           c*c, c*d,
+                                d*d};
+        for(auto& v : out.q) v *= weight;
+        out.weight = weight;
+        return out;
+    }
+
+    Quadric& operator+=(const Quadric& o) {
+        for(std::size_t i = 0; i < q.size(); ++i) q[i] += o.q[i];
+        weight += o.weight;
+        return *this;
+    }
+
+    //Evaluates v^T Q v for v = (p,1)
+    [[nodiscard]] double Evaluate(const Vec3f& p) const {
+        const double x = p.x, y = p.y, z = p.z;
+        return q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+                        +   q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+                                     +   q[7]*z*z + 2*q[8]*z
+                                                  +   q[9];
+    }
+};
+
+/// @brief Builds a chain of progressively simplified meshes by quadric-error edge collapse.
+/// @brief Collapses always move a vertex onto one of its neighbours ('subset placement'), so every level indexes the original
+/// @brief vertex arrays and only the index list differs between levels. Open boundaries are preserved with perpendicular penalty planes
+/// @brief and collapses that would flip a triangle are rejected.
+/// @param positions Vertex positions.
+/// @param indices Three position indices per triangle.
+/// @param min_faces The chain stops once a level has fewer faces than this.
+/// @return Levels with roughly 1/2, 1/4, ... of the original faces. Does not include the original mesh.
+[[nodiscard]] inline std::vector<LodLevel> BuildLodChain(std::span<const Vec3f> positions, std::span<const std::int32_t> indices, std::uint32_t min_faces = kLodMinFaces) {
+    assert(indices.size()%3==0);
+    const auto face_count = static_cast<std::uint32_t>(indices.size()/3);
+    const auto vertex_count = positions.size();
+
+    std::vector<std::int32_t> tris(indices.begin(), indices.end());
+    std::vector<bool> face_alive(face_count, true);
+    std::vector<std::vector<std::uint32_t>> vertex_faces(vertex_count);
+    std::vector<Quadric> quadrics(vertex_count);
+    std::vector<std::uint32_t> version(vertex_count, 0);
+    std::vector<bool> vertex_alive(vertex_count, true);
+
+    auto face_normal = [&](std::uint32_t f) {
+        const auto& p0 = positions[tris[3*f]];
+        return la::cross(positions[tris[3*f+1]] - p0, positions[tris[3*f+2]] - p0);
+    };
+
+    //Accumulate face quadrics. They are not area-weighted, so cost/weight is the mean squared distance to the original planes.
+    std::uint32_t alive_faces = 0;
+    for(std::uint32_t f = 0; f < face_count; ++f) {
+        const auto n = face_normal(f);
+        const auto len = la::length(n);
+        if(tris[3*f]==tris[3*f+1] || tris[3*f+1]==tris[3*f+2] || tris[3*f]==tris[3*f+2]) {
+            face_alive[f] = false;
+            continue;
+        }
+        ++alive_faces;
+        for(int i = 0; i < 3; ++i) vertex_faces[tris[3*f+i]].push_back(f);
+        if(len==0.f) continue;
+        const auto u = n/len;
+        const auto plane = Quadric::FromPlane(u.x, u.y, u.z, -la::dot(u, positions[tris[3*f]]), 1.0);
+        for(int i = 0; i < 3; ++i) quadrics[tris[3*f+i]] += plane;
+    }
+
+    //Boundary edges (used by a single face) get a heavily weighted plane perpendicular to the face, so the outline stays put
+    {
+        std::vector<std::array<std::int32_t,3>> edges; //(min vertex, max vertex, face)
+        for(std::uint32_t f = 0; f < face_count; ++f) {
+            if(!face_alive[f]) continue;
+            for(int i = 0; i < 3; ++i) {
+                const auto a = tris[3*f+i];
+                const auto b = tris[3*f+(i+1)%3];
+                edges.push_back({std::min(a,b), std::max(a,b), static_cast<std::int32_t>(f)});
+            }
+        }
+        std::ranges::sort(edges);
+        constexpr double kboundary_weight{10.0};
+        for(std::size_t i = 0; i < edges.size(); ) {
+            auto j = i;
+            while(j < edges.size() && edges[j][0]==edges[i][0] && edges[j][1]==edges[i][1]) ++j;
+            if(j-i==1) {
+                const auto& p0 = positions[edges[i][0]];
+                const auto& p1 = positions[edges[i][1]];
+                const auto n = la::cross(p1 - p0, face_normal(edges[i][2]));
+                const auto len = la::length(n);
+                if(len>0.f) {
+                    const auto u = n/len;
+                    const auto plane = Quadric::FromPlane(u.x, u.y, u.z, -la::dot(u, p0), kboundary_weight);
+                    quadrics[edges[i][0]] += plane;
+                    quadrics[edges[i][1]] += plane;
+                }
+            }
+            i = j;
+        }
+    }
+
+    //Candidate collapse of 'from' onto 'to'. The cost is the mean squared distance of 'to' from the planes around both vertices.
+    //Stale entries are detected with the vertex versions.
+    struct Collapse {
+        double cost;
+        std::int32_t from;
+        std::int32_t to;
+        std::uint32_t from_version;
+        std::uint32_t to_version;
+        bool operator>(const Collapse& o) const { return cost > o.cost; }
+    };
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<>> queue;
+
+    auto push_edge = [&](std::int32_t from, std::int32_t to) {
+        auto q = quadrics[from];
+        q += quadrics[to];
+        const auto cost = q.weight>0.0 ? std::max(q.Evaluate(positions[to]), 0.0)/q.weight : 0.0;
+        queue.push(Collapse{cost, from, to, version[from], version[to]});
+    };
+    auto push_vertex = [&](std::int32_t v) {
+        for(auto f : vertex_faces[v]) {
+            if(!face_alive[f]) continue;
+            for(int i = 0; i < 3; ++i) {
+                const auto n = tris[3*f+i];
+                if(n==v) continue;
+                push_edge(v, n);
+                push_edge(n, v);
+            }
+        }
+    };
+    for(std::size_t v = 0; v < vertex_count; ++v) push_vertex(static_cast<std::int32_t>(v));
+
+    //Rejects collapses that would flip (or flatten) any of the faces that survive the collapse
+    auto flips = [&](std::int32_t from, std::int32_t to) {
+        for(auto f : vertex_faces[from]) {
+            if(!face_alive[f]) continue;
+            std::array<Vec3f,3> p;
+            bool shared = false;
+            for(int i = 0; i < 3; ++i) {
+                shared |= tris[3*f+i]==to;
+                p[i] = positions[tris[3*f+i]==from ? to : tris[3*f+i]];
+            }
+            if(shared) continue; //Removed by the collapse
+            const auto before = face_normal(f);
+            const auto after = la::cross(p[1] - p[0], p[2] - p[0]);
+            if(la::dot(before, after) <= 0.f) return true;
+        }
+        return false;
+    };
+
+    std::vector<LodLevel> levels;
+    double max_cost = 0.0;
+    auto target = alive_faces/2;
+
+    auto snapshot = [&] {
+        LodLevel level;
+        level.error = static_cast<float>(std::sqrt(max_cost));
+        for(std::uint32_t f = 0; f < face_count; ++f) {
+            if(!face_alive[f]) continue;
+            level.indices.insert(level.indices.end(), tris.begin()+3*f, tris.begin()+3*f+3);
+            level.source_faces.push_back(f);
+        }
+        levels.push_back(std::move(level));
+    };
+
+    while(target >= min_faces && !queue.empty()) {
+        const auto c = queue.top();
+        queue.pop();
+        if(!vertex_alive[c.from] || !vertex_alive[c.to]) continue;
+        if(c.from_version!=version[c.from] || c.to_version!=version[c.to]) continue;
+        if(flips(c.from, c.to)) continue;
+
+        //Perform the collapse
+        max_cost = std::max(max_cost, c.cost);
+        for(auto f : vertex_faces[c.from]) {
+            if(!face_alive[f]) continue;
+            bool shared = false;
+            for(int i = 0; i < 3; ++i) shared |= tris[3*f+i]==c.to;
+            if(shared) {
+                face_alive[f] = false;
+                --alive_faces;
+                continue;
+            }
+            for(int i = 0; i < 3; ++i) {
+                if(tris[3*f+i]==c.from) tris[3*f+i] = c.to;
+            }
+            vertex_faces[c.to].push_back(f);
+        }
+        vertex_faces[c.from].clear();
+        vertex_alive[c.from] = false;
+        quadrics[c.to] += quadrics[c.from];
+        ++version[c.to];
+
+        //Drop references to dead faces so the adjacency stays small
+        std::erase_if(vertex_faces[c.to], [&](std::uint32_t f) { return !face_alive[f]; });
+        push_vertex(c.to);
+
+        if(alive_faces <= target) {
+            snapshot();
+            target /= 2;
+        }
+    }
+    return levels;
+}
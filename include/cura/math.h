@@ -20,6 +20,7 @@ using Vec2u = la::vec<std::uint32_t,2>;
 using Vec3f   = la::vec<float,3>;
 using Vec3i   = la::vec<std::int32_t,3>;
 using Vec3u   = la::vec<std::uint32_t,3>;
+using Norm3f  = Vec3f; //Unit-length direction. Normalisation is not enforced by the type.
 
 using Color3f = Vec3f;
 using Color3u = Vec3u;
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include <cura/bounds.h>
+#include <cura/math.h>
+
+//Upper bound on the number of triangles in a meshlet.
+inline constexpr std::uint32_t kMeshletMaxFaces{96};
+//A face only joins a meshlet if its normal is within ~53 degrees (acos 0.6) of the meshlet's average normal.
+//Wider cones are almost never entirely back-facing, so they are not worth the larger meshlet.
+inline constexpr float kMeshletMinNormalAlignment{0.6f};
+
+/// @brief A cluster of spatially connected triangles of a mesh that is culled as a unit.
+/// @brief Every face normal of the cluster lies within a cone around cone_axis with half-angle asin(cone_cutoff).
+struct Meshlet {
+    std::uint32_t first;      //Index of the first entry of this meshlet in the mesh's meshlet face list
+    std::uint32_t count;      //Number of triangles
+    BoundingSphere sphere;    //Object-space bounds of the triangles
+    Vec3f cone_axis;          //Average direction of the face normals
+    float cone_cutoff;        //sin of the half-angle of the normal cone; 1 if the cone is too wide to ever cull
+};
+
+/// @brief Partition of a mesh into meshlets.
+struct MeshletData {
+    std::vector<Meshlet> meshlets;
+    std::vector<std::uint32_t> faces; //Face indices, grouped by meshlet
+};
+
+/// @brief Tests whether every triangle of a meshlet faces away from a viewer.
+/// @param viewer Position of the viewer, in the same space as the meshlet (i.e. object space).
+[[nodiscard]] inline bool IsBackFacing(const Meshlet& meshlet, const Vec3f& viewer) {
+    //A triangle faces away when the direction from the viewer to it lies within 90 degrees of its normal.
+    //That holds for every normal in the cone if the view direction lies within (90 - half-angle) degrees of the axis.
+    //Using the bounding sphere makes the test conservative for every point of the meshlet (see meshoptimizer's meshopt_computeClusterBounds).
+    const auto to_center = meshlet.sphere.center - viewer;
+    return la::dot(to_center, meshlet.cone_axis) >= meshlet.cone_cutoff*la::length(to_center) + meshlet.sphere.radius;
+}
+
+/// @brief Partitions a triangle mesh into meshlets by greedy region growing over shared vertices.
+/// @brief Each meshlet starts from the first unassigned triangle and grows by repeatedly adding the adjacent triangle whose
+/// @brief normal is closest to the meshlet's average normal (preferring triangles that share more vertices), which keeps the normal cones tight.
+/// @param positions Vertex positions.
+/// @param indices Three position indices per triangle.
+/// @param max_faces Maximum number of triangles per meshlet.
+[[nodiscard]] inline MeshletData BuildMeshlets(std::span<const Vec3f> positions, std::span<const std::int32_t> indices, std::uint32_t max_faces = kMeshletMaxFaces) {
+    assert(indices.size()%3==0);
+    const auto face_count = static_cast<std::uint32_t>(indices.size()/3);
+
+    auto corner = [&](std::uint32_t f, int i) { return positions[indices[3*f+i]]; };
+
+    //Unit face normals (zero for degenerate faces)
+    std::vector<Vec3f> normals(face_count);
+    for(std::uint32_t f = 0; f < face_count; ++f) {
+        const auto n = la::cross(corner(f,1) - corner(f,0), corner(f,2) - corner(f,0));
+        const auto len = la::length(n);
+        normals[f] = len>0.f ? n/len : Vec3f{0.f,0.f,0.f};
+    }
+
+    //Vertex -> faces adjacency, in compressed row form
+    std::vector<std::uint32_t> offsets(positions.size()+1, 0);
+    for(auto idx : indices) ++offsets[idx+1];
+    for(std::size_t i = 1; i < offsets.size(); ++i) offsets[i] += offsets[i-1];
+    std::vector<std::uint32_t> vertex_faces(indices.size());
+    {
+        auto fill = offsets;
+        for(std::uint32_t f = 0; f < face_count; ++f) {
+            for(int i = 0; i < 3; ++i) vertex_faces[fill[indices[3*f+i]]++] = f;
+        }
+    }
+
+    MeshletData out;
+    out.faces.reserve(face_count);
+    std::vector<bool> assigned(face_count, false);
+    std::vector<std::uint32_t> frontier;
+
+    for(std::uint32_t seed = 0; seed < face_count; ++seed) {
+        if(assigned[seed]) continue;
+
+        Meshlet meshlet{static_cast<std::uint32_t>(out.faces.size()), 0, {}, {0.f,0.f,0.f}, 1.f};
+        Vec3f normal_sum{0.f,0.f,0.f};
+        frontier.clear();
+
+        auto add = [&](std::uint32_t f) {
+            assigned[f] = true;
+            out.faces.push_back(f);
+            ++meshlet.count;
+            normal_sum += normals[f];
+            for(int i = 0; i < 3; ++i) {
+                const auto v = indices[3*f+i];
+                for(auto k = offsets[v]; k < offsets[v+1]; ++k) {
+                    if(!assigned[vertex_faces[k]]) frontier.push_back(vertex_faces[k]);
+                }
+            }
+        };
+
+        add(seed);
+        while(meshlet.count < max_faces) {
+            //Pick the unassigned neighbour that best matches the current average normal
+            std::size_t best = frontier.size();
+            float best_score = std::numeric_limits<float>::lowest();
+            const auto axis = la::normalize(normal_sum);
+            for(std::size_t k = 0; k < frontier.size(); ++k) {
+                if(assigned[frontier[k]]) continue;
+                const auto alignment = la::dot(normals[frontier[k]], axis);
+                if(alignment < kMeshletMinNormalAlignment) continue;
+                //A face appears in the frontier once per vertex it shares with the meshlet; favouring shared vertices keeps meshlets compact
+                const auto shared = std::count(frontier.begin(), frontier.end(), frontier[k]);
+                const auto score = alignment + 0.3f*static_cast<float>(shared);
+                if(score > best_score) { best_score = score; best = k; }
+            }
+            //Stop when the component is exhausted, or when every neighbour would widen the cone past the point where it is useful
+            if(best==frontier.size()) break;
+            const auto f = frontier[best];
+            std::erase_if(frontier, [&](std::uint32_t g) { return assigned[g] || g==f; });
+            add(f);
+        }
+
+        //Bounds
+        AABB box;
+        for(auto k = meshlet.first; k < meshlet.first+meshlet.count; ++k) {
+            for(int i = 0; i < 3; ++i) box.Extend(corner(out.faces[k], i));
+        }
+        meshlet.sphere = BoundingSphere{box.Center(), 0.f};
+        for(auto k = meshlet.first; k < meshlet.first+meshlet.count; ++k) {
+            for(int i = 0; i < 3; ++i) meshlet.sphere.radius = std::max(meshlet.sphere.radius, la::length(corner(out.faces[k], i) - meshlet.sphere.center));
+        }
+
+        //Normal cone. The half-angle is the widest angle between the axis and any face normal.
+        const auto axis_len = la::length(normal_sum);
+        if(axis_len > 0.f) {
+            meshlet.cone_axis = normal_sum/axis_len;
+            float min_dot = 1.f;
+            for(auto k = meshlet.first; k < meshlet.first+meshlet.count; ++k) {
+                min_dot = std::min(min_dot, la::dot(normals[out.faces[k]], meshlet.cone_axis));
+            }
+            //A cone wider than 90 degrees can never be entirely back-facing
+            meshlet.cone_cutoff = min_dot <= 0.f ? 1.f : std::sqrt(1.f - min_dot*min_dot);
+            if(min_dot <= 0.f) meshlet.cone_axis = Vec3f{0.f,0.f,0.f};
+        }
+
+        out.meshlets.push_back(meshlet);
+    }
+    return out;
+}
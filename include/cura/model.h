@@ -2,13 +2,20 @@
 
 #include <array>
 #include <fstream>
+#include <iostream>
+#include <optional>
 #include <ranges>
 #include <sstream>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#include <cura/binary_io.h>
+#include <cura/bounds.h>
+#include <cura/lod.h>
 #include <cura/math.h>
+#include <cura/meshlet.h>
+#include <cura/vertex_stream.h>
 
 /// @brief Splits a line into words by a specified delimiter
 /// @param line String to be split
@@ -33,29 +40,82 @@ struct Face {
     std::vector<int> tex_idx;
 };
 
+//One level of detail of a model. All levels share the model's vertex arrays.
+struct MeshLod {
+    std::vector<Face> faces;
+    MeshletData meshlets; //Clusters of faces that are culled together
+    float error{0.f}; //Object-space geometric error relative to the full-detail mesh
+};
+
 class Model {
 private:
     std::vector<Vec3f> vertices_;
         std::vector<Vec3f> normals_;
     std::vector<Vec2f> tex_coords_;
-    std::vector<Face> faces_;
+    std::vector<MeshLod> lods_; //lods_[0] is the mesh as loaded, followed by progressively simplified versions
+    VertexStream position_stream_; //vertices_ in SoA form, for the SIMD vertex transform
+    AABB bounds_; //Object-space bounds, used for culling
+    BoundingSphere sphere_;
 
     void Parse(std::string_view filename);
     [[nodiscard]] Vec3f ParseOBJVertexPos(std::string_view line); //Parses a geometric vertex line from an obj file
     [[nodiscard]] Vec2f ParseOBJTexCoords(std::string_view line); 
     [[nodiscard]] Vec3f ParseOBJVertexNorm(std::string_view line);
     [[nodiscard]] Face ParseOBJFaceIndices(std::string_view line);
+
+    Model() = default; //Used by Read()
     
 
 
 public:
     Model(std::string_view path) {
         Parse(path);
+        for(const auto& v : vertices_) bounds_.Extend(v);
+        sphere_ = ComputeBoundingSphere(vertices_, bounds_);
+
+        //Simplified levels reuse the attributes of the face each of their triangles came from, with new position indices.
+        std::vector<std::int32_t> indices;
+        indices.reserve(3*lods_[0].faces.size());
+        for(const auto& face : lods_[0].faces) {
+            indices.insert(indices.end(), face.pos_idx.begin(), face.pos_idx.begin()+3);
+        }
+        for(auto& level : BuildLodChain(vertices_, indices)) {
+            MeshLod lod;
+            lod.error = level.error;
+            lod.faces.reserve(level.source_faces.size());
+            for(std::size_t f = 0; f < level.source_faces.size(); ++f) {
+                auto face = lods_[0].faces[level.source_faces[f]];
+                std::copy_n(level.indices.begin()+3*f, 3, face.pos_idx.begin());
+                lod.faces.push_back(std::move(face));
+            }
+            lods_.push_back(std::move(lod));
+        }
+
+        for(auto& lod : lods_) {
+            indices.clear();
+            for(const auto& face : lod.faces) {
+                indices.insert(indices.end(), face.pos_idx.begin(), face.pos_idx.begin()+3);
+            }
+            lod.meshlets = BuildMeshlets(vertices_, indices);
+        }
+        position_stream_ = MakeVertexStream(vertices_);
     }
     const std::vector<Vec3f>& Vertices() const noexcept{return vertices_;};
     const std::vector<Vec2f>& TexCoords() const noexcept{return tex_coords_;}   
     const std::vector<Vec3f>& Normals() const noexcept{return normals_;};
-    const std::vector<Face>& Faces() const noexcept{return faces_;}; //TODO switch to array?
+    const std::vector<Face>& Faces(std::size_t lod = 0) const noexcept{return lods_[lod].faces;}; //TODO switch to array?
+    const VertexStream& PositionStream() const noexcept{return position_stream_;}
+    const AABB& Bounds() const noexcept{return bounds_;}
+    const BoundingSphere& Sphere() const noexcept{return sphere_;}
+    const std::vector<Meshlet>& Meshlets(std::size_t lod = 0) const noexcept{return lods_[lod].meshlets.meshlets;}
+    const std::vector<std::uint32_t>& MeshletFaces(std::size_t lod = 0) const noexcept{return lods_[lod].meshlets.faces;} //Face indices, grouped by meshlet
+    std::size_t LodCount() const noexcept{return lods_.size();}
+    float LodError(std::size_t lod) const noexcept{return lods_[lod].error;}
+
+    //Writes the processed model (vertex arrays, and every level of detail with its meshlets) in a flat binary form.
+    void Write(std::ostream& out) const;
+    //Reads a model written by Write(). Returns nullopt if the data is truncated or malformed.
+    [[nodiscard]] static std::optional<Model> Read(std::istream& in);
 
 
 };
@@ -112,6 +172,7 @@ Face Model::ParseOBJFaceIndices(std::string_view line) {
 //Parses an obj file
 //Fills the vertices and faces attributes
 void Model::Parse(std::string_view filename) {
+    auto& faces = lods_.emplace_back().faces;
     if(!filename.ends_with(".obj")) {
         std::cerr<<"Incorrect file format.\n";
     }
@@ -133,7 +194,49 @@ void Model::Parse(std::string_view filename) {
             normals_.push_back(ParseOBJVertexNorm(curr_line));
         }
         if(curr_line.compare(0,2,"f ")==0) {
-            faces_.push_back(ParseOBJFaceIndices(curr_line));
+            faces.push_back(ParseOBJFaceIndices(curr_line));
         }
     }
 };
+
+
+inline void Model::Write(std::ostream& out) const {
+    WriteArray(out, vertices_);
+    WriteArray(out, normals_);
+    WriteArray(out, tex_coords_);
+    WritePod(out, bounds_);
+    WritePod(out, sphere_);
+    WritePod(out, static_cast<std::uint64_t>(lods_.size()));
+    for(const auto& lod : lods_) {
+        WritePod(out, lod.error);
+        WritePod(out, static_cast<std::uint64_t>(lod.faces.size()));
+        for(const auto& face : lod.faces) {
+            WriteArray(out, face.pos_idx);
+            WriteArray(out, face.norm_idx);
+            WriteArray(out, face.tex_idx);
+        }
+        WriteArray(out, lod.meshlets.meshlets);
+        WriteArray(out, lod.meshlets.faces);
+    }
+}
+
+inline std::optional<Model> Model::Read(std::istream& in) {
+    Model model;
+    if(!ReadArray(in, model.vertices_) || !ReadArray(in, model.normals_) || !ReadArray(in, model.tex_coords_)) return std::nullopt;
+    if(!ReadPod(in, model.bounds_) || !ReadPod(in, model.sphere_)) return std::nullopt;
+
+    std::uint64_t lod_count = 0;
+    if(!ReadPod(in, lod_count) || lod_count==0 || lod_count > 64) return std::nullopt;
+    model.lods_.resize(lod_count);
+    for(auto& lod : model.lods_) {
+        std::uint64_t face_count = 0;
+        if(!ReadPod(in, lod.error) || !ReadPod(in, face_count) || face_count > kMaxBinaryArrayBytes/sizeof(Face)) return std::nullopt;
+        lod.faces.resize(face_count);
+        for(auto& face : lod.faces) {
+            if(!ReadArray(in, face.pos_idx) || !ReadArray(in, face.norm_idx) || !ReadArray(in, face.tex_idx)) return std::nullopt;
+        }
+        if(!ReadArray(in, lod.meshlets.meshlets) || !ReadArray(in, lod.meshlets.faces)) return std::nullopt;
+    }
+    model.position_stream_ = MakeVertexStream(model.vertices_);
+    return model;
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <cura/buffer.h>
+#include <cura/light.h>
+#include <cura/math.h>
+#include <cura/model.h>
+#include <cura/rasterizer.h>
+#include <cura/renderer.h>
+#include <cura/shader.h>
+#include <cura/thread_pool.h>
+#include <cura/transforms.h>
+#include <cura/vertex.h>
+
+//Phong lighting with diffuse, normal and specular maps: the lighting NormalMapShader describes, on the live rasterizer.
+//Fragments are shaded either one at a time, or four at a time in 2x2 quads with every step written as a fixed-size loop over
+//the lanes (SPMD style) so that the compiler can vectorize it.
+
+//Exponent of the specular highlight, as a power of two: 2^6 = 64.
+inline constexpr std::int32_t kSpecularExponentLog2{6};
+
+//x^64 by repeated squaring. Exact up to rounding, and far cheaper than std::pow.
+[[nodiscard]] inline float SpecularPower(float x) {
+    for(std::int32_t i = 0; i < kSpecularExponentLog2; ++i) x *= x;
+    return x;
+}
+
+/// @brief Textures of a normal-mapped surface. The normal map holds object-space normals, stored in [0,1].
+struct NormalMapMaterial {
+    TextureRef diffuse;
+    TextureRef normal;
+    TextureRef specular;
+};
+
+/// @brief A distant light and the viewer, moved into a model's object space once per draw.
+/// @brief Fragments can then be lit with their object-space normals directly, instead of transforming every normal to world space.
+/// @brief Exact for rotations, translations and uniform scales.
+struct ObjectSpaceLighting {
+    Norm3f light_dir; //Direction the light travels
+    Vec3f eye;        //Camera position
+    Color3f ambient;
+    Color3f diffuse;
+    Color3f specular;
+};
+
+/// @param transform Object-to-world matrix.
+/// @param view World-to-camera matrix.
+[[nodiscard]] inline ObjectSpaceLighting MakeObjectSpaceLighting(const DistantLight& light, const Mat44f& transform, const Mat44f& view) {
+    const auto to_object = la::inverse(transform);
+    return ObjectSpaceLighting{
+        la::normalize(la::mul(to_object, Vec4f(light.Direction, 0.f)).xyz()),
+        ViewPosition(la::mul(view, transform)),
+        light.Ambient, light.Diffuse, light.Specular
+    };
+}
+
+/// @brief Lights one fragment.
+/// @param position Object-space position of the fragment.
+/// @param uv Texture coordinates, in [0,1].
+[[nodiscard]] inline Color3f ShadeNormalMapped(const NormalMapMaterial& material, const ObjectSpaceLighting& lighting, const Vec3f& position, const Vec2f& uv) {
+    const auto albedo = TextureLookup(material.diffuse, uv.x, uv.y);
+    const auto n = la::normalize(2.f*TextureLookup(material.normal, uv.x, uv.y) - Vec3f(1.f,1.f,1.f));
+    const auto& l = lighting.light_dir;
+
+    const auto diffuse = std::max(la::dot(n, -l), 0.f);
+    const auto view_dir = la::normalize(lighting.eye - position);
+    const auto reflect_dir = l - 2.f*la::dot(n, l)*n;
+    const auto specular = SpecularPower(std::max(la::dot(view_dir, reflect_dir), 0.f));
+
+    return (lighting.ambient + diffuse*lighting.diffuse)*albedo + specular*lighting.specular*TextureLookup(material.specular, uv.x, uv.y);
+}
+
+//Four fragments (the lanes of a 2x2 quad) in structure-of-arrays form.
+inline constexpr std::size_t kQuadLanes{4};
+using QuadFloat = std::array<float,kQuadLanes>;
+
+/// @brief Lights the four lanes of a quad. The same math as ShadeNormalMapped, with each step a loop over the lanes.
+/// @brief Only the texture fetches are per lane; everything else vectorizes. Every lane is shaded: lanes that will not be written
+/// @brief cost nothing extra in SIMD and keep the loops free of branches.
+/// @param px,py,pz Object-space positions.
+/// @param u,v Texture coordinates, in [0,1].
+[[nodiscard]] inline std::array<Color3f,kQuadLanes> ShadeNormalMappedQuad(const NormalMapMaterial& material, const ObjectSpaceLighting& lighting,
+                                                                          const QuadFloat& px, const QuadFloat& py, const QuadFloat& pz, const QuadFloat& u, const QuadFloat& v) {
+    //Fetch
+    std::array<Color3f,kQuadLanes> albedo, encoded, specular_map;
+    for(std::size_t i = 0; i < kQuadLanes; ++i) albedo[i] = TextureLookup(material.diffuse, u[i], v[i]);
+    for(std::size_t i = 0; i < kQuadLanes; ++i) encoded[i] = TextureLookup(material.normal, u[i], v[i]);
+    for(std::size_t i = 0; i < kQuadLanes; ++i) specular_map[i] = TextureLookup(material.specular, u[i], v[i]);
+
+    //Decode the normals from [0,1] to unit vectors in [-1,1]
+    QuadFloat nx, ny, nz;
+    for(std::size_t i = 0; i < kQuadLanes; ++i) {
+        nx[i] = 2.f*encoded[i].x - 1.f;
+        ny[i] = 2.f*encoded[i].y - 1.f;
+        nz[i] = 2.f*encoded[i].z - 1.f;
+        const auto inv_len = 1.f/std::sqrt(nx[i]*nx[i] + ny[i]*ny[i] + nz[i]*nz[i]);
+        nx[i] *= inv_len; ny[i] *= inv_len; nz[i] *= inv_len;
+    }
+
+    const auto [lx, ly, lz] = lighting.light_dir;
+    QuadFloat diffuse, specular;
+    for(std::size_t i = 0; i < kQuadLanes; ++i) {
+        const auto n_dot_l = nx[i]*lx + ny[i]*ly + nz[i]*lz;
+        diffuse[i] = std::max(-n_dot_l, 0.f);
+
+        auto vx = lighting.eye.x - px[i];
+        auto vy = lighting.eye.y - py[i];
+        auto vz = lighting.eye.z - pz[i];
+        const auto inv_len = 1.f/std::sqrt(vx*vx + vy*vy + vz*vz);
+        vx *= inv_len; vy *= inv_len; vz *= inv_len;
+
+        const auto rx = lx - 2.f*n_dot_l*nx[i];
+        const auto ry = ly - 2.f*n_dot_l*ny[i];
+        const auto rz = lz - 2.f*n_dot_l*nz[i];
+        specular[i] = SpecularPower(std::max(vx*rx + vy*ry + vz*rz, 0.f));
+    }
+
+    std::array<Color3f,kQuadLanes> out;
+    for(std::size_t i = 0; i < kQuadLanes; ++i) {
+        out[i] = (lighting.ambient + diffuse[i]*lighting.diffuse)*albedo[i] + specular[i]*lighting.specular*specular_map[i];
+    }
+    return out;
+}
+
+
+/// @brief Rasterizes a normal-mapped triangle into a single-sampled image, with the same coverage and depth as DrawTriangle.
+/// @brief With 'quads' set, pixels are visited in 2x2 quads (see RasterizeQuads) and depth-tested and shaded four lanes at a time;
+/// @brief lanes that are uncovered or fail the depth test are masked out of the writes. Otherwise each fragment is shaded on its own.
+/// @param p0,p1,p2 Object-space positions of the vertices, interpolated perspective-correctly for the view direction.
+/// @param image A FrameBuffer, or a TileBuffer covering 'tile'.
+template<typename Target>
+inline void DrawTriangleNormalMapped(const ClippedVertex& cv0, const ClippedVertex& cv1, const ClippedVertex& cv2, const Vec3f& p0, const Vec3f& p1, const Vec3f& p2,
+                                     Target& image, const NormalMapMaterial& material, const ObjectSpaceLighting& lighting, const Tile& tile, bool quads = true) {
+    assert(image.samples==1);
+    if(cv0.clip_z>=0.f || cv1.clip_z>=0.f || cv2.clip_z>=0.f) return;
+
+    const auto setup = SetupTriangle(cv0.pixel_coords.xy(), cv1.pixel_coords.xy(), cv2.pixel_coords.xy());
+    if(!setup) return;
+    const auto& tri = *setup;
+    const auto bounds = PixelBounds(tri, tile);
+    if(bounds.Empty()) return;
+
+    const auto inv_z0 = 1.f/cv0.clip_z;
+    const auto inv_z1 = 1.f/cv1.clip_z;
+    const auto inv_z2 = 1.f/cv2.clip_z;
+    const auto inv_area = 1.f/static_cast<float>(tri.area);
+
+    //Attributes divided by z at each vertex, so that interpolating them and multiplying by the interpolated z is perspective-correct
+    const auto t0 = cv0.tex_coords*inv_z0, t1 = cv1.tex_coords*inv_z1, t2 = cv2.tex_coords*inv_z2;
+    const auto q0 = p0*inv_z0, q1 = p1*inv_z1, q2 = p2*inv_z2;
+
+    if(!quads) {
+        Rasterize(tri, bounds, [&](std::int32_t x, std::int32_t y, std::int64_t w0, std::int64_t w1, std::int64_t w2) {
+            const auto b0 = static_cast<float>(w0)*inv_area;
+            const auto b1 = static_cast<float>(w1)*inv_area;
+            const auto b2 = static_cast<float>(w2)*inv_area;
+            const auto depth = 1.f/(b0*inv_z0 + b1*inv_z1 + b2*inv_z2);
+            if(depth<image.Depth(x,y)) return;
+            image.Depth(x,y) = depth;
+
+            const auto tex = (b0*t0 + b1*t1 + b2*t2)*depth;
+            const auto position = (b0*q0 + b1*q1 + b2*q2)*depth;
+            const Vec2f uv{ClampTexCoord(tex.x), ClampTexCoord(tex.y)};
+            image.Color(x,y) = ShadeNormalMapped(material, lighting, position, uv);
+        });
+        return;
+    }
+
+    RasterizeQuads(tri, bounds, [&](std::int32_t x, std::int32_t y, std::uint32_t mask, const auto& w0, const auto& w1, const auto& w2) {
+        //Depth test the covered lanes first, so that hidden quads are never shaded
+        QuadFloat b0, b1, b2, depth;
+        std::uint32_t passed = 0;
+        for(std::size_t i = 0; i < kQuadLanes; ++i) {
+            b0[i] = static_cast<float>(w0[i])*inv_area;
+            b1[i] = static_cast<float>(w1[i])*inv_area;
+            b2[i] = static_cast<float>(w2[i])*inv_area;
+            depth[i] = 1.f/(b0[i]*inv_z0 + b1[i]*inv_z1 + b2[i]*inv_z2);
+        }
+        for(std::size_t i = 0; i < kQuadLanes; ++i) {
+            if(!(mask >> i & 1u)) continue;
+            const auto lx = x + static_cast<std::int32_t>(i%2);
+            const auto ly = y + static_cast<std::int32_t>(i/2);
+            if(depth[i]>=image.Depth(lx,ly)) passed |= 1u << i;
+        }
+        if(!passed) return;
+
+        //Interpolate for every lane. Helper lanes lie outside the triangle, so their texture coordinates are sanitized.
+        QuadFloat u, v, px, py, pz;
+        for(std::size_t i = 0; i < kQuadLanes; ++i) {
+            u[i] = ClampTexCoord((b0[i]*t0.x + b1[i]*t1.x + b2[i]*t2.x)*depth[i]);
+            v[i] = ClampTexCoord((b0[i]*t0.y + b1[i]*t1.y + b2[i]*t2.y)*depth[i]);
+            px[i] = (b0[i]*q0.x + b1[i]*q1.x + b2[i]*q2.x)*depth[i];
+            py[i] = (b0[i]*q0.y + b1[i]*q1.y + b2[i]*q2.y)*depth[i];
+            pz[i] = (b0[i]*q0.z + b1[i]*q1.z + b2[i]*q2.z)*depth[i];
+        }
+        const auto colors = ShadeNormalMappedQuad(material, lighting, px, py, pz, u, v);
+
+        for(std::size_t i = 0; i < kQuadLanes; ++i) {
+            if(!(passed >> i & 1u)) continue;
+            const auto lx = x + static_cast<std::int32_t>(i%2);
+            const auto ly = y + static_cast<std::int32_t>(i/2);
+            image.Depth(lx,ly) = depth[i];
+            image.Color(lx,ly) = colors[i];
+        }
+    });
+}
+
+/// @brief Draws a normal-mapped model lit by a distant light, by splitting the image into tiles and rasterizing the tiles in parallel.
+/// @brief Binning and tile memory work as in DrawBatches.
+/// @param transform Object-to-world matrix.
+/// @param view World-to-camera matrix.
+/// @param projection Camera-to-clip matrix.
+/// @param quads Shade in 2x2 quads (see DrawTriangleNormalMapped) rather than one fragment at a time.
+inline void DrawModelNormalMapped(const Model& model, const NormalMapMaterial& material, const DistantLight& light, const Mat44f& transform, const Mat44f& view, const Mat44f& projection,
+                                  FrameBuffer& image, ThreadPool& pool, bool quads = true, std::int32_t tile_size = kDefaultTileSize) {
+    assert(image.samples==1 && "Error: normal-mapped drawing does not support multisampling!");
+    const auto model_view = la::mul(view, transform);
+    const auto lighting = MakeObjectSpaceLighting(light, transform, view);
+
+    const DrawBatch batch{ProcessVertices(model, model_view, projection, image.height, image.width), material.diffuse};
+    const auto tiles = SplitIntoTiles(image.height, image.width, tile_size);
+    const auto bins = BinTriangles(std::span(&batch, 1), image.height, image.width, tile_size);
+    const auto& faces = model.Faces();
+    const auto& positions = model.Vertices();
+
+    pool.ParallelFor(0, static_cast<std::int32_t>(tiles.size()), [&](std::int32_t t) {
+        if(bins[t].empty()) return;
+        thread_local TileBuffer scratch;
+        scratch.Reset(tiles[t], image.samples);
+        scratch.Load(image);
+        for(const auto& binned : bins[t]) {
+            const auto i = binned.first_vertex;
+            const auto& face = faces[i/3];
+            DrawTriangleNormalMapped(batch.vertices[i], batch.vertices[i+1], batch.vertices[i+2],
+                                     positions[face.pos_idx[0]], positions[face.pos_idx[1]], positions[face.pos_idx[2]],
+                                     scratch, material, lighting, tiles[t], quads);
+        }
+        scratch.Store(image);
+    });
+}
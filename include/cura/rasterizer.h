@@ -1,7 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
 #include <optional>
 
+#include <cura/buffer.h>
 #include <cura/math.h>
 
 /// @brief      Determines whether a point lies to the 'left' or 'right' of a vector, assuming you are oriented in the same direction as the vector. 
@@ -47,3 +53,301 @@
     }
     return std::nullopt;
 }
+
+
+
+//Vertex positions are snapped to 1/256 of a pixel before integer rasterization.
+inline constexpr std::int32_t kSubpixelBits{8};
+inline constexpr std::int64_t kSubpixelOne{std::int64_t{1}<<kSubpixelBits};
+//Vertices further than this many pixels from the origin are not rasterized: edge functions would overflow 64 bits.
+//Without clipping (TODO), this only happens to triangles with a vertex almost in the camera plane.
+inline constexpr float kMaxRasterCoord{1<<20};
+
+/// @brief An edge function in fixed point, E(p) = a*p.x + b*p.y + c, for p in subpixel units.
+/// @brief E is positive on the inside of the edge. 'bias' is 0 for top and left edges and -1 otherwise,
+/// @brief so that a point exactly on an edge shared by two triangles is covered by exactly one of them (the top-left rule).
+struct FixedEdge {
+    std::int64_t a;
+    std::int64_t b;
+    std::int64_t c;
+    std::int64_t bias;
+
+    [[nodiscard]] std::int64_t Evaluate(std::int64_t x, std::int64_t y) const noexcept { return a*x + b*y + c; }
+};
+
+/// @brief A triangle set up for integer rasterization.
+struct FixedTriangle {
+    std::array<FixedEdge,3> edges; //edges[i] is the edge opposite vertex i, so edges[i]/area is the barycentric coordinate of vertex i
+    std::int64_t area;             //Twice the area of the triangle, in subpixel units. Always positive.
+    std::int64_t min_x, min_y;     //Bounding box of the snapped vertices, in subpixel units
+    std::int64_t max_x, max_y;
+};
+
+//Subpixel coordinate of the center of pixel i
+[[nodiscard]] constexpr std::int64_t PixelCenter(std::int32_t i) noexcept { return i*kSubpixelOne + kSubpixelOne/2; }
+
+//Smallest pixel whose center is >= the subpixel coordinate v
+[[nodiscard]] constexpr std::int32_t FirstPixelAtOrAfter(std::int64_t v) noexcept {
+    const auto n = v - kSubpixelOne/2;
+    return static_cast<std::int32_t>(n>=0 ? (n + kSubpixelOne - 1)/kSubpixelOne : -((-n)/kSubpixelOne));
+}
+
+//Largest pixel whose center is <= the subpixel coordinate v
+[[nodiscard]] constexpr std::int32_t LastPixelAtOrBefore(std::int64_t v) noexcept {
+    const auto n = v - kSubpixelOne/2;
+    return static_cast<std::int32_t>(n>=0 ? n/kSubpixelOne : -((-n + kSubpixelOne - 1)/kSubpixelOne));
+}
+
+/// @brief Snaps a screen-space triangle to the subpixel grid and computes its integer edge functions.
+/// @brief The winding convention matches oBarycentrics (covered points have EdgeFunction <= 0 for every edge).
+/// @return The set-up triangle, or nothing if it is back-facing, degenerate after snapping or too far off-screen.
+[[nodiscard]] inline std::optional<FixedTriangle> SetupTriangle(const Vec2f& v0, const Vec2f& v1, const Vec2f& v2) {
+    for(const auto& v : {v0, v1, v2}) {
+        if(!(std::abs(v.x)<kMaxRasterCoord && std::abs(v.y)<kMaxRasterCoord)) return std::nullopt;
+    }
+    const auto snap = [](float f) { return static_cast<std::int64_t>(std::lround(f*static_cast<float>(kSubpixelOne))); };
+    const std::array<std::int64_t,3> x{snap(v0.x), snap(v1.x), snap(v2.x)};
+    const std::array<std::int64_t,3> y{snap(v0.y), snap(v1.y), snap(v2.y)};
+
+    FixedTriangle tri;
+    for(int i = 0; i < 3; ++i) {
+        const auto from = (i+1)%3;
+        const auto to = (i+2)%3;
+        auto& e = tri.edges[i];
+        //E(p) = cross(p - from, to - from). The gradient (a,b) points into the triangle.
+        e.a = y[to] - y[from];
+        e.b = x[from] - x[to];
+        e.c = -(e.a*x[from] + e.b*y[from]);
+        //With y pointing down, a left edge has the inside to its right (a > 0) and a top edge is horizontal with the inside below (b > 0)
+        const bool top_left = e.a>0 || (e.a==0 && e.b>0);
+        e.bias = top_left ? 0 : -1;
+    }
+    tri.area = tri.edges[0].Evaluate(x[0], y[0]);
+    if(tri.area<=0) return std::nullopt;
+
+    tri.min_x = std::min({x[0], x[1], x[2]});
+    tri.min_y = std::min({y[0], y[1], y[2]});
+    tri.max_x = std::max({x[0], x[1], x[2]});
+    tri.max_y = std::max({y[0], y[1], y[2]});
+    return tri;
+}
+
+/// @brief Pixels whose centers lie in the bounding box of a triangle, restricted to a tile.
+/// @param pad Amount (in subpixel units) by which to grow the bounding box first, e.g. to reach multisample positions.
+[[nodiscard]] inline Tile PixelBounds(const FixedTriangle& tri, const Tile& tile, std::int64_t pad = 0) {
+    return Tile{
+        std::max(FirstPixelAtOrAfter(tri.min_x - pad), tile.x0),
+        std::max(FirstPixelAtOrAfter(tri.min_y - pad), tile.y0),
+        std::min(LastPixelAtOrBefore(tri.max_x + pad) + 1, tile.x1),
+        std::min(LastPixelAtOrBefore(tri.max_y + pad) + 1, tile.y1)
+    };
+}
+
+
+//Side of the square blocks that Rasterize classifies before testing individual pixels.
+inline constexpr std::int32_t kRasterBlockSize{8};
+
+//Counts of the work done by the rasterizer, for benchmarking.
+struct RasterStats {
+    std::uint64_t blocks_outside{0};  //Blocks rejected without testing any pixel
+    std::uint64_t blocks_partial{0};  //Blocks whose pixels were tested one by one
+    std::uint64_t blocks_inside{0};   //Blocks filled without testing any pixel
+    std::uint64_t pixels_tested{0};   //Pixels whose edge functions were tested
+    std::uint64_t pixels_covered{0};  //Pixels passed to the fragment stage
+};
+
+/// @brief Calls fragment(x, y, w0, w1, w2) for every pixel of 'bounds' whose center the triangle covers, testing every pixel of the bounds.
+/// @brief w0, w1, w2 are the edge functions at the pixel center; divided by tri.area they are the barycentric coordinates.
+template<typename Fragment>
+inline void RasterizeBoundingBox(const FixedTriangle& tri, const Tile& bounds, Fragment&& fragment, RasterStats* stats = nullptr) {
+    const auto& [e0, e1, e2] = tri.edges;
+    auto row_w0 = e0.Evaluate(PixelCenter(bounds.x0), PixelCenter(bounds.y0));
+    auto row_w1 = e1.Evaluate(PixelCenter(bounds.x0), PixelCenter(bounds.y0));
+    auto row_w2 = e2.Evaluate(PixelCenter(bounds.x0), PixelCenter(bounds.y0));
+    std::uint64_t covered = 0;
+
+    for(auto y = bounds.y0; y < bounds.y1; ++y) {
+        auto w0 = row_w0;
+        auto w1 = row_w1;
+        auto w2 = row_w2;
+        for(auto x = bounds.x0; x < bounds.x1; ++x, w0 += e0.a*kSubpixelOne, w1 += e1.a*kSubpixelOne, w2 += e2.a*kSubpixelOne) {
+            //Inside if every biased edge function is >= 0, i.e. none of their sign bits are set
+            if(((w0 + e0.bias) | (w1 + e1.bias) | (w2 + e2.bias)) < 0) continue;
+            ++covered;
+            fragment(x, y, w0, w1, w2);
+        }
+        row_w0 += e0.b*kSubpixelOne;
+        row_w1 += e1.b*kSubpixelOne;
+        row_w2 += e2.b*kSubpixelOne;
+    }
+    if(stats) {
+        stats->pixels_tested += static_cast<std::uint64_t>(bounds.x1-bounds.x0)*(bounds.y1-bounds.y0);
+        stats->pixels_covered += covered;
+    }
+}
+
+/// @brief Like RasterizeBoundingBox, but first classifies kRasterBlockSize^2 blocks of pixels against the three edges.
+/// @brief An edge function is affine, so its extremes over a block are at the block's corners. Blocks outside any edge are skipped,
+/// @brief blocks inside all three are filled without per-pixel tests, and only blocks that straddle an edge test their pixels.
+/// @brief Blocks are aligned to multiples of kRasterBlockSize, so they never straddle tiles (whose size is a multiple of it).
+template<typename Fragment>
+inline void RasterizeBlocks(const FixedTriangle& tri, const Tile& bounds, Fragment&& fragment, RasterStats* stats = nullptr) {
+    const auto& edges = tri.edges;
+    const auto block_x0 = bounds.x0 - bounds.x0%kRasterBlockSize;
+    const auto block_y0 = bounds.y0 - bounds.y0%kRasterBlockSize;
+
+    for(auto by = block_y0; by < bounds.y1; by += kRasterBlockSize) {
+        for(auto bx = block_x0; bx < bounds.x1; bx += kRasterBlockSize) {
+            const Tile block{std::max(bx, bounds.x0), std::max(by, bounds.y0), std::min(bx + kRasterBlockSize, bounds.x1), std::min(by + kRasterBlockSize, bounds.y1)};
+            const auto span_x = (block.x1 - 1 - block.x0)*kSubpixelOne;
+            const auto span_y = (block.y1 - 1 - block.y0)*kSubpixelOne;
+
+            bool outside = false;
+            bool inside = true;
+            for(const auto& e : edges) {
+                const auto corner = e.Evaluate(PixelCenter(block.x0), PixelCenter(block.y0)) + e.bias;
+                const auto dx = e.a*span_x;
+                const auto dy = e.b*span_y;
+                const auto max_w = corner + std::max<std::int64_t>(dx, 0) + std::max<std::int64_t>(dy, 0);
+                const auto min_w = corner + std::min<std::int64_t>(dx, 0) + std::min<std::int64_t>(dy, 0);
+                outside |= max_w < 0;
+                inside &= min_w >= 0;
+            }
+
+            if(outside) {
+                if(stats) ++stats->blocks_outside;
+                continue;
+            }
+            if(!inside) {
+                if(stats) ++stats->blocks_partial;
+                RasterizeBoundingBox(tri, block, fragment, stats);
+                continue;
+            }
+
+            //Every pixel of the block is covered: step the edge functions only to interpolate
+            const auto& [e0, e1, e2] = edges;
+            auto row_w0 = e0.Evaluate(PixelCenter(block.x0), PixelCenter(block.y0));
+            auto row_w1 = e1.Evaluate(PixelCenter(block.x0), PixelCenter(block.y0));
+            auto row_w2 = e2.Evaluate(PixelCenter(block.x0), PixelCenter(block.y0));
+            for(auto y = block.y0; y < block.y1; ++y) {
+                auto w0 = row_w0;
+                auto w1 = row_w1;
+                auto w2 = row_w2;
+                for(auto x = block.x0; x < block.x1; ++x, w0 += e0.a*kSubpixelOne, w1 += e1.a*kSubpixelOne, w2 += e2.a*kSubpixelOne) {
+                    fragment(x, y, w0, w1, w2);
+                }
+                row_w0 += e0.b*kSubpixelOne;
+                row_w1 += e1.b*kSubpixelOne;
+                row_w2 += e2.b*kSubpixelOne;
+            }
+            if(stats) {
+                ++stats->blocks_inside;
+                stats->pixels_covered += static_cast<std::uint64_t>(block.x1-block.x0)*(block.y1-block.y0);
+            }
+        }
+    }
+}
+
+/// @brief Calls fragment(x, y, w0, w1, w2) for every pixel of 'bounds' whose center the triangle covers.
+/// @brief Triangles that fit in a single block are tested pixel by pixel; larger ones are traversed by block.
+template<typename Fragment>
+inline void Rasterize(const FixedTriangle& tri, const Tile& bounds, Fragment&& fragment, RasterStats* stats = nullptr) {
+    if(bounds.x1-bounds.x0 <= kRasterBlockSize && bounds.y1-bounds.y0 <= kRasterBlockSize) {
+        RasterizeBoundingBox(tri, bounds, fragment, stats);
+    }
+    else {
+        RasterizeBlocks(tri, bounds, fragment, stats);
+    }
+}
+
+
+/// @brief Calls quad(x, y, mask, w0, w1, w2) for every 2x2 quad of pixels, aligned to even coordinates, that the triangle covers at least partly.
+/// @brief (x,y) is the quad's top-left pixel and lane i is pixel (x + i%2, y + i/2). Bit i of 'mask' is set if that pixel's center is
+/// @brief covered and the pixel lies in 'bounds'. The edge functions are given for all four lanes, including the uncovered 'helper' lanes,
+/// @brief so that attributes can be evaluated (and differenced) across the whole quad.
+template<typename Quad>
+inline void RasterizeQuads(const FixedTriangle& tri, const Tile& bounds, Quad&& quad) {
+    const auto& [e0, e1, e2] = tri.edges;
+    const auto qx0 = bounds.x0 - bounds.x0%2;
+    const auto qy0 = bounds.y0 - bounds.y0%2;
+
+    //Offsets of each lane's edge functions from the quad's top-left pixel
+    std::array<std::int64_t,4> d0, d1, d2;
+    for(std::size_t i = 0; i < 4; ++i) {
+        const auto dx = static_cast<std::int64_t>(i%2)*kSubpixelOne;
+        const auto dy = static_cast<std::int64_t>(i/2)*kSubpixelOne;
+        d0[i] = e0.a*dx + e0.b*dy;
+        d1[i] = e1.a*dx + e1.b*dy;
+        d2[i] = e2.a*dx + e2.b*dy;
+    }
+
+    auto row_w0 = e0.Evaluate(PixelCenter(qx0), PixelCenter(qy0));
+    auto row_w1 = e1.Evaluate(PixelCenter(qx0), PixelCenter(qy0));
+    auto row_w2 = e2.Evaluate(PixelCenter(qx0), PixelCenter(qy0));
+    std::array<std::int64_t,4> w0, w1, w2;
+    for(auto y = qy0; y < bounds.y1; y += 2) {
+        auto q0 = row_w0;
+        auto q1 = row_w1;
+        auto q2 = row_w2;
+        for(auto x = qx0; x < bounds.x1; x += 2, q0 += 2*e0.a*kSubpixelOne, q1 += 2*e1.a*kSubpixelOne, q2 += 2*e2.a*kSubpixelOne) {
+            std::uint32_t mask = 0;
+            for(std::size_t i = 0; i < 4; ++i) {
+                w0[i] = q0 + d0[i];
+                w1[i] = q1 + d1[i];
+                w2[i] = q2 + d2[i];
+                const auto px = x + static_cast<std::int32_t>(i%2);
+                const auto py = y + static_cast<std::int32_t>(i/2);
+                const bool covered = ((w0[i] + e0.bias) | (w1[i] + e1.bias) | (w2[i] + e2.bias)) >= 0;
+                const bool in_bounds = px>=bounds.x0 && px<bounds.x1 && py>=bounds.y0 && py<bounds.y1;
+                mask |= static_cast<std::uint32_t>(covered && in_bounds) << i;
+            }
+            if(mask) quad(x, y, mask, w0, w1, w2);
+        }
+        row_w0 += 2*e0.b*kSubpixelOne;
+        row_w1 += 2*e1.b*kSubpixelOne;
+        row_w2 += 2*e2.b*kSubpixelOne;
+    }
+}
+
+
+/// @brief Calls span(x, y, count, mask, w0, w1, w2) for every run of N pixels of a row, starting at bounds.x0, that the triangle covers at least partly.
+/// @brief Lane i is pixel (x+i, y) and count is the number of lanes inside 'bounds' (N except for the last run of a row).
+/// @brief Bit i of 'mask' is set if lane i is covered and inside 'bounds'. The edge functions are given for all N lanes.
+/// @brief Runs of consecutive pixels suit per-row work such as depth testing a contiguous span of a depth buffer.
+template<std::size_t N, typename Span>
+inline void RasterizeSpans(const FixedTriangle& tri, const Tile& bounds, Span&& span) {
+    static_assert(N<=32);
+    const auto& [e0, e1, e2] = tri.edges;
+
+    //Offsets of each lane's edge functions from the first pixel of the run
+    std::array<std::int64_t,N> d0, d1, d2;
+    for(std::size_t i = 0; i < N; ++i) {
+        const auto dx = static_cast<std::int64_t>(i)*kSubpixelOne;
+        d0[i] = e0.a*dx;
+        d1[i] = e1.a*dx;
+        d2[i] = e2.a*dx;
+    }
+
+    auto row_w0 = e0.Evaluate(PixelCenter(bounds.x0), PixelCenter(bounds.y0));
+    auto row_w1 = e1.Evaluate(PixelCenter(bounds.x0), PixelCenter(bounds.y0));
+    auto row_w2 = e2.Evaluate(PixelCenter(bounds.x0), PixelCenter(bounds.y0));
+    constexpr auto kstep = static_cast<std::int64_t>(N)*kSubpixelOne;
+    std::array<std::int64_t,N> w0, w1, w2;
+    for(auto y = bounds.y0; y < bounds.y1; ++y, row_w0 += e0.b*kSubpixelOne, row_w1 += e1.b*kSubpixelOne, row_w2 += e2.b*kSubpixelOne) {
+        auto q0 = row_w0;
+        auto q1 = row_w1;
+        auto q2 = row_w2;
+        for(auto x = bounds.x0; x < bounds.x1; x += static_cast<std::int32_t>(N), q0 += e0.a*kstep, q1 += e1.a*kstep, q2 += e2.a*kstep) {
+            const auto count = static_cast<std::size_t>(std::min<std::int32_t>(static_cast<std::int32_t>(N), bounds.x1 - x));
+            std::uint32_t mask = 0;
+            for(std::size_t i = 0; i < N; ++i) {
+                w0[i] = q0 + d0[i];
+                w1[i] = q1 + d1[i];
+                w2[i] = q2 + d2[i];
+                mask |= static_cast<std::uint32_t>(((w0[i] + e0.bias) | (w1[i] + e1.bias) | (w2[i] + e2.bias)) >= 0) << i;
+            }
+            if(count<N) mask &= (1u << count) - 1u;
+            if(mask) span(x, y, count, mask, w0, w1, w2);
+        }
+    }
+}
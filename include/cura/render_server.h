@@ -0,0 +1,709 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <istream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <numbers>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <cura/assets.h>
+#include <cura/banded_render.h>
+#include <cura/buffer.h>
+#include <cura/camera.h>
+#include <cura/json.h>
+#include <cura/light.h>
+#include <cura/math.h>
+#include <cura/scene.h>
+#include <cura/shadow.h>
+#include <cura/socket.h>
+#include <cura/tile_codec.h>
+#include <cura/thread_pool.h>
+#include <cura/transforms.h>
+
+//A long-running render server. Requests are JSON objects, one per line; every request gets one JSON line back.
+//A job looks like
+//  {"id": "a", "output": "a.ppm", "width": 800, "height": 800, "samples": 4,
+//   "camera": {"eye": [1,1,3], "center": [0,0,0], "up": [0,1,0], "fov": 90, "near": 0.1, "far": 5},
+//   "objects": [{"model": "head.obj", "texture": "head_diffuse.ppm", "translate": [0,0,0], "scale": 1}],
+//   "light": {"direction": [-0.3,-1,-0.4], "ambient": [0.3,0.3,0.3]}, "shadow_map_size": 1024}
+//where "samples", the camera's "fov", "near" and "far", an object's "translate", "scale" and "matrix" (16 numbers, column-major),
+//and "light" are optional. Other requests are {"command": "stats"}, {"command": "release"} and {"command": "shutdown"}.
+//A job with "region": [x0, y0, x1, y1] renders only those pixels of the frame and returns them in the reply, as "pixels" encoded with
+//EncodePixelRuns and EncodeBase64, instead of writing "output" (see distributed_render.h).
+
+struct RenderJob {
+    struct Object {
+        std::string model;
+        std::string texture;
+        Mat44f transform{la::identity};
+    };
+
+    std::string id;
+    std::string output; //Binary PPM. Not written by region jobs.
+    std::int32_t width{0};
+    std::int32_t height{0};
+    std::int32_t samples{1};
+    Vec3f eye{0.f,0.f,1.f};
+    Vec3f center{0.f,0.f,0.f};
+    Vec3f up{0.f,1.f,0.f};
+    float fov_degrees{90.f};
+    float near{0.1f};
+    float far{100.f};
+    std::vector<Object> objects;
+    std::optional<DistantLight> light; //Shadows are applied if there is a light
+    std::int32_t shadow_map_size{1024};
+    std::optional<Tile> region; //Pixels to render and return. Starts on a tile boundary (kDefaultTileSize).
+};
+
+namespace render_job_detail {
+
+inline bool ReadNumber(const JsonValue& json, std::string_view key, float& out, std::string& error) {
+    const auto* member = json.Find(key);
+    if(!member) return true;
+    if(const auto* d = member->Number()) {
+        out = static_cast<float>(*d);
+        return true;
+    }
+    error = "'" + std::string(key) + "' must be a number";
+    return false;
+}
+
+inline bool ReadInt(const JsonValue& json, std::string_view key, std::int32_t& out, std::int32_t min, std::int32_t max, std::string& error) {
+    const auto* member = json.Find(key);
+    if(!member) return true;
+    const auto* d = member->Number();
+    if(!d || *d!=std::floor(*d) || *d<min || *d>max) {
+        error = "'" + std::string(key) + "' must be an integer in [" + std::to_string(min) + "," + std::to_string(max) + "]";
+        return false;
+    }
+    out = static_cast<std::int32_t>(*d);
+    return true;
+}
+
+inline bool ReadString(const JsonValue& json, std::string_view key, std::string& out, std::string& error) {
+    const auto* member = json.Find(key);
+    if(member && member->String()) {
+        out = *member->String();
+        return true;
+    }
+    error = "'" + std::string(key) + "' must be a string";
+    return false;
+}
+
+inline bool ReadVec3(const JsonValue& json, std::string_view key, Vec3f& out, std::string& error) {
+    const auto* member = json.Find(key);
+    if(!member) return true;
+    const auto* elements = member->Elements();
+    if(elements && elements->size()==3 && std::ranges::all_of(*elements, [](const JsonValue& e) { return e.Number()!=nullptr; })) {
+        out = Vec3f{static_cast<float>(*(*elements)[0].Number()), static_cast<float>(*(*elements)[1].Number()), static_cast<float>(*(*elements)[2].Number())};
+        return true;
+    }
+    error = "'" + std::string(key) + "' must be an array of 3 numbers";
+    return false;
+}
+
+inline bool ReadObject(const JsonValue& json, RenderJob::Object& object, std::string& error) {
+    if(!json.Members()) {
+        error = "objects must be JSON objects";
+        return false;
+    }
+    if(!ReadString(json, "model", object.model, error) || !ReadString(json, "texture", object.texture, error)) return false;
+
+    if(const auto* matrix = json.Find("matrix")) {
+        const auto* elements = matrix->Elements();
+        if(!elements || elements->size()!=16 || !std::ranges::all_of(*elements, [](const JsonValue& e) { return e.Number()!=nullptr; })) {
+            error = "'matrix' must be an array of 16 numbers";
+            return false;
+        }
+        for(int i = 0; i < 16; ++i) object.transform[i/4][i%4] = static_cast<float>(*(*elements)[i].Number());
+        return true;
+    }
+
+    Vec3f translate{0.f,0.f,0.f};
+    Vec3f scale{1.f,1.f,1.f};
+    if(!ReadVec3(json, "translate", translate, error)) return false;
+    if(const auto* s = json.Find("scale"); s && s->Number()) scale = Vec3f{1.f,1.f,1.f}*static_cast<float>(*s->Number());
+    else if(!ReadVec3(json, "scale", scale, error)) return false;
+    object.transform = la::mul(la::translation_matrix(translate), la::scaling_matrix(scale));
+    return true;
+}
+
+} //namespace render_job_detail
+
+/// @brief Reads a job from a parsed request (see the format above).
+/// @param error Receives a description of the first problem found.
+[[nodiscard]] inline std::optional<RenderJob> ParseRenderJob(const JsonValue& json, std::string& error) {
+    using namespace render_job_detail;
+    constexpr std::int32_t kmax_size{1 << 15};
+    RenderJob job;
+    if(!json.Members()) {
+        error = "a job must be a JSON object";
+        return std::nullopt;
+    }
+    if(const auto* id = json.Find("id"); id && id->String()) job.id = *id->String();
+    if((json.Find("output") || !json.Find("region")) && !ReadString(json, "output", job.output, error)) return std::nullopt;
+    if(!json.Find("width") || !json.Find("height")) {
+        error = "'width' and 'height' are required";
+        return std::nullopt;
+    }
+    if(!ReadInt(json, "width", job.width, 1, kmax_size, error) || !ReadInt(json, "height", job.height, 1, kmax_size, error)) return std::nullopt;
+    if(job.width%2!=0 || job.height%2!=0) {
+        error = "'width' and 'height' must be even";
+        return std::nullopt;
+    }
+    if(!ReadInt(json, "samples", job.samples, 1, 8, error)) return std::nullopt;
+    if(job.samples!=1 && job.samples!=4 && job.samples!=8) {
+        error = "'samples' must be 1, 4 or 8";
+        return std::nullopt;
+    }
+
+    const auto* camera = json.Find("camera");
+    if(!camera || !camera->Members()) {
+        error = "'camera' must be an object";
+        return std::nullopt;
+    }
+    if(!ReadVec3(*camera, "eye", job.eye, error) || !ReadVec3(*camera, "center", job.center, error) || !ReadVec3(*camera, "up", job.up, error)
+       || !ReadNumber(*camera, "fov", job.fov_degrees, error) || !ReadNumber(*camera, "near", job.near, error) || !ReadNumber(*camera, "far", job.far, error)) {
+        return std::nullopt;
+    }
+    job.near = std::abs(job.near);
+    job.far = std::abs(job.far);
+    if(!(job.near > 0.f && job.far > job.near && job.fov_degrees > 0.f && job.fov_degrees < 180.f)) {
+        error = "the camera needs 0 < near < far and 0 < fov < 180";
+        return std::nullopt;
+    }
+
+    const auto* objects = json.Find("objects");
+    if(!objects || !objects->Elements()) {
+        error = "'objects' must be an array";
+        return std::nullopt;
+    }
+    for(const auto& o : *objects->Elements()) {
+        if(!ReadObject(o, job.objects.emplace_back(), error)) return std::nullopt;
+    }
+
+    if(const auto* light = json.Find("light")) {
+        DistantLight sun{la::normalize(Vec3f{0.f,-1.f,0.f}), {0.3f,0.3f,0.3f}, {1.f,1.f,1.f}, {1.f,1.f,1.f}};
+        Vec3f direction = sun.Direction;
+        if(!light->Members() || !ReadVec3(*light, "direction", direction, error) || !ReadVec3(*light, "ambient", sun.Ambient, error)) {
+            if(error.empty()) error = "'light' must be an object";
+            return std::nullopt;
+        }
+        if(la::length(direction)==0.f) {
+            error = "the light direction must not be zero";
+            return std::nullopt;
+        }
+        sun.Direction = la::normalize(direction);
+        job.light = sun;
+        if(!ReadInt(json, "shadow_map_size", job.shadow_map_size, 16, 8192, error)) return std::nullopt;
+    }
+
+    if(const auto* region = json.Find("region")) {
+        const auto* elements = region->Elements();
+        std::array<std::int32_t,4> corners{};
+        const auto valid = elements && elements->size()==4 && std::ranges::all_of(*elements, [](const JsonValue& e) {
+            return e.Number() && *e.Number()==std::floor(*e.Number()) && *e.Number()>=0 && *e.Number()<=kmax_size;
+        });
+        if(valid) {
+            for(std::size_t i = 0; i < 4; ++i) corners[i] = static_cast<std::int32_t>(*(*elements)[i].Number());
+        }
+        const Tile tile{corners[0], corners[1], corners[2], corners[3]};
+        if(!valid || tile.Empty() || tile.x1>job.width || tile.y1>job.height || tile.x0%kDefaultTileSize!=0 || tile.y0%kDefaultTileSize!=0) {
+            error = "'region' must be [x0,y0,x1,y1] inside the image, starting on a multiple of " + std::to_string(kDefaultTileSize);
+            return std::nullopt;
+        }
+        //Shadows are applied to whole frames
+        if(job.light && tile!=Tile{0, 0, job.width, job.height}) {
+            error = "a job with a light must render the whole frame";
+            return std::nullopt;
+        }
+        job.region = tile;
+    }
+    return job;
+}
+
+
+/// @brief Latencies of the most recent kWindow samples of one kind, in milliseconds.
+class LatencyRecorder {
+public:
+    static constexpr std::size_t kWindow{1024};
+
+    struct Summary {
+        std::size_t count{0}; //All samples ever added
+        double mean_ms{0.};   //The rest are over the window
+        double p50_ms{0.};
+        double p95_ms{0.};
+        double max_ms{0.};
+    };
+
+    void Add(double ms) {
+        if(samples_.size() < kWindow) samples_.push_back(ms);
+        else samples_[count_%kWindow] = ms;
+        ++count_;
+    }
+
+    [[nodiscard]] Summary Summarize() const {
+        Summary s;
+        s.count = count_;
+        if(samples_.empty()) return s;
+        auto sorted = samples_;
+        std::ranges::sort(sorted);
+        const auto rank = [&](double p) { return sorted[static_cast<std::size_t>(p*static_cast<double>(sorted.size() - 1) + 0.5)]; };
+        for(const auto ms : sorted) s.mean_ms += ms;
+        s.mean_ms /= static_cast<double>(sorted.size());
+        s.p50_ms = rank(0.5);
+        s.p95_ms = rank(0.95);
+        s.max_ms = sorted.back();
+        return s;
+    }
+
+private:
+    std::vector<double> samples_;
+    std::size_t count_{0};
+};
+
+//Where the time of one job went.
+struct JobTimings {
+    double queue_ms{0.};  //Waiting for a free job slot
+    double load_ms{0.};   //Waiting for assets. Close to zero once they are resident.
+    double render_ms{0.};
+    double write_ms{0.};
+    double total_ms{0.};  //From receipt of the request to the reply
+};
+
+struct RenderServerOptions {
+    std::size_t concurrent_jobs{2};  //Jobs rendered at once. Each renders in parallel on the shared pool.
+    std::size_t queue_capacity{16};  //Jobs waiting beyond these block the caller of Submit()
+    std::optional<std::filesystem::path> cache_directory; //On-disk asset cache (see AssetManager)
+    //When set, a job's "output" must be a relative path without "..", and is written under this directory. Set it whenever requests
+    //come from other processes, which could otherwise overwrite any file the server can write.
+    std::optional<std::filesystem::path> output_directory;
+};
+
+/// @brief Renders jobs from a bounded queue, keeping every model and texture it has loaded resident, so that after the first job that
+/// @brief uses an asset the cost of a job is just rendering and writing the image.
+/// @brief Jobs run concurrently on 'concurrent_jobs' threads, and each job's tiles, shadow map and asset loads run on the shared pool.
+/// @brief Replies are delivered through a callback, on the thread that rendered the job.
+class RenderServer {
+public:
+    using ReplyFn = std::function<void(const std::string& line)>;
+    using Clock = std::chrono::steady_clock;
+
+    RenderServer(ThreadPool& pool, RenderServerOptions options = {})
+        : pool_{pool}, assets_{pool, options.cache_directory}, output_directory_{std::move(options.output_directory)},
+          capacity_{std::max<std::size_t>(options.queue_capacity, 1)}
+    {
+        for(std::size_t i = 0; i < std::max<std::size_t>(options.concurrent_jobs, 1); ++i) {
+            runners_.emplace_back([this]{ RunJobs(); });
+        }
+    }
+
+    RenderServer(const RenderServer&) = delete;
+    RenderServer& operator=(const RenderServer&) = delete;
+
+    //Finishes the queued jobs before returning
+    ~RenderServer() {
+        {
+            std::scoped_lock lock(mutex_);
+            stopping_ = true;
+        }
+        not_empty_.notify_all();
+        for(auto& runner : runners_) runner.join();
+    }
+
+    /// @brief Handles one request line: queues a job, or answers a command straight away. Blocks while the queue is full.
+    /// @return False if the request was a shutdown command.
+    bool Handle(std::string_view line, ReplyFn reply) {
+        const auto received = Clock::now();
+        std::string error;
+        const auto json = ParseJson(line, &error);
+        if(!json) {
+            reply(ErrorReply("", "invalid JSON: " + error));
+            return true;
+        }
+        if(const auto* command = json->Find("command")) {
+            const auto* name = command->String();
+            if(name && *name=="shutdown") {
+                reply("{\"ok\":true}");
+                return false;
+            }
+            if(name && *name=="stats") reply(StatsReply());
+            else if(name && *name=="release") reply("{\"ok\":true,\"released\":" + std::to_string(assets_.ReleaseUnused()) + "}");
+            else reply(ErrorReply("", "unknown command"));
+            return true;
+        }
+
+        auto job = ParseRenderJob(*json, error);
+        if(!job) {
+            const auto* id = json->Find("id");
+            reply(ErrorReply(id && id->String() ? *id->String() : "", error));
+            return true;
+        }
+        if(output_directory_ && !job->region) {
+            const std::filesystem::path output{job->output};
+            const auto escapes = std::ranges::any_of(output, [](const auto& part) { return part==".."; });
+            if(output.empty() || output.has_root_path() || escapes) {
+                reply(ErrorReply(job->id, "'output' must be a relative path inside the output directory"));
+                return true;
+            }
+            job->output = (*output_directory_/output).string();
+        }
+        Submit(std::move(*job), std::move(reply), received);
+        return true;
+    }
+
+    //Queues a job. Blocks while the queue is full.
+    void Submit(RenderJob job, ReplyFn reply, Clock::time_point received = Clock::now()) {
+        std::unique_lock lock(mutex_);
+        not_full_.wait(lock, [this]{ return queue_.size() < capacity_; });
+        queue_.push_back(Pending{std::move(job), std::move(reply), received});
+        lock.unlock();
+        not_empty_.notify_one();
+    }
+
+    //Waits until every queued job has been rendered and replied to.
+    void Drain() {
+        std::unique_lock lock(mutex_);
+        idle_.wait(lock, [this]{ return queue_.empty() && running_==0; });
+    }
+
+    /// @brief Renders a job and writes its image, or for a region job encodes its pixels into 'pixels'.
+    /// @brief Assets are loaded once and kept (see AssetManager).
+    /// @return An error message on failure.
+    [[nodiscard]] std::optional<std::string> Render(const RenderJob& job, JobTimings& timings, std::string* pixels = nullptr) {
+        auto start = Clock::now();
+        const auto lap = [&] {
+            const auto now = Clock::now();
+            const auto ms = std::chrono::duration<double, std::milli>(now - start).count();
+            start = now;
+            return ms;
+        };
+
+        //Start every load before waiting on any, so that the misses of a job load in parallel
+        std::vector<std::pair<AssetHandle<Model>, AssetHandle<FrameBuffer>>> handles;
+        for(const auto& object : job.objects) handles.emplace_back(assets_.LoadModel(object.model), assets_.LoadTexture(object.texture));
+        //Failed loads stay in the manager, so a job naming a bad file fails quickly from then on
+        const auto get = [](const auto& handle) -> decltype(handle.Get()) {
+            try {
+                return handle.Get();
+            }
+            catch(const std::exception&) {
+                return nullptr;
+            }
+        };
+        Scene scene;
+        for(std::size_t i = 0; i < handles.size(); ++i) {
+            auto model = get(handles[i].first);
+            auto texture = get(handles[i].second);
+            if(!model || model->Faces().empty()) return "could not load model '" + job.objects[i].model + "'";
+            if(!texture || texture->height==0 || texture->width==0) return "could not load texture '" + job.objects[i].texture + "'";
+            scene.Add(std::move(model), std::move(texture), job.objects[i].transform);
+        }
+        scene.Build();
+        timings.load_ms = lap();
+
+        const Camera camera(job.eye, job.center, job.up);
+        const auto aspect = static_cast<float>(job.width)/static_cast<float>(job.height);
+        const auto projection = PerspectiveProjection(job.fov_degrees*std::numbers::pi_v<float>/180.f, aspect, -job.near, -job.far);
+        const auto encode = [&](const std::string& rgb) {
+            if(pixels) *pixels = EncodeBase64(EncodePixelRuns(std::span(reinterpret_cast<const std::uint8_t*>(rgb.data()), rgb.size())));
+        };
+
+        //Part of a frame: only the region's tiles are rasterized, into a buffer the size of the region
+        const Tile full{0, 0, job.width, job.height};
+        if(job.region && *job.region!=full) {
+            CullStats stats;
+            const auto batches = BuildSceneBatches(scene, camera, projection, job.near, job.far, job.height, job.width, pool_, stats);
+            const auto tiles = SplitIntoTiles(job.height, job.width, kDefaultTileSize);
+            const auto bins = BinTriangles(batches, job.height, job.width, kDefaultTileSize);
+            TileBuffer region;
+            region.Reset(*job.region, job.samples);
+            region.Clear();
+            DrawRegion(batches, tiles, bins, job.width, kDefaultTileSize, region, pool_);
+            timings.render_ms = lap();
+
+            std::ostringstream rgb;
+            std::vector<char> row;
+            WritePPMRows(rgb, region, row);
+            encode(rgb.str());
+            timings.write_ms = lap();
+            return std::nullopt;
+        }
+
+        FrameBuffer image{job.height, job.width, job.samples};
+        DrawScene(scene, camera, projection, job.near, job.far, image, pool_);
+        if(job.samples > 1) image = image.Resolve();
+        if(job.light) {
+            const auto map = RenderShadowMap(scene, *job.light, job.shadow_map_size, pool_);
+            ApplyShadows(image, camera.view, projection, map, *job.light, 1, pool_);
+        }
+        timings.render_ms = lap();
+
+        if(job.region) {
+            std::ostringstream rgb;
+            WriteRGBRows(rgb, image);
+            encode(rgb.str());
+        }
+        else {
+            std::ofstream out(job.output, std::ios::binary);
+            if(!out) return "could not create '" + job.output + "'";
+            WritePPM(out, image);
+            if(!out) return "could not write '" + job.output + "'";
+        }
+        timings.write_ms = lap();
+        return std::nullopt;
+    }
+
+    //Binary (P6) PPM of a single-sampled image
+    static void WritePPM(std::ostream& out, const FrameBuffer& image) {
+        WritePPMHeader(out, image.height, image.width);
+        WriteRGBRows(out, image);
+    }
+
+    //The pixels of a single-sampled image as 8-bit RGB, row by row: the body of a binary PPM
+    static void WriteRGBRows(std::ostream& out, const FrameBuffer& image) {
+        assert(image.samples==1 && "Error: resolve a multisampled image before writing it!");
+        const auto to_byte = [](float c) { return static_cast<char>(static_cast<unsigned char>(255.999f*std::clamp(c, 0.f, 1.f))); };
+        std::vector<char> row(3*static_cast<std::size_t>(image.width));
+        for(std::int32_t y = 0; y < image.height; ++y) {
+            for(std::int32_t x = 0; x < image.width; ++x) {
+                const auto& color = image.Cleared(x,y) ? image.ClearColor() : image.Color(x,y);
+                row[3*x] = to_byte(color.x);
+                row[3*x+1] = to_byte(color.y);
+                row[3*x+2] = to_byte(color.z);
+            }
+            out.write(row.data(), static_cast<std::streamsize>(row.size()));
+        }
+    }
+
+    [[nodiscard]] std::string StatsReply() const {
+        std::scoped_lock lock(mutex_);
+        std::string out = "{\"ok\":true,\"jobs\":" + std::to_string(completed_) + ",\"failed\":" + std::to_string(failed_)
+                        + ",\"queued\":" + std::to_string(queue_.size()) + ",\"running\":" + std::to_string(running_)
+                        + ",\"assets\":" + std::to_string(assets_.Size());
+        const auto add = [&](std::string_view name, const LatencyRecorder& recorder) {
+            const auto s = recorder.Summarize();
+            out += ",\"" + std::string(name) + "\":{\"count\":" + std::to_string(s.count) + ",\"mean_ms\":" + std::to_string(s.mean_ms)
+                 + ",\"p50_ms\":" + std::to_string(s.p50_ms) + ",\"p95_ms\":" + std::to_string(s.p95_ms) + ",\"max_ms\":" + std::to_string(s.max_ms) + "}";
+        };
+        add("total", total_);
+        add("queue", queue_wait_);
+        add("load", load_);
+        add("render", render_);
+        add("write", write_);
+        out += "}";
+        return out;
+    }
+
+private:
+    struct Pending {
+        RenderJob job;
+        ReplyFn reply;
+        Clock::time_point received;
+    };
+
+    [[nodiscard]] static std::string ErrorReply(std::string_view id, std::string_view error) {
+        std::string out = "{\"id\":";
+        AppendJsonString(out, id);
+        out += ",\"ok\":false,\"error\":";
+        AppendJsonString(out, error);
+        out += "}";
+        return out;
+    }
+
+    void RunJobs() {
+        for(;;) {
+            std::unique_lock lock(mutex_);
+            not_empty_.wait(lock, [this]{ return stopping_ || !queue_.empty(); });
+            if(queue_.empty()) return; //Stopping, and nothing left to do
+            auto pending = std::move(queue_.front());
+            queue_.pop_front();
+            ++running_;
+            lock.unlock();
+            not_full_.notify_one();
+
+            JobTimings timings;
+            timings.queue_ms = std::chrono::duration<double, std::milli>(Clock::now() - pending.received).count();
+            std::optional<std::string> error;
+            std::string pixels;
+            try {
+                error = Render(pending.job, timings, &pixels);
+            }
+            catch(const std::exception& e) {
+                error = std::string("render failed: ") + e.what();
+            }
+            timings.total_ms = std::chrono::duration<double, std::milli>(Clock::now() - pending.received).count();
+
+            std::string reply;
+            if(error) reply = ErrorReply(pending.job.id, *error);
+            else {
+                reply = "{\"id\":";
+                AppendJsonString(reply, pending.job.id);
+                reply += ",\"ok\":true,\"output\":";
+                AppendJsonString(reply, pending.job.output);
+                reply += ",\"queue_ms\":" + std::to_string(timings.queue_ms) + ",\"load_ms\":" + std::to_string(timings.load_ms)
+                       + ",\"render_ms\":" + std::to_string(timings.render_ms) + ",\"write_ms\":" + std::to_string(timings.write_ms)
+                       + ",\"total_ms\":" + std::to_string(timings.total_ms);
+                if(const auto& r = pending.job.region) {
+                    reply += ",\"region\":[" + std::to_string(r->x0) + "," + std::to_string(r->y0) + "," + std::to_string(r->x1) + "," + std::to_string(r->y1)
+                           + "],\"pixels\":\"" + pixels + "\"";
+                }
+                reply += "}";
+            }
+            pending.reply(reply);
+
+            lock.lock();
+            if(error) ++failed_;
+            else {
+                ++completed_;
+                total_.Add(timings.total_ms);
+                queue_wait_.Add(timings.queue_ms);
+                load_.Add(timings.load_ms);
+                render_.Add(timings.render_ms);
+                write_.Add(timings.write_ms);
+            }
+            --running_;
+            if(queue_.empty() && running_==0) idle_.notify_all();
+        }
+    }
+
+private:
+    ThreadPool& pool_;
+    AssetManager assets_;
+    std::optional<std::filesystem::path> output_directory_;
+    std::size_t capacity_;
+    std::vector<std::thread> runners_;
+
+    mutable std::mutex mutex_; //Guards everything below
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::condition_variable idle_;
+    std::deque<Pending> queue_;
+    std::size_t running_{0};
+    bool stopping_{false};
+    std::size_t completed_{0};
+    std::size_t failed_{0};
+    LatencyRecorder total_;
+    LatencyRecorder queue_wait_;
+    LatencyRecorder load_;
+    LatencyRecorder render_;
+    LatencyRecorder write_;
+};
+
+
+/// @brief Serves requests read line by line from 'in' (e.g. a pipe on stdin), writing one reply line per request to 'out'.
+/// @brief Replies to jobs come in the order jobs finish, which with several concurrent jobs need not be the order they were sent in.
+/// @brief Returns at the end of the input or after a shutdown command, once every queued job has been replied to.
+inline void ServeStream(RenderServer& server, std::istream& in, std::ostream& out) {
+    std::mutex out_mutex;
+    const auto reply = [&](const std::string& line) {
+        std::scoped_lock lock(out_mutex);
+        out<<line<<'\n'<<std::flush;
+    };
+    std::string line;
+    while(std::getline(in, line)) {
+        if(line.find_first_not_of(" \t\r")==std::string::npos) continue;
+        if(!server.Handle(line, reply)) break;
+    }
+    server.Drain();
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/// @brief Serves requests on a socket at 'address' (a Unix socket path or host:port, see ListenOn), one connection per client, with
+/// @brief the same line protocol as ServeStream. Returns after a shutdown command from any client, once every queued job has been replied to.
+/// @return False if the socket could not be set up.
+inline bool ServeSocket(RenderServer& server, std::string_view address) {
+    const int listener = ListenOn(address);
+    if(listener < 0) return false;
+
+    //A connection is closed once its reader has stopped and the last reply to it has been sent (replies hold a reference)
+    struct Connection {
+        explicit Connection(int f) : fd{f} {}
+        ~Connection() { ::close(fd); }
+        void Send(const std::string& line) {
+            std::scoped_lock lock(mutex);
+            SendAll(fd, line + '\n');
+        }
+        int fd;
+        std::mutex mutex;
+    };
+
+    std::atomic<bool> stopping{false};
+    std::mutex connections_mutex;
+    std::vector<std::weak_ptr<Connection>> connections;
+    //One thread per connection. Finished ones are joined on the next accept, so threads do not pile up over the server's lifetime.
+    struct Reader {
+        std::thread thread;
+        std::atomic<bool> done{false};
+    };
+    std::list<Reader> readers;
+
+    const auto serve = [&](std::shared_ptr<Connection> connection) {
+        LineReader reader(connection->fd);
+        std::string line;
+        while(reader.ReadLine(line)) {
+            if(line.find_first_not_of(" \t\r")==std::string::npos) continue;
+            if(!server.Handle(line, [connection](const std::string& reply) { connection->Send(reply); })) {
+                //Wake the accept loop and every other reader
+                stopping = true;
+                ::shutdown(listener, SHUT_RDWR);
+                std::scoped_lock lock(connections_mutex);
+                for(const auto& weak : connections) {
+                    if(const auto c = weak.lock()) ::shutdown(c->fd, SHUT_RD);
+                }
+                return;
+            }
+        }
+    };
+
+    while(!stopping) {
+        const int fd = ::accept(listener, nullptr, nullptr);
+        if(fd < 0) {
+            if(stopping) break;
+            continue;
+        }
+        auto connection = std::make_shared<Connection>(fd);
+        {
+            std::scoped_lock lock(connections_mutex);
+            std::erase_if(connections, [](const auto& weak) { return weak.expired(); });
+            connections.push_back(connection);
+            if(stopping) ::shutdown(fd, SHUT_RD);
+        }
+        std::erase_if(readers, [](Reader& reader) {
+            if(!reader.done) return false;
+            reader.thread.join();
+            return true;
+        });
+        auto& reader = readers.emplace_back();
+        reader.thread = std::thread([&serve, &reader, connection = std::move(connection)]() mutable {
+            serve(std::move(connection));
+            reader.done = true;
+        });
+    }
+    for(auto& reader : readers) reader.thread.join();
+    server.Drain();
+    ::close(listener);
+    if(address.find('/')!=std::string_view::npos) ::unlink(std::string(address).c_str());
+    return true;
+}
+#endif
@@ -0,0 +1,516 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <span>
+#include <vector>
+
+#include <cura/buffer.h>
+#include <cura/depth_buffer.h>
+#include <cura/math.h>
+#include <cura/model.h>
+#include <cura/rasterizer.h>
+#include <cura/shader.h>
+#include <cura/thread_pool.h>
+#include <cura/vertex.h>
+#include <cura/vertex_quantization.h>
+
+//Tiles are square. 64x64 pixels of color+depth is 64KB, which keeps a tile's working set in L2.
+inline constexpr std::int32_t kDefaultTileSize{64};
+
+//How a draw tests and writes depth. A Z-prepass draws everything with kDepthOnly, then again with kEqual:
+//only the closest fragment of each pixel passes the second time, so every pixel is shaded once however much overdraw there is.
+//Both passes must draw the same triangles, so that the depths they compute are bit-identical.
+enum class DepthPass {
+    kNormal,    //Closer (or equal) fragments pass, and write depth and color
+    kDepthOnly, //Closer (or equal) fragments pass, and write depth only. Nothing is shaded.
+    kEqual,     //Fragments at exactly the stored depth pass, and write color only
+};
+
+/// @brief Rasterizes a triangle into a multisampled image, with coverage and depth per sample but shading per pixel.
+/// @brief The edge functions and depth are evaluated at all N sample positions of a pixel at once (fixed-size loops that the compiler vectorizes).
+/// @brief The texture is then looked up once, at the centroid of the covered samples, and the color is written to every sample that passed the depth test.
+/// @brief Coverage uses the same fixed-point edge functions and top-left rule as DrawTriangle.
+/// @param image A FrameBuffer, or a TileBuffer covering 'tile'.
+/// @param offsets Sample positions relative to the pixel center (kSamplePositions4 or kSamplePositions8).
+/// @param shaded If not null, incremented for every pixel that is shaded.
+template<std::size_t N, typename Target>
+inline void DrawTriangleMultisample(const ClippedVertex& cv0,const ClippedVertex& cv1,const ClippedVertex& cv2, Target& image, TextureRef texture, const Tile& tile, const Color3f& tint, const std::array<Vec2f,N>& offsets,
+                                    DepthPass pass = DepthPass::kNormal, std::uint64_t* shaded = nullptr) {
+    assert(image.samples==static_cast<std::int32_t>(N));
+    if(cv0.clip_z>=0.f || cv1.clip_z>=0.f || cv2.clip_z>=0.f) return;
+
+    const auto setup = SetupTriangle(cv0.pixel_coords.xy(), cv1.pixel_coords.xy(), cv2.pixel_coords.xy());
+    if(!setup) return;
+    const auto& tri = *setup;
+    const auto& [e0, e1, e2] = tri.edges;
+
+    //Samples lie within half a pixel of the center, so grow the bounding box by half a pixel
+    const auto bounds = PixelBounds(tri, tile, kSubpixelOne/2);
+    if(bounds.Empty()) return;
+    const auto minX = bounds.x0;
+    const auto minY = bounds.y0;
+    const auto maxX = bounds.x1-1;
+    const auto maxY = bounds.y1-1;
+
+    //Change of each edge function from the pixel center to each sample. The standard patterns lie on a 1/16 pixel grid, so these are exact.
+    //The largest change over the samples gives a quick test that rejects pixels none of whose samples are covered.
+    std::array<std::int64_t,N> d0, d1, d2;
+    std::int64_t max_d0 = std::numeric_limits<std::int64_t>::lowest();
+    std::int64_t max_d1 = max_d0;
+    std::int64_t max_d2 = max_d0;
+    for(std::size_t s = 0; s < N; ++s) {
+        const auto ox = static_cast<std::int64_t>(std::lround(offsets[s].x*static_cast<float>(kSubpixelOne)));
+        const auto oy = static_cast<std::int64_t>(std::lround(offsets[s].y*static_cast<float>(kSubpixelOne)));
+        d0[s] = e0.a*ox + e0.b*oy;
+        d1[s] = e1.a*ox + e1.b*oy;
+        d2[s] = e2.a*ox + e2.b*oy;
+        max_d0 = std::max(max_d0, d0[s] + e0.bias);
+        max_d1 = std::max(max_d1, d1[s] + e1.bias);
+        max_d2 = std::max(max_d2, d2[s] + e2.bias);
+    }
+
+    const auto inv_z0 = 1.f/cv0.clip_z;
+    const auto inv_z1 = 1.f/cv1.clip_z;
+    const auto inv_z2 = 1.f/cv2.clip_z;
+    const auto inv_area = 1.f/static_cast<float>(tri.area);
+
+    auto row_w0 = e0.Evaluate(PixelCenter(minX), PixelCenter(minY));
+    auto row_w1 = e1.Evaluate(PixelCenter(minX), PixelCenter(minY));
+    auto row_w2 = e2.Evaluate(PixelCenter(minX), PixelCenter(minY));
+
+    for(auto y = minY; y <= maxY; ++y, row_w0 += e0.b*kSubpixelOne, row_w1 += e1.b*kSubpixelOne, row_w2 += e2.b*kSubpixelOne) {
+        auto w0 = row_w0 - e0.a*kSubpixelOne;
+        auto w1 = row_w1 - e1.a*kSubpixelOne;
+        auto w2 = row_w2 - e2.a*kSubpixelOne;
+        for(auto x = minX; x <= maxX; ++x) {
+            //Edge functions at the pixel center
+            w0 += e0.a*kSubpixelOne;
+            w1 += e1.a*kSubpixelOne;
+            w2 += e2.a*kSubpixelOne;
+            if(((w0 + max_d0) | (w1 + max_d1) | (w2 + max_d2)) < 0) continue;
+
+            //Coverage, barycentrics and depth for all samples
+            std::array<float,N> b0, b1, b2, depth;
+            std::array<bool,N> covered;
+            std::array<bool,N> passed;
+            for(std::size_t s = 0; s < N; ++s) {
+                covered[s] = ((w0 + d0[s] + e0.bias) | (w1 + d1[s] + e1.bias) | (w2 + d2[s] + e2.bias)) >= 0;
+                b0[s] = static_cast<float>(w0 + d0[s])*inv_area;
+                b1[s] = static_cast<float>(w1 + d1[s])*inv_area;
+                b2[s] = static_cast<float>(w2 + d2[s])*inv_area;
+                depth[s] = 1.f/(b0[s]*inv_z0 + b1[s]*inv_z1 + b2[s]*inv_z2);
+            }
+            bool any = false;
+            for(std::size_t s = 0; s < N; ++s) {
+                const auto stored = image.Depth(x,y,static_cast<std::int32_t>(s));
+                passed[s] = covered[s] && (pass==DepthPass::kEqual ? depth[s]==stored : depth[s]>=stored);
+                any |= passed[s];
+            }
+            if(!any) continue;
+            if(pass==DepthPass::kDepthOnly) {
+                for(std::size_t s = 0; s < N; ++s) {
+                    if(passed[s]) image.Depth(x,y,static_cast<std::int32_t>(s)) = depth[s];
+                }
+                continue;
+            }
+
+            //Shade once, at the centroid of the covered samples. Unlike the pixel center, this always lies inside the triangle.
+            //Barycentrics are affine in the position, so the centroid's are the mean of the samples'.
+            float c0 = 0.f, c1 = 0.f, c2 = 0.f, count = 0.f;
+            for(std::size_t s = 0; s < N; ++s) {
+                if(!covered[s]) continue;
+                c0 += b0[s]; c1 += b1[s]; c2 += b2[s];
+                count += 1.f;
+            }
+            c0 /= count; c1 /= count; c2 /= count;
+            const auto inv_z = c0*inv_z0 + c1*inv_z1 + c2*inv_z2;
+            const auto tex = (c0*cv0.tex_coords*inv_z0 + c1*cv1.tex_coords*inv_z1 + c2*cv2.tex_coords*inv_z2)/inv_z;
+            const auto color = tint*TextureLookup(texture, ClampTexCoord(tex.x), ClampTexCoord(tex.y));
+            if(shaded) ++*shaded;
+
+            for(std::size_t s = 0; s < N; ++s) {
+                if(!passed[s]) continue;
+                image.Depth(x,y,static_cast<std::int32_t>(s)) = depth[s];
+                image.Color(x,y,static_cast<std::int32_t>(s)) = color;
+            }
+        }
+    }
+}
+
+//Uses the barycentric coordinates computed by the edge function to interpolate attributes over vertices.
+//Coverage is tested at pixel centers with fixed-point edge functions and the top-left rule (see SetupTriangle).
+//In this case the attributes are depth and texture coordinates, both interpolated perspective-correctly.
+//Only pixels inside the tile are written, so several threads can draw the same triangle into disjoint tiles of one image.
+//The texture color is modulated by 'tint' (a per-draw uniform).
+//Multisampled images are drawn by DrawTriangleMultisample.
+//'image' is a FrameBuffer, or a TileBuffer covering 'tile'.
+//'pass' selects the depth test (see DepthPass). If 'shaded' is not null, it is incremented for every fragment that is shaded.
+template<typename Target>
+inline void DrawTriangle(const ClippedVertex& cv0,const ClippedVertex& cv1,const ClippedVertex& cv2, Target& image, TextureRef texture, const Tile& tile, const Color3f& tint = Color3f(1.f,1.f,1.f),
+                         DepthPass pass = DepthPass::kNormal, std::uint64_t* shaded = nullptr) {
+    if(image.samples==4) return DrawTriangleMultisample(cv0, cv1, cv2, image, texture, tile, tint, kSamplePositions4, pass, shaded);
+    if(image.samples==8) return DrawTriangleMultisample(cv0, cv1, cv2, image, texture, tile, tint, kSamplePositions8, pass, shaded);
+
+    //Without clipping (TODO), a triangle with a vertex behind the camera projects to garbage, so skip it.
+    //Culling removes whole objects behind the near plane, so this only affects objects that straddle the camera.
+    if(cv0.clip_z>=0.f || cv1.clip_z>=0.f || cv2.clip_z>=0.f) return;
+
+    //Snap to the subpixel grid. Integer edge functions are exact, so triangles that share an edge never leave cracks or overlap,
+    //and the result does not depend on how the image is split into tiles.
+    const auto setup = SetupTriangle(cv0.pixel_coords.xy(), cv1.pixel_coords.xy(), cv2.pixel_coords.xy());
+    if(!setup) return;
+    const auto& tri = *setup;
+
+    //Pixels whose centers lie in the bounding box, restricted to the tile
+    const auto bounds = PixelBounds(tri, tile);
+    if(bounds.Empty()) return;
+
+    //Evaluate 1/z at each vertex
+    const auto inv_z0 = 1.f/cv0.clip_z;
+    const auto inv_z1 = 1.f/cv1.clip_z;
+    const auto inv_z2 = 1.f/cv2.clip_z;
+    const auto inv_area = 1.f/static_cast<float>(tri.area);
+
+    Rasterize(tri, bounds, [&](std::int32_t x, std::int32_t y, std::int64_t w0, std::int64_t w1, std::int64_t w2) {
+        //Barycentric coordinates
+        const auto b0 = static_cast<float>(w0)*inv_area;
+        const auto b1 = static_cast<float>(w1)*inv_area;
+        const auto b2 = static_cast<float>(w2)*inv_area;
+
+        //Interpolate 1/z
+        const auto inv_z_interp = b0*inv_z0 + b1*inv_z1 + b2*inv_z2;
+
+        //Compute perspective-correct depth attribute
+        const auto pCorrectDepth = 1.f/inv_z_interp;
+
+        //Early depth testing
+        if(pass==DepthPass::kEqual) {
+            if(pCorrectDepth!=image.Depth(x,y)) return;
+        }
+        else {
+            if(pCorrectDepth<image.Depth(x,y)) return;
+            image.Depth(x,y) = pCorrectDepth;
+            if(pass==DepthPass::kDepthOnly) return;
+        }
+
+        //Interpolate other attributes
+
+        //Texture
+        auto  pCorrectTex = b0*cv0.tex_coords*inv_z0  + b1*cv1.tex_coords*inv_z1  + b2*cv2.tex_coords*inv_z2;
+        pCorrectTex /= (1.f/pCorrectDepth);
+
+        image.Color(x,y) =  tint*TextureLookup(texture, ClampTexCoord(pCorrectTex.x), ClampTexCoord(pCorrectTex.y));
+        if(shaded) ++*shaded;
+    });
+}
+
+//Draws a triangle anywhere on the image. Cleared tiles under the triangle's bounding box are filled first (see FrameBuffer::Clear).
+inline void DrawTriangle(const ClippedVertex& cv0,const ClippedVertex& cv1,const ClippedVertex& cv2, FrameBuffer& image, TextureRef texture) {
+    const auto min = la::min(la::min(cv0.pixel_coords.xy(), cv1.pixel_coords.xy()), cv2.pixel_coords.xy());
+    const auto max = la::max(la::max(cv0.pixel_coords.xy(), cv1.pixel_coords.xy()), cv2.pixel_coords.xy());
+    const auto clamp_x = [&](float f) { return static_cast<std::int32_t>(std::clamp(f, 0.f, static_cast<float>(image.width))); };
+    const auto clamp_y = [&](float f) { return static_cast<std::int32_t>(std::clamp(f, 0.f, static_cast<float>(image.height))); };
+    image.Touch(Tile{clamp_x(min.x), clamp_y(min.y), std::min(clamp_x(max.x) + 1, image.width), std::min(clamp_y(max.y) + 1, image.height)});
+    DrawTriangle(cv0, cv1, cv2, image, texture, Tile{0, 0, image.width, image.height});
+}
+
+
+/// @brief Runs the fixed-function vertex stage for a single vertex.
+/// @brief world space -> camera space -> clip space -> NDC -> screen space.
+/// @param worldpos Position of the vertex in world space.
+/// @param texcoord Texture coordinates of the vertex.
+/// @param view World-to-camera matrix (or object-to-camera, if the object has its own model matrix).
+/// @param projection Camera-to-clip matrix.
+/// @return Vertex in screen space, ready to be rasterized.
+[[nodiscard]] inline ClippedVertex ProcessVertex(const Vec3f& worldpos, const Vec2f& texcoord, const Mat44f& view, const Mat44f& projection, std::int32_t height, std::int32_t width) {
+    //Transform to camera space by applying view matrix.
+    const auto hcamerapos = la::mul(view, Vec4f(worldpos,1.f));
+
+    //Transform to clip space by applying projection matrix.
+    const auto hclipspacepos = la::mul(projection,hcamerapos);
+
+    //Clipping (TODO)
+
+    //Transform to NDC by applying perspective divide. (Note this does nothing for an orthographic projection).
+    const auto ndcpos = hclipspacepos.xyz() / hclipspacepos.w;
+
+    //Transform to screen space by applying viewport transformation.
+    //Keep the z coordinate for depth testing.
+    const auto viewpos = Vec3f{(ndcpos.x+1)*width/2.f, (-ndcpos.y+1)*height/2.f, ndcpos.z};
+
+    return ClippedVertex{viewpos, texcoord, hcamerapos.z};
+}
+
+/// @brief Runs the vertex stage over every face of a model.
+/// @brief Each unique position is transformed once by the SIMD stream kernel (see TransformVertexStream), then gathered per face corner.
+/// @return Three screen-space vertices per face, in face order.
+[[nodiscard]] inline std::vector<ClippedVertex> ProcessVertices(const Model& model, const Mat44f& view, const Mat44f& projection, std::int32_t height, std::int32_t width) {
+    ScreenStream transformed;
+    TransformVertexStream(model.PositionStream(), view, projection, height, width, transformed);
+
+    const auto& faces = model.Faces();
+    std::vector<ClippedVertex> out(3*faces.size());
+    for(std::size_t f = 0; f < faces.size(); ++f) {
+        for(int i = 0; i < 3; ++i) {
+            out[3*f+i] = transformed.Vertex(faces[f].pos_idx[i], model.TexCoords()[faces[f].tex_idx[i]]);
+        }
+    }
+    return out;
+}
+
+/// @brief As above, but reads positions and texture coordinates from the model's quantized vertices (see QuantizeVertices).
+/// @brief They are decoded here, in the vertex stage; the output is the same up to the quantization error.
+[[nodiscard]] inline std::vector<ClippedVertex> ProcessVertices(const Model& model, const QuantizedVertices& quantized, const Mat44f& view, const Mat44f& projection, std::int32_t height, std::int32_t width) {
+    ScreenStream transformed;
+    TransformVertexStream(quantized.positions, view, projection, height, width, transformed);
+
+    const auto& faces = model.Faces();
+    std::vector<ClippedVertex> out(3*faces.size());
+    for(std::size_t f = 0; f < faces.size(); ++f) {
+        for(int i = 0; i < 3; ++i) {
+            out[3*f+i] = transformed.Vertex(faces[f].pos_idx[i], quantized.TexCoord(faces[f].tex_idx[i]));
+        }
+    }
+    return out;
+}
+
+/// @brief Gathers the screen-space vertices of a subset of the faces of a model from its positions already run through the vertex stage.
+/// @param transformed The model's PositionStream() after TransformVertexStream. Every level of detail indexes the same positions.
+/// @param faces Indices of the faces to gather.
+/// @param lod Level of detail that the face indices refer to.
+/// @return Three screen-space vertices per face, in the order given.
+[[nodiscard]] inline std::vector<ClippedVertex> ProcessVertices(const Model& model, const ScreenStream& transformed, std::span<const std::uint32_t> faces, std::size_t lod = 0) {
+    std::vector<ClippedVertex> out(3*faces.size());
+    for(std::size_t f = 0; f < faces.size(); ++f) {
+        const auto& face = model.Faces(lod)[faces[f]];
+        for(int i = 0; i < 3; ++i) {
+            out[3*f+i] = transformed.Vertex(face.pos_idx[i], model.TexCoords()[face.tex_idx[i]]);
+        }
+    }
+    return out;
+}
+
+/// @brief Runs the vertex stage over a subset of the faces of a model, one face corner at a time.
+/// @brief For small subsets. When many faces of a model are drawn, transforming its whole PositionStream() once and gathering (above) is cheaper.
+/// @param faces Indices of the faces to process.
+/// @param lod Level of detail that the face indices refer to.
+/// @return Three screen-space vertices per face, in the order given.
+[[nodiscard]] inline std::vector<ClippedVertex> ProcessVertices(const Model& model, std::span<const std::uint32_t> faces, const Mat44f& view, const Mat44f& projection, std::int32_t height, std::int32_t width, std::size_t lod = 0) {
+    std::vector<ClippedVertex> out(3*faces.size());
+    for(std::size_t f = 0; f < faces.size(); ++f) {
+        const auto& face = model.Faces(lod)[faces[f]];
+        for(int i = 0; i < 3; ++i) {
+            out[3*f+i] = ProcessVertex(model.Vertices()[face.pos_idx[i]], model.TexCoords()[face.tex_idx[i]], view, projection, height, width);
+        }
+    }
+    return out;
+}
+
+/// @brief Draws every face of a model, restricted to one tile of the image.
+inline void DrawModel(const Model& model, TextureRef texture, const Mat44f& view, const Mat44f& projection, FrameBuffer& image, const Tile& tile) {
+    const auto vertices = ProcessVertices(model, view, projection, image.height, image.width);
+    image.Touch(tile);
+    for(std::size_t i = 0; i < vertices.size(); i += 3) {
+        DrawTriangle(vertices[i], vertices[i+1], vertices[i+2], image, texture, tile);
+    }
+}
+
+/// @brief Draws every face of a model over the whole image on the calling thread.
+inline void DrawModel(const Model& model, TextureRef texture, const Mat44f& view, const Mat44f& projection, FrameBuffer& image) {
+    DrawModel(model, texture, view, projection, image, Tile{0, 0, image.width, image.height});
+}
+
+/// @brief Screen-space triangles that share a texture, ready to be rasterized.
+struct DrawBatch {
+    std::vector<ClippedVertex> vertices; //Three per triangle
+    TextureRef texture;
+    Color3f tint{1.f,1.f,1.f};
+};
+
+//A triangle of a batch, as stored in a tile bin.
+struct BinnedTriangle {
+    std::uint32_t batch;
+    std::uint32_t first_vertex;
+};
+
+//The row or column of tiles holding screen coordinate 'f', along an axis of 'size' pixels. Coordinates off the screen map to the
+//nearest edge tile. They are clamped while still floats, so that huge projected coordinates cannot overflow the conversion.
+[[nodiscard]] inline std::int32_t TileCoordinate(float f, std::int32_t size, std::int32_t tile_size) {
+    return static_cast<std::int32_t>(std::clamp(f, 0.f, static_cast<float>(size - 1)))/tile_size;
+}
+
+/// @brief Sorts the triangles of a set of batches into the tiles that their bounding boxes overlap.
+/// @brief Triangles that are entirely off-screen or cross behind the camera are dropped here.
+/// @return One list per tile (row-major, as produced by SplitIntoTiles), each in submission order.
+[[nodiscard]] inline std::vector<std::vector<BinnedTriangle>> BinTriangles(std::span<const DrawBatch> batches, std::int32_t height, std::int32_t width, std::int32_t tile_size) {
+    const auto tiles_x = (width + tile_size - 1)/tile_size;
+    const auto tiles_y = (height + tile_size - 1)/tile_size;
+    std::vector<std::vector<BinnedTriangle>> bins(tiles_x*tiles_y);
+
+    for(std::uint32_t b = 0; b < batches.size(); ++b) {
+        const auto& vertices = batches[b].vertices;
+        for(std::uint32_t i = 0; i < vertices.size(); i += 3) {
+            const auto& v0 = vertices[i];
+            const auto& v1 = vertices[i+1];
+            const auto& v2 = vertices[i+2];
+            if(v0.clip_z>=0.f || v1.clip_z>=0.f || v2.clip_z>=0.f) continue;
+
+            //Multisampled pixels have samples up to half a pixel from their center, so pad the bounds by that much
+            const auto min_x = std::min({v0.pixel_coords.x, v1.pixel_coords.x, v2.pixel_coords.x}) - 0.5f;
+            const auto max_x = std::max({v0.pixel_coords.x, v1.pixel_coords.x, v2.pixel_coords.x}) + 0.5f;
+            const auto min_y = std::min({v0.pixel_coords.y, v1.pixel_coords.y, v2.pixel_coords.y}) - 0.5f;
+            const auto max_y = std::max({v0.pixel_coords.y, v1.pixel_coords.y, v2.pixel_coords.y}) + 0.5f;
+            //Vertices very close to the camera plane can project to huge or non-finite coordinates
+            if(!std::isfinite(min_x) || !std::isfinite(max_x) || !std::isfinite(min_y) || !std::isfinite(max_y)) continue;
+            if(max_x < 0.f || max_y < 0.f || min_x >= width || min_y >= height) continue;
+
+            const auto tx0 = TileCoordinate(min_x, width, tile_size);
+            const auto ty0 = TileCoordinate(min_y, height, tile_size);
+            const auto tx1 = TileCoordinate(max_x, width, tile_size);
+            const auto ty1 = TileCoordinate(max_y, height, tile_size);
+            for(auto ty = ty0; ty <= ty1; ++ty) {
+                for(auto tx = tx0; tx <= tx1; ++tx) {
+                    bins[ty*tiles_x + tx].push_back(BinnedTriangle{b, i});
+                }
+            }
+        }
+    }
+    return bins;
+}
+
+//What DrawBatches reads from, and writes back to, the image around each tile.
+struct TileMemory {
+    //Start each tile from the image's contents, color and depth. Otherwise tiles start at the image's clear color and the farthest depth,
+    //without reading the image, and the whole image is overwritten: only what is drawn this pass is depth-tested against.
+    bool load{true};
+    bool store_depth{true}; //Write depth back to the image. Leave it out when nothing reads the image's depth after drawing (depth is still tested).
+};
+
+/// @brief Draws the triangles binned to one tile into a per-thread TileBuffer and copies it to the image: the work DrawBatches does per tile.
+/// @return Number of fragments shaded.
+inline std::uint64_t DrawBinnedTile(std::span<const DrawBatch> batches, std::span<const BinnedTriangle> bin, const Tile& tile, FrameBuffer& image,
+                                    TileMemory memory = {}, bool depth_prepass = false) {
+    thread_local TileBuffer scratch;
+    scratch.Reset(tile, image.samples);
+    if(memory.load) scratch.Load(image);
+    else scratch.Clear(image.ClearColor());
+
+    std::uint64_t shaded = 0;
+    const auto draw = [&](DepthPass pass) {
+        for(const auto& [b, i] : bin) {
+            const auto& batch = batches[b];
+            DrawTriangle(batch.vertices[i], batch.vertices[i+1], batch.vertices[i+2], scratch, batch.texture, tile, batch.tint, pass, &shaded);
+        }
+    };
+    if(depth_prepass) {
+        draw(DepthPass::kDepthOnly);
+        draw(DepthPass::kEqual);
+    }
+    else {
+        draw(DepthPass::kNormal);
+    }
+    scratch.Store(image, memory.store_depth);
+    return shaded;
+}
+
+/// @brief Rasterizes a set of batches by splitting the image into tiles and rasterizing the tiles in parallel.
+/// @brief Triangles are first binned by tile so that each tile only visits the triangles that overlap it.
+/// @brief Each tile owns its pixels exclusively, so no locking is needed. Within a tile, triangles are drawn in submission order.
+/// @brief Tiles are drawn into a per-thread TileBuffer, which stays in cache however much overdraw there is, and copied to the image once.
+/// @brief With a depth prepass each tile's triangles are drawn twice, back to back on the same cached tile: depth only, then color with an
+/// @brief equal depth test (see DepthPass). Without one, submitting batches front to back lets the depth test reject the most fragments.
+/// @brief Tiles that no triangle touches are skipped, so tiles of a cleared image (see FrameBuffer::Clear) stay cleared and cost no memory traffic.
+/// @param memory Whether tiles are loaded from the image first, and whether their depth is stored back.
+/// @return Number of fragments shaded (texture lookups). Divided by the pixel count this is the shading overdraw.
+inline std::uint64_t DrawBatches(std::span<const DrawBatch> batches, FrameBuffer& image, ThreadPool& pool, std::int32_t tile_size = kDefaultTileSize, TileMemory memory = {}, bool depth_prepass = false) {
+    assert(tile_size%kClearTileSize==0 && "Error: tile size must be a multiple of kClearTileSize!");
+    const auto tiles = SplitIntoTiles(image.height, image.width, tile_size);
+    const auto bins = BinTriangles(batches, image.height, image.width, tile_size);
+    std::vector<std::uint64_t> shaded(tiles.size(), 0);
+
+    pool.ParallelFor(0, static_cast<std::int32_t>(tiles.size()), [&](std::int32_t t) {
+        //Tiles that no triangle touches keep the image's pixels, unless those are being replaced
+        if(bins[t].empty() && memory.load) return;
+        shaded[t] = DrawBinnedTile(batches, bins[t], tiles[t], image, memory, depth_prepass);
+    });
+    return std::accumulate(shaded.begin(), shaded.end(), std::uint64_t{0});
+}
+
+//Pixels depth-tested together when depth lives in a DepthBuffer: 8 lanes fill a 256-bit register for 32-bit formats.
+inline constexpr std::size_t kDepthSpanWidth{8};
+
+/// @brief Rasterizes a triangle into a single-sampled image, with depth in a separate DepthBuffer of any DepthFormat.
+/// @brief Vertices must come from a reverse-Z projection (see ReverseZPerspectiveProjection), whose NDC depth is affine in screen space,
+/// @brief so it is interpolated with the screen-space barycentrics; no per-pixel division is needed for the depth itself.
+/// @brief Pixels are visited in row spans of kDepthSpanWidth (see RasterizeSpans), so each span is depth-tested with one call to DepthBuffer::Test.
+/// @brief Only passing pixels are shaded. Coverage is the same as DrawTriangle's.
+/// @param image A FrameBuffer with the cleared tiles under 'tile' touched, or a TileBuffer covering 'tile'.
+template<typename Target>
+inline void DrawTriangle(const ClippedVertex& cv0, const ClippedVertex& cv1, const ClippedVertex& cv2, Target& image, DepthBuffer& depth, TextureRef texture, const Tile& tile,
+                         const Color3f& tint = Color3f(1.f,1.f,1.f)) {
+    assert(image.samples==1 && "Error: DepthBuffer does not support multisampling!");
+    if(cv0.clip_z>=0.f || cv1.clip_z>=0.f || cv2.clip_z>=0.f) return;
+
+    const auto setup = SetupTriangle(cv0.pixel_coords.xy(), cv1.pixel_coords.xy(), cv2.pixel_coords.xy());
+    if(!setup) return;
+    const auto& tri = *setup;
+    const auto bounds = PixelBounds(tri, tile);
+    if(bounds.Empty()) return;
+
+    const auto inv_z0 = 1.f/cv0.clip_z;
+    const auto inv_z1 = 1.f/cv1.clip_z;
+    const auto inv_z2 = 1.f/cv2.clip_z;
+    const auto inv_area = 1.f/static_cast<float>(tri.area);
+    const auto z0 = cv0.pixel_coords.z, z1 = cv1.pixel_coords.z, z2 = cv2.pixel_coords.z;
+
+    RasterizeSpans<kDepthSpanWidth>(tri, bounds, [&](std::int32_t x, std::int32_t y, std::size_t count, std::uint32_t mask, const auto& w0, const auto& w1, const auto& w2) {
+        std::array<float,kDepthSpanWidth> b0, b1, b2, d;
+        for(std::size_t i = 0; i < kDepthSpanWidth; ++i) {
+            b0[i] = static_cast<float>(w0[i])*inv_area;
+            b1[i] = static_cast<float>(w1[i])*inv_area;
+            b2[i] = static_cast<float>(w2[i])*inv_area;
+            d[i] = b0[i]*z0 + b1[i]*z1 + b2[i]*z2;
+        }
+        const auto passed = depth.Test(x, y, count, d, mask);
+        for(std::size_t i = 0; i < count; ++i) {
+            if(!(passed >> i & 1u)) continue;
+            const auto inv_z = b0[i]*inv_z0 + b1[i]*inv_z1 + b2[i]*inv_z2;
+            const auto tex = (b0[i]*cv0.tex_coords*inv_z0 + b1[i]*cv1.tex_coords*inv_z1 + b2[i]*cv2.tex_coords*inv_z2)/inv_z;
+            image.Color(x + static_cast<std::int32_t>(i), y) = tint*TextureLookup(texture, ClampTexCoord(tex.x), ClampTexCoord(tex.y));
+        }
+    });
+}
+
+/// @brief Rasterizes a set of batches with depth in a separate DepthBuffer, splitting the image into tiles drawn in parallel.
+/// @brief Binning is as in DrawBatches. Colors are drawn in a per-thread TileBuffer; its depth is unused, since the DepthBuffer holds depth.
+inline void DrawBatches(std::span<const DrawBatch> batches, FrameBuffer& image, DepthBuffer& depth, ThreadPool& pool, std::int32_t tile_size = kDefaultTileSize) {
+    assert(depth.height==image.height && depth.width==image.width);
+    assert(tile_size%kClearTileSize==0 && "Error: tile size must be a multiple of kClearTileSize!");
+    const auto tiles = SplitIntoTiles(image.height, image.width, tile_size);
+    const auto bins = BinTriangles(batches, image.height, image.width, tile_size);
+
+    pool.ParallelFor(0, static_cast<std::int32_t>(tiles.size()), [&](std::int32_t t) {
+        if(bins[t].empty()) return;
+        thread_local TileBuffer scratch;
+        scratch.Reset(tiles[t], image.samples);
+        scratch.Load(image);
+        for(const auto& [b, i] : bins[t]) {
+            const auto& batch = batches[b];
+            DrawTriangle(batch.vertices[i], batch.vertices[i+1], batch.vertices[i+2], scratch, depth, batch.texture, tiles[t], batch.tint);
+        }
+        scratch.Store(image, false);
+    });
+}
+
+/// @brief Draws every face of a model by splitting the image into tiles and rasterizing the tiles in parallel.
+/// @brief Vertices are transformed once up front.
+inline void DrawModel(const Model& model, TextureRef texture, const Mat44f& view, const Mat44f& projection, FrameBuffer& image, ThreadPool& pool, std::int32_t tile_size = kDefaultTileSize) {
+    const DrawBatch batch{ProcessVertices(model, view, projection, image.height, image.width), texture};
+    DrawBatches(std::span(&batch, 1), image, pool, tile_size);
+}
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include <cura/bounds.h>
+#include <cura/buffer.h>
+#include <cura/camera.h>
+#include <cura/math.h>
+#include <cura/model.h>
+#include <cura/renderer.h>
+#include <cura/thread_pool.h>
+#include <cura/transforms.h>
+#include <cura/vertex_stream.h>
+
+/// @brief A model placed in the world. The model and texture must outlive the scene, unless they were added as shared assets.
+struct SceneObject {
+    const Model* model;
+    TextureRef texture;
+    Mat44f transform; //Object-to-world matrix
+    AABB world_bounds; //Bounds of the model after 'transform' is applied
+};
+
+/// @brief A flat list of objects with a bounding volume hierarchy over their world-space bounds.
+/// @brief The BVH is used to frustum-cull whole groups of objects with a single test.
+class Scene {
+public:
+    //Adds an object to the scene. Build() must be called before the next Cull().
+    std::size_t Add(const Model& model, TextureRef texture, const Mat44f& transform = Mat44f{la::identity}) {
+        objects_.push_back(SceneObject{&model, texture, transform, model.Bounds().Transformed(transform)});
+        built_ = false;
+        ++revision_;
+        return objects_.size()-1;
+    }
+
+    //Adds an object whose model and texture are shared assets (e.g. from an AssetManager). The scene keeps them alive.
+    std::size_t Add(std::shared_ptr<const Model> model, std::shared_ptr<const FrameBuffer> texture, const Mat44f& transform = Mat44f{la::identity}) {
+        const auto index = Add(*model, *texture, transform);
+        assets_.push_back(std::move(model));
+        assets_.push_back(std::move(texture));
+        return index;
+    }
+
+    //Moves an object. Build() must be called before the next Cull().
+    void SetTransform(std::size_t index, const Mat44f& transform) {
+        auto& object = objects_[index];
+        object.transform = transform;
+        object.world_bounds = object.model->Bounds().Transformed(transform);
+        built_ = false;
+        ++revision_;
+    }
+
+    [[nodiscard]] const std::vector<SceneObject>& Objects() const noexcept {return objects_;}
+
+    //Changes whenever the scene's geometry changes. Used to decide whether cached results (e.g. shadow maps) are stale.
+    [[nodiscard]] std::uint64_t Revision() const noexcept {return revision_;}
+
+    //World-space bounds of every object in the scene
+    [[nodiscard]] AABB Bounds() const noexcept {
+        AABB bounds;
+        for(const auto& object : objects_) bounds.Extend(object.world_bounds);
+        return bounds;
+    }
+
+    //(Re)builds the BVH over the current objects.
+    void Build() {
+        nodes_.clear();
+        order_.resize(objects_.size());
+        std::iota(order_.begin(), order_.end(), std::size_t{0});
+        if(!objects_.empty()) {
+            nodes_.reserve(2*objects_.size());
+            BuildNode(0, objects_.size());
+        }
+        built_ = true;
+    }
+
+    /// @brief Finds the objects whose bounds intersect the frustum.
+    /// @return Indices into Objects(), in no particular order.
+    [[nodiscard]] std::vector<std::size_t> Cull(const Frustum& frustum) const {
+        assert(built_ && "Scene::Build() must be called after adding objects");
+        std::vector<std::size_t> visible;
+        if(!nodes_.empty()) {
+            CullNode(0, frustum, visible);
+        }
+        return visible;
+    }
+
+private:
+    //A leaf holds objects order_[first, first+count). An inner node has count==0 and its children at 'left' and 'right'.
+    struct Node {
+        AABB bounds;
+        std::size_t left;
+        std::size_t right;
+        std::size_t first;
+        std::size_t count;
+    };
+    static constexpr std::size_t kmax_leaf_objects{4};
+
+    std::size_t BuildNode(std::size_t first, std::size_t last) {
+        const auto index = nodes_.size();
+        nodes_.push_back(Node{});
+
+        AABB bounds;
+        AABB centers; //Split along the axis in which the object centers are most spread out
+        for(auto i = first; i < last; ++i) {
+            bounds.Extend(objects_[order_[i]].world_bounds);
+            centers.Extend(objects_[order_[i]].world_bounds.Center());
+        }
+        nodes_[index].bounds = bounds;
+
+        if(last-first <= kmax_leaf_objects) {
+            nodes_[index].first = first;
+            nodes_[index].count = last-first;
+            return index;
+        }
+
+        const auto extent = centers.Extent();
+        const int axis = extent.x>extent.y ? (extent.x>extent.z ? 0 : 2) : (extent.y>extent.z ? 1 : 2);
+
+        //Median split
+        const auto mid = first + (last-first)/2;
+        std::nth_element(order_.begin()+first, order_.begin()+mid, order_.begin()+last, [&](std::size_t a, std::size_t b) {
+            return objects_[a].world_bounds.Center()[axis] < objects_[b].world_bounds.Center()[axis];
+        });
+
+        const auto left = BuildNode(first, mid);
+        const auto right = BuildNode(mid, last);
+        nodes_[index].left = left;
+        nodes_[index].right = right;
+        nodes_[index].count = 0;
+        return index;
+    }
+
+    void CullNode(std::size_t index, const Frustum& frustum, std::vector<std::size_t>& visible) const {
+        const auto& node = nodes_[index];
+        const auto containment = frustum.Test(node.bounds);
+        if(containment==Containment::kOutside) return;
+        if(containment==Containment::kInside) {
+            CollectNode(index, visible); //Everything below is visible, no more tests needed
+            return;
+        }
+        if(node.count>0) {
+            for(auto i = node.first; i < node.first+node.count; ++i) {
+                if(frustum.Test(objects_[order_[i]].world_bounds)!=Containment::kOutside) visible.push_back(order_[i]);
+            }
+            return;
+        }
+        CullNode(node.left, frustum, visible);
+        CullNode(node.right, frustum, visible);
+    }
+
+    void CollectNode(std::size_t index, std::vector<std::size_t>& visible) const {
+        const auto& node = nodes_[index];
+        if(node.count>0) {
+            for(auto i = node.first; i < node.first+node.count; ++i) visible.push_back(order_[i]);
+            return;
+        }
+        CollectNode(node.left, visible);
+        CollectNode(node.right, visible);
+    }
+
+private:
+    std::vector<SceneObject> objects_;
+    std::vector<Node> nodes_;
+    std::vector<std::size_t> order_; //Object indices, permuted so that every leaf refers to a contiguous range
+    bool built_{true};
+    std::uint64_t revision_{0};
+    std::vector<std::shared_ptr<const void>> assets_; //Shared assets referenced by objects_
+};
+
+
+//Counts of what was rejected while culling and drawing a frame.
+struct CullStats {
+    std::size_t objects{0};                   //Objects in the scene
+    std::size_t objects_visible{0};           //Objects that survived BVH culling
+    std::size_t meshlets_tested{0};           //Meshlets of the visible objects
+    std::size_t meshlets_frustum_culled{0};   //Meshlets outside the frustum
+    std::size_t meshlets_backface_culled{0};  //Meshlets facing entirely away from the camera
+    std::size_t faces_drawn{0};               //Faces sent to the vertex stage, after LOD selection and culling
+    std::uint64_t fragments_shaded{0};        //Fragments whose color was computed. Divided by the pixel count this is the shading overdraw.
+};
+
+//Largest factor by which a matrix scales lengths. Used to grow bounding spheres conservatively.
+[[nodiscard]] inline float MaxScale(const Mat44f& m) {
+    return std::sqrt(std::max({la::length2(m[0].xyz()), la::length2(m[1].xyz()), la::length2(m[2].xyz())}));
+}
+
+//The coarsest level of detail is chosen whose error projects to at most this many pixels.
+inline constexpr float kLodMaxErrorPixels{1.f};
+
+/// @brief Picks the level of detail of a placed model from the size of its projected bounding sphere.
+/// @brief The sphere's distance gives the number of pixels per world unit at the model; the coarsest level whose
+/// @brief geometric error stays below kLodMaxErrorPixels on screen is used. Models that contain the camera use full detail.
+/// @param transform Object-to-world matrix.
+/// @param view World-to-camera matrix.
+/// @param projection Camera-to-clip matrix.
+/// @param height Height of the image in pixels.
+[[nodiscard]] inline std::size_t SelectLod(const Model& model, const Mat44f& transform, const Mat44f& view, const Mat44f& projection, std::int32_t height) {
+    const auto scale = MaxScale(transform);
+    const auto center = la::mul(la::mul(view, transform), Vec4f(model.Sphere().center,1.f)).xyz();
+    const auto radius = model.Sphere().radius*scale;
+    const auto distance = -center.z - radius; //Distance from the camera to the nearest point of the sphere, along the view axis
+    if(distance <= 0.f) return 0;
+
+    //projection[1][1] is cot(vfov/2), so a unit length at this distance covers this many pixels vertically
+    const auto pixels_per_unit = std::abs(projection[1][1])*0.5f*static_cast<float>(height)/distance;
+    std::size_t lod = 0;
+    while(lod+1 < model.LodCount() && model.LodError(lod+1)*scale*pixels_per_unit <= kLodMaxErrorPixels) ++lod;
+    return lod;
+}
+
+/// @brief Culls the meshlets of one placed model against a frustum and the viewer's position.
+/// @param lod Level of detail whose meshlets are culled.
+/// @param transform Object-to-world matrix.
+/// @param model_view Object-to-camera matrix.
+/// @param fully_inside Whether the whole object is already known to be inside the frustum (skips the frustum tests).
+/// @param visible Receives the surviving meshlets.
+inline void CullMeshlets(const Model& model, std::size_t lod, const Mat44f& transform, const Mat44f& model_view, const Frustum& frustum, bool fully_inside, CullStats& stats, std::vector<const Meshlet*>& visible) {
+    const auto viewer = ViewPosition(model_view); //Camera position in object space
+    const auto scale = MaxScale(transform);
+
+    for(const auto& meshlet : model.Meshlets(lod)) {
+        ++stats.meshlets_tested;
+        if(!fully_inside) {
+            const BoundingSphere world_sphere{la::mul(transform, Vec4f(meshlet.sphere.center,1.f)).xyz(), meshlet.sphere.radius*scale};
+            if(frustum.Test(world_sphere)==Containment::kOutside) {
+                ++stats.meshlets_frustum_culled;
+                continue;
+            }
+        }
+        if(IsBackFacing(meshlet, viewer)) {
+            ++stats.meshlets_backface_culled;
+            continue;
+        }
+        visible.push_back(&meshlet);
+        stats.faces_drawn += meshlet.count;
+    }
+}
+
+/// @brief Culls a scene and runs the vertex stage on what survives, producing the batches that DrawScene rasterizes.
+/// @brief Objects are frustum-culled through the BVH and a level of detail is chosen for each visible one. Its meshlets are then culled against the frustum
+/// @brief and their normal cones, all before any vertices are transformed. The positions of each object with surviving meshlets are then
+/// @brief transformed once by the stream kernel (see TransformVertexStream), and the meshlets' face corners are gathered from them in parallel.
+/// @brief Batches are sorted front to back, so that the depth test rejects hidden fragments before they are shaded.
+/// @param near Distance to the near plane used to build 'projection' (the sign is ignored).
+/// @param far Distance to the far plane used to build 'projection' (the sign is ignored).
+/// @param include If not empty, one flag per object: objects whose flag is clear are skipped. The other batches come out exactly as without it.
+[[nodiscard]] inline std::vector<DrawBatch> BuildSceneBatches(const Scene& scene, const Camera& camera, const Mat44f& projection, float near, float far,
+                                                              std::int32_t height, std::int32_t width, ThreadPool& pool, CullStats& stats, std::span<const std::uint8_t> include = {}) {
+    const auto frustum = MakeFrustum(camera.view, projection, near, far);
+    auto visible = scene.Cull(frustum);
+    if(!include.empty()) std::erase_if(visible, [&](std::size_t index) { return !include[index]; });
+    std::ranges::sort(visible); //Keep submission order stable so equal-depth fragments resolve the same way every frame
+
+    stats.objects = scene.Objects().size();
+    stats.objects_visible = visible.size();
+
+    struct MeshletDraw {
+        std::size_t object;
+        std::size_t lod;
+        const Meshlet* meshlet;
+        std::size_t stream; //Index into the transformed positions of the visible objects
+        float distance; //From the camera to the nearest point of the meshlet's bounding sphere, along the view axis
+    };
+    std::vector<MeshletDraw> draws;
+    //The objects that have meshlets to draw, with their model-view matrices
+    std::vector<std::pair<std::size_t, Mat44f>> drawn;
+
+    std::vector<const Meshlet*> meshlets;
+    for(auto index : visible) {
+        const auto& object = scene.Objects()[index];
+        const auto model_view = la::mul(camera.view, object.transform);
+        const auto fully_inside = frustum.Test(object.world_bounds)==Containment::kInside;
+
+        const auto lod = SelectLod(*object.model, object.transform, camera.view, projection, height);
+
+        meshlets.clear();
+        CullMeshlets(*object.model, lod, object.transform, model_view, frustum, fully_inside, stats, meshlets);
+        if(meshlets.empty()) continue;
+        const auto scale = MaxScale(object.transform);
+        for(const auto* meshlet : meshlets) {
+            const auto center = la::mul(model_view, Vec4f(meshlet->sphere.center,1.f)).xyz();
+            draws.push_back(MeshletDraw{index, lod, meshlet, drawn.size(), -center.z - meshlet->sphere.radius*scale});
+        }
+        drawn.emplace_back(index, model_view);
+    }
+    //Front to back. Ties keep the order above, so the result is the same every frame.
+    std::ranges::stable_sort(draws, {}, &MeshletDraw::distance);
+
+    //Each shared position is transformed once per object, rather than once per face corner
+    std::vector<ScreenStream> streams(drawn.size());
+    pool.ParallelFor(0, static_cast<std::int32_t>(drawn.size()), [&](std::int32_t i) {
+        const auto& [index, model_view] = drawn[i];
+        TransformVertexStream(scene.Objects()[index].model->PositionStream(), model_view, projection, height, width, streams[i]);
+    });
+
+    std::vector<DrawBatch> batches(draws.size());
+    pool.ParallelFor(0, static_cast<std::int32_t>(draws.size()), [&](std::int32_t i) {
+        const auto& draw = draws[i];
+        const auto& object = scene.Objects()[draw.object];
+        const auto faces = std::span(object.model->MeshletFaces(draw.lod)).subspan(draw.meshlet->first, draw.meshlet->count);
+        batches[i] = DrawBatch{ProcessVertices(*object.model, streams[draw.stream], faces, draw.lod), object.texture};
+    });
+    return batches;
+}
+
+/// @brief Draws the objects of a scene that are visible from a camera (see BuildSceneBatches).
+/// @param near Distance to the near plane used to build 'projection' (the sign is ignored).
+/// @param far Distance to the far plane used to build 'projection' (the sign is ignored).
+/// @param depth_prepass Lay down depth before shading, so that every pixel is shaded once (see DrawBatches).
+inline CullStats DrawScene(const Scene& scene, const Camera& camera, const Mat44f& projection, float near, float far, FrameBuffer& image, ThreadPool& pool, bool depth_prepass = false) {
+    CullStats stats;
+    const auto batches = BuildSceneBatches(scene, camera, projection, near, far, image.height, image.width, pool, stats);
+    stats.fragments_shaded = DrawBatches(batches, image, pool, kDefaultTileSize, TileMemory{}, depth_prepass);
+    return stats;
+}
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <concepts>
+#include <cstdint>
 #include <mutex>
 #include <string>
 #include <type_traits>
@@ -9,10 +12,15 @@
 #include <variant>
 
 #include <cura/buffer.h>
+#include <cura/compressed_texture.h>
 #include <cura/math.h>
 
 #include "vertex.h"
 
+//Makes an interpolated texture coordinate safe to look up. Perspective-correct quotients can round just outside [0,1] at triangle
+//edges, and helper lanes outside a triangle can interpolate to values far outside it or to NaN, which std::clamp would pass through.
+[[nodiscard]] inline float ClampTexCoord(float t) { return std::isfinite(t) ? std::clamp(t, 0.f, 1.f) : 0.f; }
+
 inline Color3f TextureLookup( const FrameBuffer& texture, float u, float v, bool flip_v = true) {
     assert(u>=0 && u<=1.f);
     assert(v>=0 && v<=1.f);
@@ -23,7 +31,48 @@ inline Color3f TextureLookup( const FrameBuffer& texture, float u, float v, bool
 
     const float scaled_u = u*tw;
     const float scaled_v = flip_v ? th - v*th : v*th;
-    return texture.Color(scaled_u,scaled_v);
+    //u or v of exactly 0 or 1 would land one texel past the edge
+    return texture.Color(std::min(static_cast<std::int32_t>(scaled_u), tw-1), std::min(static_cast<std::int32_t>(scaled_v), th-1));
+}
+
+//Same as above, for a block-compressed texture. The texel is decoded from its block on the fly.
+inline Color3f TextureLookup( const CompressedTexture& texture, float u, float v, bool flip_v = true) {
+    assert(u>=0 && u<=1.f);
+    assert(v>=0 && v<=1.f);
+
+    const auto tw{texture.width};
+    const auto th{texture.height};
+
+    const float scaled_u = u*tw;
+    const float scaled_v = flip_v ? th - v*th : v*th;
+    return texture.Color(std::min(static_cast<std::int32_t>(scaled_u), tw-1), std::min(static_cast<std::int32_t>(scaled_v), th-1));
+}
+
+/// @brief A non-owning reference to a texture in any of the supported storage formats.
+/// @brief Converts implicitly from either kind of texture, so drawing functions accept both.
+class TextureRef {
+public:
+    TextureRef() = default;
+    TextureRef(const FrameBuffer& texture) : uncompressed_{&texture} {}
+    TextureRef(const CompressedTexture& texture) : compressed_{&texture} {}
+
+    [[nodiscard]] bool Empty() const noexcept { return !uncompressed_ && !compressed_; }
+
+    //Whether both refer to the same texture
+    [[nodiscard]] bool operator==(const TextureRef&) const noexcept = default;
+
+    [[nodiscard]] Color3f Lookup(float u, float v) const {
+        assert(!Empty());
+        return compressed_ ? TextureLookup(*compressed_, u, v) : TextureLookup(*uncompressed_, u, v);
+    }
+
+private:
+    const FrameBuffer* uncompressed_{nullptr};
+    const CompressedTexture* compressed_{nullptr};
+};
+
+inline Color3f TextureLookup(const TextureRef& texture, float u, float v) {
+    return texture.Lookup(u, v);
 }
 
 // using Uniform = std::variant<float, Vec2f, Vec3f, Norm3f, Mat4f>; //Contains all the possible types of a uniform variable
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include <cura/bounds.h>
+#include <cura/buffer.h>
+#include <cura/camera.h>
+#include <cura/light.h>
+#include <cura/math.h>
+#include <cura/model.h>
+#include <cura/scene.h>
+#include <cura/thread_pool.h>
+#include <cura/transforms.h>
+
+/// @brief Depth of a scene as seen from a distant light.
+/// @brief Depths are light-space z values (the light looks down -z), so as in the main pass a greater depth is closer.
+struct ShadowMap {
+    std::int32_t size{0};
+    std::vector<float> depths; //size*size texels, top-left origin
+    Mat44f light_view;         //World-to-light matrix (a pure rotation)
+    Mat44f light_projection;   //Orthographic light-to-clip matrix fitted around the scene
+    float texel_world_size{0.f}; //Width of one texel in world units, used to scale the depth bias
+
+    [[nodiscard]] float& Depth(std::int32_t x, std::int32_t y) { return depths[y*size + x]; }
+    [[nodiscard]] float Depth(std::int32_t x, std::int32_t y) const { return depths[y*size + x]; }
+
+    //Maps a world-space point to (texel x, texel y, light depth)
+    [[nodiscard]] Vec3f Project(const Vec3f& world) const {
+        const auto light = la::mul(light_view, Vec4f(world,1.f));
+        const auto clip = la::mul(light_projection, light);
+        return Vec3f{(clip.x+1.f)*size/2.f, (-clip.y+1.f)*size/2.f, light.z};
+    }
+};
+
+
+/// @brief Depth-only rasterization of one triangle, for shadow maps and depth pre-passes.
+/// @brief Compared with DrawTriangle there is no attribute interpolation, no texture lookup and no color write: edge functions and
+/// @brief depth are stepped incrementally and depth is interpolated linearly (exact for orthographic projections).
+/// @brief Both windings are rasterized. Pixels are sampled at their centers.
+/// @param v0,v1,v2 Vertices in (pixel x, pixel y, depth). Greater depth wins.
+/// @param y0,y1 Rows [y0,y1) that may be written.
+inline void DrawDepthTriangle(Vec3f v0, Vec3f v1, Vec3f v2, std::span<float> depths, std::int32_t width, std::int32_t y0, std::int32_t y1) {
+    //Degenerate projections can produce huge or non-finite coordinates, which would overflow the conversions below
+    const auto finite = [](const Vec3f& v) { return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z); };
+    if(!finite(v0) || !finite(v1) || !finite(v2)) return;
+
+    auto area = la::cross(v1.xy() - v0.xy(), v2.xy() - v0.xy());
+    if(area==0.f || !std::isfinite(area)) return;
+    if(area<0.f) {
+        std::swap(v1, v2);
+        area = -area;
+    }
+
+    const auto lo_x = std::floor(std::min({v0.x, v1.x, v2.x}));
+    const auto hi_x = std::ceil(std::max({v0.x, v1.x, v2.x}));
+    const auto lo_y = std::floor(std::min({v0.y, v1.y, v2.y}));
+    const auto hi_y = std::ceil(std::max({v0.y, v1.y, v2.y}));
+    if(hi_x < 0.f || lo_x > width-1 || hi_y < y0 || lo_y > y1-1) return;
+
+    //Clamp while still floats, then convert
+    const auto min_x = static_cast<std::int32_t>(std::max(lo_x, 0.f));
+    const auto max_x = static_cast<std::int32_t>(std::min(hi_x, static_cast<float>(width-1)));
+    const auto min_y = static_cast<std::int32_t>(std::max(lo_y, static_cast<float>(y0)));
+    const auto max_y = static_cast<std::int32_t>(std::min(hi_y, static_cast<float>(y1-1)));
+
+    //Edge function e(p) = cross(b-a, p-a) changes by (a.y-b.y) per pixel in x and (b.x-a.x) per pixel in y
+    const auto edge = [](const Vec3f& a, const Vec3f& b, float px, float py) { return (b.x-a.x)*(py-a.y) - (b.y-a.y)*(px-a.x); };
+    const float px = min_x + 0.5f;
+    const float py = min_y + 0.5f;
+    float row_w0 = edge(v1, v2, px, py);
+    float row_w1 = edge(v2, v0, px, py);
+    float row_w2 = edge(v0, v1, px, py);
+    const float dx0 = v1.y-v2.y, dy0 = v2.x-v1.x;
+    const float dx1 = v2.y-v0.y, dy1 = v0.x-v2.x;
+    const float dx2 = v0.y-v1.y, dy2 = v1.x-v0.x;
+
+    //Depth is an affine function of the edge values
+    const float z0 = v0.z/area, z1 = v1.z/area, z2 = v2.z/area;
+    const float dzdx = dx0*z0 + dx1*z1 + dx2*z2;
+
+    for(auto y = min_y; y <= max_y; ++y) {
+        float w0 = row_w0, w1 = row_w1, w2 = row_w2;
+        float z = w0*z0 + w1*z1 + w2*z2;
+        float* row = depths.data() + static_cast<std::size_t>(y)*width;
+        for(auto x = min_x; x <= max_x; ++x) {
+            if(w0>=0.f && w1>=0.f && w2>=0.f && z>row[x]) row[x] = z;
+            w0 += dx0; w1 += dx1; w2 += dx2;
+            z += dzdx;
+        }
+        row_w0 += dy0; row_w1 += dy1; row_w2 += dy2;
+    }
+}
+
+
+/// @brief Renders the depth of every object of a scene from a distant light.
+/// @brief The orthographic projection is fitted to the scene's bounds in light space, so the whole scene casts and receives shadows.
+/// @param size Width and height of the shadow map in texels.
+[[nodiscard]] inline ShadowMap RenderShadowMap(const Scene& scene, const DistantLight& light, std::int32_t size, ThreadPool& pool) {
+    ShadowMap map;
+    map.size = size;
+    map.depths.assign(static_cast<std::size_t>(size)*size, std::numeric_limits<float>::lowest());
+
+    //Rotate the world so that the light looks down -z. The eye is at the origin, which avoids any translation.
+    const auto dir = la::normalize(light.Direction);
+    const Vec3f up = std::abs(dir.y) > 0.99f ? Vec3f{1.f,0.f,0.f} : Vec3f{0.f,1.f,0.f};
+    map.light_view = LookAt(Vec3f{0.f,0.f,0.f}, dir, up);
+
+    auto bounds = scene.Bounds().Transformed(map.light_view);
+    if(bounds.Empty()) {
+        map.light_projection = Mat44f{la::identity};
+        return map;
+    }
+    //A flat scene has no extent along some axis (e.g. a floor lit from straight above has none in depth), which would divide by zero
+    //in the projection. Widen such axes around their center to a small fraction of the largest extent.
+    const auto extent = bounds.Extent();
+    const auto center = bounds.Center();
+    const auto min_extent = 1e-3f*std::max({extent.x, extent.y, extent.z, 1.f});
+    for(int axis = 0; axis < 3; ++axis) {
+        if(extent[axis] >= min_extent) continue;
+        bounds.min[axis] = center[axis] - 0.5f*min_extent;
+        bounds.max[axis] = center[axis] + 0.5f*min_extent;
+    }
+    map.light_projection = OrthographicProjection(bounds.min.x, bounds.max.x, bounds.min.y, bounds.max.y, bounds.max.z, bounds.min.z);
+    map.texel_world_size = std::max(bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y)/size;
+
+    //Transform every triangle into shadow-map space once
+    const auto& objects = scene.Objects();
+    std::vector<std::vector<Vec3f>> triangles(objects.size());
+    pool.ParallelFor(0, static_cast<std::int32_t>(objects.size()), [&](std::int32_t i) {
+        const auto& object = objects[i];
+        const auto& vertices = object.model->Vertices();
+        std::vector<Vec3f> projected(vertices.size());
+        for(std::size_t v = 0; v < vertices.size(); ++v) {
+            projected[v] = map.Project(la::mul(object.transform, Vec4f(vertices[v],1.f)).xyz());
+        }
+        auto& out = triangles[i];
+        out.reserve(3*object.model->Faces().size());
+        for(const auto& face : object.model->Faces()) {
+            for(int k = 0; k < 3; ++k) out.push_back(projected[face.pos_idx[k]]);
+        }
+    });
+
+    //Rasterize in horizontal bands so that threads never write the same texels
+    constexpr std::int32_t kband_rows{32};
+    const auto bands = (size + kband_rows - 1)/kband_rows;
+    pool.ParallelFor(0, bands, [&](std::int32_t band) {
+        const auto y0 = band*kband_rows;
+        const auto y1 = std::min(y0 + kband_rows, size);
+        for(const auto& tris : triangles) {
+            for(std::size_t t = 0; t < tris.size(); t += 3) {
+                if(std::max({tris[t].y, tris[t+1].y, tris[t+2].y}) < y0) continue;
+                if(std::min({tris[t].y, tris[t+1].y, tris[t+2].y}) >= y1) continue;
+                DrawDepthTriangle(tris[t], tris[t+1], tris[t+2], map.depths, size, y0, y1);
+            }
+        }
+    });
+    return map;
+}
+
+/// @brief Keeps the last rendered shadow map and only re-renders it when the light, the scene geometry or the size changes.
+class ShadowMapCache {
+public:
+    const ShadowMap& Get(const Scene& scene, const DistantLight& light, std::int32_t size, ThreadPool& pool) {
+        const bool stale = !map_ || scene_!=&scene || revision_!=scene.Revision() || direction_!=light.Direction || map_->size!=size;
+        if(stale) {
+            map_ = RenderShadowMap(scene, light, size, pool);
+            scene_ = &scene;
+            revision_ = scene.Revision();
+            direction_ = light.Direction;
+        }
+        return *map_;
+    }
+
+    void Invalidate() noexcept { map_.reset(); }
+
+private:
+    std::optional<ShadowMap> map_;
+    const Scene* scene_{nullptr};
+    std::uint64_t revision_{0};
+    Vec3f direction_{0.f,0.f,0.f};
+};
+
+
+/// @brief Fraction of a world-space point that is lit by the light of a shadow map.
+/// @param pcf_radius Radius (in texels) of the percentage-closer filter. 0 takes a single sample.
+[[nodiscard]] inline float ShadowVisibility(const ShadowMap& map, const Vec3f& world, std::int32_t pcf_radius = 1) {
+    const auto p = map.Project(world);
+    //Surfaces at a slope to the light change depth by several texel widths across one texel; without a bias they shadow themselves ('acne')
+    const auto bias = 4.f*map.texel_world_size;
+    const auto cx = static_cast<std::int32_t>(std::floor(p.x));
+    const auto cy = static_cast<std::int32_t>(std::floor(p.y));
+
+    std::int32_t lit = 0;
+    std::int32_t taps = 0;
+    for(auto y = cy - pcf_radius; y <= cy + pcf_radius; ++y) {
+        for(auto x = cx - pcf_radius; x <= cx + pcf_radius; ++x) {
+            ++taps;
+            //Anything outside the map is outside the scene bounds and so cannot be occluded
+            if(x<0 || y<0 || x>=map.size || y>=map.size || p.z + bias >= map.Depth(x,y)) ++lit;
+        }
+    }
+    return static_cast<float>(lit)/static_cast<float>(taps);
+}
+
+/// @brief Darkens the shadowed pixels of a rendered image.
+/// @brief The world position of each covered pixel is reconstructed from its depth (camera-space z, as written by DrawTriangle),
+/// @brief looked up in the shadow map, and the color is scaled between the light's ambient term (fully shadowed) and 1 (fully lit).
+/// @brief Multisampled images must be resolved first.
+/// @param view World-to-camera matrix used for the main pass.
+/// @param projection Camera-to-clip matrix used for the main pass.
+inline void ApplyShadows(FrameBuffer& image, const Mat44f& view, const Mat44f& projection, const ShadowMap& map, const DistantLight& light, std::int32_t pcf_radius, ThreadPool& pool) {
+    assert(image.samples==1 && "Error: resolve a multisampled image before applying shadows!");
+    const auto inv_view = la::inverse(view);
+
+    pool.ParallelFor(0, image.height, [&](std::int32_t y) {
+        for(std::int32_t x = 0; x < image.width; ++x) {
+            if(image.Cleared(x,y)) continue; //Background that was never drawn to
+            const auto z = image.Depth(x,y);
+            if(z==std::numeric_limits<float>::lowest()) continue; //Background
+
+            //Undo the viewport transform (for the pixel center) and the projection for a point whose camera-space depth is known
+            const auto ndc_x = 2.f*(x+0.5f)/image.width - 1.f;
+            const auto ndc_y = 1.f - 2.f*(y+0.5f)/image.height;
+            const auto w = projection[2][3]*z + projection[3][3];
+            const auto cam_x = (ndc_x*w - projection[2][0]*z - projection[3][0])/projection[0][0];
+            const auto cam_y = (ndc_y*w - projection[2][1]*z - projection[3][1])/projection[1][1];
+            const auto world = la::mul(inv_view, Vec4f(cam_x, cam_y, z, 1.f)).xyz();
+
+            const auto visibility = ShadowVisibility(map, world, pcf_radius);
+            image.Color(x,y) *= light.Ambient + visibility*(Color3f(1.f,1.f,1.f) - light.Ambient);
+        }
+    });
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//Stream sockets for the line-based protocols of the render server and the distributed renderer. An address is either the path of a
+//Unix domain socket (anything containing '/') or "host:port" for TCP. Functions return -1 on failure and report it on std::cerr.
+
+namespace socket_detail {
+
+//Splits "host:port". An empty host means the local host. Listening on every interface takes an explicit "0.0.0.0:port" or "[::]:port".
+inline bool SplitHostPort(std::string_view address, std::string& host, std::string& port) {
+    const auto colon = address.rfind(':');
+    if(colon==std::string_view::npos || colon + 1==address.size()) return false;
+    host = std::string(address.substr(0, colon));
+    if(host.size() >= 2 && host.front()=='[' && host.back()==']') host = host.substr(1, host.size() - 2); //IPv6 literal
+    port = std::string(address.substr(colon + 1));
+    return true;
+}
+
+[[nodiscard]] inline bool IsUnixPath(std::string_view address) { return address.find('/')!=std::string_view::npos; }
+
+[[nodiscard]] inline bool FillUnixAddress(std::string_view path, sockaddr_un& address) {
+    address = sockaddr_un{};
+    address.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(address.sun_path)) {
+        std::cerr<<"Error: socket path too long\n";
+        return false;
+    }
+    std::copy(path.begin(), path.end(), address.sun_path);
+    return true;
+}
+
+} //namespace socket_detail
+
+/// @brief Listens on 'address'. A Unix socket replaces any file at its path.
+/// @return The listening socket, or -1.
+[[nodiscard]] inline int ListenOn(std::string_view address, int backlog = 16) {
+    using namespace socket_detail;
+    if(IsUnixPath(address)) {
+        sockaddr_un unix_address;
+        if(!FillUnixAddress(address, unix_address)) return -1;
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0) {
+            std::cerr<<"Error creating socket\n";
+            return -1;
+        }
+        ::unlink(unix_address.sun_path);
+        if(::bind(fd, reinterpret_cast<const sockaddr*>(&unix_address), sizeof(unix_address))!=0 || ::listen(fd, backlog)!=0) {
+            std::cerr<<"Error listening on "<<address<<"\n";
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    std::string host, port;
+    if(!SplitHostPort(address, host, port)) {
+        std::cerr<<"Error: expected a socket path or host:port, got "<<address<<"\n";
+        return -1;
+    }
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* results = nullptr;
+    if(::getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints, &results)!=0) {
+        std::cerr<<"Error resolving "<<address<<"\n";
+        return -1;
+    }
+    int fd = -1;
+    for(auto* r = results; r && fd < 0; r = r->ai_next) {
+        fd = ::socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+        if(fd < 0) continue;
+        const int reuse = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if(::bind(fd, r->ai_addr, r->ai_addrlen)!=0 || ::listen(fd, backlog)!=0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    ::freeaddrinfo(results);
+    if(fd < 0) std::cerr<<"Error listening on "<<address<<"\n";
+    return fd;
+}
+
+/// @brief Connects to a socket listening on 'address'.
+/// @return The connected socket, or -1.
+[[nodiscard]] inline int ConnectTo(std::string_view address) {
+    using namespace socket_detail;
+    if(IsUnixPath(address)) {
+        sockaddr_un unix_address;
+        if(!FillUnixAddress(address, unix_address)) return -1;
+        const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd >= 0 && ::connect(fd, reinterpret_cast<const sockaddr*>(&unix_address), sizeof(unix_address))==0) return fd;
+        if(fd >= 0) ::close(fd);
+        std::cerr<<"Error connecting to "<<address<<"\n";
+        return -1;
+    }
+
+    std::string host, port;
+    if(!SplitHostPort(address, host, port)) {
+        std::cerr<<"Error: expected a socket path or host:port, got "<<address<<"\n";
+        return -1;
+    }
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* results = nullptr;
+    if(::getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints, &results)!=0) {
+        std::cerr<<"Error resolving "<<address<<"\n";
+        return -1;
+    }
+    int fd = -1;
+    for(auto* r = results; r && fd < 0; r = r->ai_next) {
+        fd = ::socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+        if(fd < 0) continue;
+        if(::connect(fd, r->ai_addr, r->ai_addrlen)!=0) {
+            ::close(fd);
+            fd = -1;
+            continue;
+        }
+        //Requests and replies are single lines; send them without waiting to coalesce
+        const int nodelay = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    }
+    ::freeaddrinfo(results);
+    if(fd < 0) std::cerr<<"Error connecting to "<<address<<"\n";
+    return fd;
+}
+
+//Writes all of 'data'. Returns false if the peer has gone. Never raises SIGPIPE where the platform allows avoiding it.
+inline bool SendAll(int fd, std::string_view data) {
+    #ifdef MSG_NOSIGNAL
+    constexpr int kflags{MSG_NOSIGNAL};
+    #else
+    constexpr int kflags{0};
+    #endif
+    for(std::size_t sent = 0; sent < data.size();) {
+        const auto n = ::send(fd, data.data() + sent, data.size() - sent, kflags);
+        if(n <= 0) return false;
+        sent += static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+//Makes blocking sends and receives on 'fd' give up after 'timeout' without progress. Zero waits forever.
+inline bool SetTimeout(int fd, std::chrono::milliseconds timeout) {
+    timeval tv{};
+    tv.tv_sec = static_cast<decltype(tv.tv_sec)>(timeout.count()/1000);
+    tv.tv_usec = static_cast<decltype(tv.tv_usec)>(timeout.count()%1000*1000);
+    return ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))==0 && ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv))==0;
+}
+
+/// @brief Reads newline-terminated lines from a socket, buffering what arrives past the end of a line.
+class LineReader {
+public:
+    explicit LineReader(int fd) : fd_{fd} {}
+
+    //Reads the next line, without its newline. Returns false once the peer has closed the connection, it failed, or it timed out.
+    bool ReadLine(std::string& line) {
+        timed_out_ = false;
+        for(;;) {
+            if(const auto end = buffer_.find('\n', scanned_); end!=std::string::npos) {
+                line.assign(buffer_, 0, end);
+                buffer_.erase(0, end + 1);
+                scanned_ = 0;
+                return true;
+            }
+            scanned_ = buffer_.size();
+            char chunk[65536];
+            const auto n = ::recv(fd_, chunk, sizeof(chunk), 0);
+            if(n <= 0) {
+                timed_out_ = n < 0 && (errno==EAGAIN || errno==EWOULDBLOCK);
+                return false;
+            }
+            buffer_.append(chunk, static_cast<std::size_t>(n));
+        }
+    }
+
+    //Whether the last ReadLine() failed because nothing arrived within the socket's timeout (see SetTimeout)
+    [[nodiscard]] bool TimedOut() const noexcept { return timed_out_; }
+
+private:
+    int fd_;
+    bool timed_out_{false};
+    std::string buffer_;
+    std::size_t scanned_{0}; //Bytes of buffer_ known to hold no newline
+};
+
+#endif
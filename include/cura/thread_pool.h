@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/// @brief A fixed-size, work-stealing pool of worker threads.
+/// @brief Shared by everything that renders in parallel so that the number of threads never exceeds the core count.
+/// @brief Tasks submitted from outside the pool go to a shared queue and start in FIFO order. Tasks submitted by a task go to its
+/// @brief worker's own queue, which the worker runs newest first (the data they touch is likely still in its cache); idle workers
+/// @brief steal the oldest task from other workers' queues. So nested work, like the helpers of a ParallelFor inside a task, spreads
+/// @brief over idle workers without every push and pop contending on one lock.
+class ThreadPool {
+public:
+    explicit ThreadPool(std::size_t thread_count = std::max(1u, std::thread::hardware_concurrency())) {
+        //One queue per worker, and the shared queue last
+        for(std::size_t i = 0; i <= thread_count; ++i) {
+            queues_.push_back(std::make_unique<WorkQueue>());
+        }
+        for(std::size_t i = 0; i < thread_count; ++i) {
+            workers_.emplace_back([this, i]{ WorkerLoop(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    //Finishes all queued tasks before joining the workers
+    ~ThreadPool() {
+        {
+            std::scoped_lock lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for(auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    [[nodiscard]] std::size_t Size() const noexcept {return workers_.size();}
+
+    /// @brief Queues a task for execution on one of the workers.
+    /// @return A future holding the result of the task (or the exception it threw).
+    template<typename F>
+    [[nodiscard]] std::future<std::invoke_result_t<F>> Submit(F&& f) {
+        using R = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        auto result = task->get_future();
+        Push([task]{ (*task)(); });
+        return result;
+    }
+
+    /// @brief Runs body(i) for every i in [begin,end), spread over the workers and the calling thread.
+    /// @brief The calling thread takes part in the loop, so it is safe to call from inside a task running on this pool.
+    /// @brief If body throws, the indices not yet started are skipped and, once every running call has returned, the first exception
+    /// @brief is rethrown on the calling thread.
+    void ParallelFor(std::int32_t begin, std::int32_t end, const std::function<void(std::int32_t)>& body) {
+        if(begin>=end) return;
+
+        //Shared between the caller and the helpers. Helpers that start after the loop has finished simply find no work left.
+        struct LoopState {
+            std::atomic<std::int32_t> next;
+            std::atomic<std::int32_t> remaining;
+            std::int32_t end;
+            const std::function<void(std::int32_t)>* body;
+            std::mutex mutex;
+            std::condition_variable done;
+            std::atomic<bool> failed{false};
+            std::exception_ptr error; //The first exception thrown by body, guarded by mutex
+        };
+        auto state = std::make_shared<LoopState>();
+        state->next = begin;
+        state->remaining = end - begin;
+        state->end = end;
+        state->body = &body;
+
+        auto run = [](LoopState& s) {
+            for(auto i = s.next++; i < s.end; i = s.next++) {
+                //Every index is still counted down after a failure, so that the caller does not return while a helper uses body
+                if(!s.failed) {
+                    try {
+                        (*s.body)(i);
+                    }
+                    catch(...) {
+                        std::scoped_lock lock(s.mutex);
+                        if(!s.error) s.error = std::current_exception();
+                        s.failed = true;
+                    }
+                }
+                if(--s.remaining == 0) {
+                    std::scoped_lock lock(s.mutex);
+                    s.done.notify_all();
+                }
+            }
+        };
+
+        const auto helpers = std::min<std::size_t>(workers_.size(), static_cast<std::size_t>(end - begin - 1));
+        for(std::size_t i = 0; i < helpers; ++i) {
+            Push([state, run]{ run(*state); });
+        }
+
+        run(*state);
+        std::unique_lock lock(state->mutex);
+        state->done.wait(lock, [&]{ return state->remaining == 0; });
+        //Moved out so that the exception is released on this thread, not by whichever helper drops the last reference to the state
+        if(auto error = std::move(state->error)) {
+            lock.unlock();
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    //The pool and queue index of the worker running on this thread, if any
+    struct WorkerIdentity {
+        const ThreadPool* pool{nullptr};
+        std::size_t index{0};
+    };
+    static WorkerIdentity& CurrentWorker() {
+        thread_local WorkerIdentity identity;
+        return identity;
+    }
+
+    //queues_ is complete before any worker starts, unlike workers_
+    [[nodiscard]] std::size_t SharedQueue() const noexcept { return queues_.size() - 1; }
+
+    void Push(std::function<void()> task) {
+        const auto& worker = CurrentWorker();
+        auto& queue = *queues_[worker.pool==this ? worker.index : SharedQueue()];
+        //Counted before it can be popped, so the count never drops below zero. It is counted before taking mutex_, so a worker checking
+        //for work under mutex_ either sees it or gets the notification.
+        ++queued_;
+        {
+            std::scoped_lock lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::scoped_lock lock(mutex_);
+        }
+        cv_.notify_one();
+    }
+
+    //Takes the newest task of the worker's own queue, else the oldest of the shared queue, else steals the oldest of another worker's.
+    [[nodiscard]] bool Pop(std::size_t index, std::function<void()>& task) {
+        const auto take = [&](std::size_t q, bool newest) {
+            auto& queue = *queues_[q];
+            std::scoped_lock lock(queue.mutex);
+            if(queue.tasks.empty()) return false;
+            if(newest) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            return true;
+        };
+        if(take(index, true) || take(SharedQueue(), false)) return true;
+        for(std::size_t i = 1; i < SharedQueue(); ++i) {
+            if(take((index + i)%SharedQueue(), false)) return true;
+        }
+        return false;
+    }
+
+    void WorkerLoop(std::size_t index) {
+        CurrentWorker() = WorkerIdentity{this, index};
+        for(;;) {
+            std::function<void()> task;
+            if(Pop(index, task)) {
+                --queued_;
+                task();
+                continue;
+            }
+            std::unique_lock lock(mutex_);
+            cv_.wait(lock, [this]{ return stopping_ || queued_ > 0; });
+            if(stopping_ && queued_==0) return;
+        }
+    }
+
+private:
+    std::vector<std::thread> workers_;
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::atomic<std::size_t> queued_{0}; //Tasks in all queues
+    std::mutex mutex_;                   //Guards sleeping and waking only
+    std::condition_variable cv_;
+    bool stopping_{false};
+};
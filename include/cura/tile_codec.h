@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//Compression of 8-bit RGB pixels for shipping rendered regions between processes. Rendered images have long runs of identical pixels
+//(background, flat texels magnified across several pixels), so a run-length code over whole pixels shrinks them cheaply. The result is
+//base64-encoded so that it can travel inside a JSON string.
+
+/// @brief Run-length codes RGB pixels. Each packet starts with a byte h: h < 128 is followed by h+1 literal pixels, h >= 128 by one pixel
+/// @brief repeated h-126 times (2 to 129).
+[[nodiscard]] inline std::string EncodePixelRuns(std::span<const std::uint8_t> rgb) {
+    const auto count = rgb.size()/3;
+    const auto same = [&](std::size_t a, std::size_t b) { return rgb[3*a]==rgb[3*b] && rgb[3*a+1]==rgb[3*b+1] && rgb[3*a+2]==rgb[3*b+2]; };
+    std::string out;
+    std::size_t i = 0;
+    while(i < count) {
+        //A run of at least two identical pixels
+        auto run = std::size_t{1};
+        while(i + run < count && run < 129 && same(i, i + run)) ++run;
+        if(run >= 2) {
+            out += static_cast<char>(run + 126);
+            out.append(reinterpret_cast<const char*>(&rgb[3*i]), 3);
+            i += run;
+            continue;
+        }
+        //Literals up to the start of the next run
+        auto literal = std::size_t{1};
+        while(i + literal < count && literal < 128 && !(i + literal + 1 < count && same(i + literal, i + literal + 1))) ++literal;
+        out += static_cast<char>(literal - 1);
+        out.append(reinterpret_cast<const char*>(&rgb[3*i]), 3*literal);
+        i += literal;
+    }
+    return out;
+}
+
+//Inverse of EncodePixelRuns. Returns nullopt if the data is malformed or does not decode to exactly 'pixels' pixels.
+[[nodiscard]] inline std::optional<std::vector<std::uint8_t>> DecodePixelRuns(std::string_view data, std::size_t pixels) {
+    std::vector<std::uint8_t> rgb;
+    rgb.reserve(3*pixels);
+    std::size_t i = 0;
+    while(i < data.size()) {
+        const auto h = static_cast<std::uint8_t>(data[i++]);
+        const auto repeat = h >= 128;
+        const std::size_t n = repeat ? h - 126u : h + 1u;
+        const auto bytes = repeat ? std::size_t{3} : 3*n;
+        if(i + bytes > data.size() || rgb.size() + 3*n > 3*pixels) return std::nullopt;
+        if(repeat) {
+            for(std::size_t k = 0; k < n; ++k) rgb.insert(rgb.end(), data.begin() + i, data.begin() + i + 3);
+        }
+        else {
+            rgb.insert(rgb.end(), data.begin() + i, data.begin() + i + bytes);
+        }
+        i += bytes;
+    }
+    if(rgb.size()!=3*pixels) return std::nullopt;
+    return rgb;
+}
+
+[[nodiscard]] inline std::string EncodeBase64(std::string_view data) {
+    constexpr std::string_view kalphabet{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
+    std::string out;
+    out.reserve((data.size() + 2)/3*4);
+    for(std::size_t i = 0; i < data.size(); i += 3) {
+        const auto remaining = data.size() - i;
+        std::uint32_t bits = static_cast<std::uint8_t>(data[i]) << 16;
+        if(remaining > 1) bits |= static_cast<std::uint8_t>(data[i+1]) << 8;
+        if(remaining > 2) bits |= static_cast<std::uint8_t>(data[i+2]);
+        out += kalphabet[(bits >> 18) & 63];
+        out += kalphabet[(bits >> 12) & 63];
+        out += remaining > 1 ? kalphabet[(bits >> 6) & 63] : '=';
+        out += remaining > 2 ? kalphabet[bits & 63] : '=';
+    }
+    return out;
+}
+
+//Returns nullopt if 'text' is not padded base64.
+[[nodiscard]] inline std::optional<std::string> DecodeBase64(std::string_view text) {
+    constexpr auto kvalues = [] {
+        std::array<std::int8_t,256> v{};
+        v.fill(-1);
+        constexpr std::string_view kalphabet{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
+        for(std::size_t i = 0; i < kalphabet.size(); ++i) v[static_cast<std::uint8_t>(kalphabet[i])] = static_cast<std::int8_t>(i);
+        return v;
+    }();
+    if(text.size()%4!=0) return std::nullopt;
+    std::string out;
+    out.reserve(text.size()/4*3);
+    for(std::size_t i = 0; i < text.size(); i += 4) {
+        const auto last = i + 4==text.size();
+        const auto padding = last ? (text[i+3]=='=') + (text[i+2]=='=' && text[i+3]=='=') : 0;
+        std::uint32_t bits = 0;
+        for(std::size_t k = 0; k < 4; ++k) {
+            const auto v = k >= 4u - padding ? 0 : kvalues[static_cast<std::uint8_t>(text[i+k])];
+            if(v < 0) return std::nullopt;
+            bits = bits << 6 | static_cast<std::uint32_t>(v);
+        }
+        out += static_cast<char>(bits >> 16);
+        if(padding < 2) out += static_cast<char>(bits >> 8);
+        if(padding < 1) out += static_cast<char>(bits);
+    }
+    return out;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cmath>
 
 #include <cura/math.h>
 
@@ -33,6 +34,13 @@
 }
 
 
+/// @brief Recovers the world-space position of the viewer from a view (or model-view) matrix.
+/// @brief This is the point that the matrix maps to the origin, so it is correct even if the matrix was not built by LookAt.
+[[nodiscard]] inline Vec3f ViewPosition(const Mat44f& view) {
+    return la::mul(la::inverse(view), Vec4f(0.f,0.f,0.f,1.f)).xyz();
+}
+
+
 /// @brief Constructs an orthographic projection matrix
 /// @brief Assumes that the viewer oriented in a right-handed coordinate system, looking towards the -z direction, with the y axis pointing up. 
 /// @param l x-coordinate of left plane
@@ -78,6 +86,29 @@
 
 
 
+/// @brief Constructs a reverse-Z perspective projection matrix: NDC depth is 1 at the near plane and falls to 0 at the far plane.
+/// @brief Floats are densest near 0, and 1/z falls off fastest near the camera, so the two roughly cancel: depth precision is close to
+/// @brief uniform in log(distance) instead of collapsing towards the far plane. Pair it with a greater-wins test and a depth buffer cleared to 0.
+/// @param vfov vertical field-of-view in radians
+/// @param near z-coordinate of near plane (< 0)
+/// @param far z-coordinate of far plane (< near), or -infinity for an infinite far plane
+/// @return Matrix representing the associated projection
+[[nodiscard]] inline Mat44f ReverseZPerspectiveProjection(float vfov, float aspect, float near, float far)
+{
+    //With w = -z, NDC depth is -a - b/z. Solving for 1 at z=near and 0 at z=far gives a = -near/(near-far), b = near*far/(near-far),
+    //which tend to 0 and -near as far goes to -infinity.
+    const float f = 1.f / std::tan(0.5f * vfov);
+    const float a = std::isinf(far) ? 0.f : -near/(near-far);
+    const float b = std::isinf(far) ? -near : near*far/(near-far);
+    return Mat44f{
+        {f/aspect,     0.f,  0.f,  0.f},
+        {0.f,          f,    0.f,  0.f},
+        {0.f,          0.f,  a,   -1.f},
+        {0.f,          0.f,  b,    0.f}
+        };
+}
+
+
 // /// @brief Applies the viewport transform 
 // /// @param ndc_coords Coordinates inside the unit cube [-1,1]
 // /// @param im_height 
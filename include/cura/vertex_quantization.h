@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numbers>
+#include <span>
+#include <vector>
+
+#include <cura/bounds.h>
+#include <cura/math.h>
+#include <cura/model.h>
+#include <cura/vertex_stream.h>
+
+//Compact vertex formats, decoded in the vertex stage:
+//- positions as 16-bit unsigned integers relative to the model's bounding box (6 bytes instead of 12)
+//- normals octahedral-encoded into two 16-bit signed integers (4 bytes instead of 12)
+//- texture coordinates as half floats (4 bytes instead of 8)
+
+inline constexpr float kPositionQuantizationSteps{65535.f};
+
+//Rounds a float to the nearest half float (IEEE 754 binary16), ties to even. Values beyond the half range become infinity.
+[[nodiscard]] inline std::uint16_t FloatToHalf(float f) {
+    const auto bits = std::bit_cast<std::uint32_t>(f);
+    const auto sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000u);
+    const auto abs = bits & 0x7fffffffu;
+
+    if(abs >= 0x7f800000u) return static_cast<std::uint16_t>(sign | 0x7c00u | (abs > 0x7f800000u ? 0x200u : 0u)); //Inf, NaN
+    if(abs >= 0x477ff000u) return static_cast<std::uint16_t>(sign | 0x7c00u); //Rounds to above the largest half
+
+    if(abs < 0x38800000u) {
+        //Subnormal half (or zero): shift the mantissa, with its implicit bit, into place and round
+        if(abs < 0x33000000u) return sign; //Below half the smallest subnormal
+        const auto exponent = abs >> 23;
+        const auto mantissa = (abs & 0x7fffffu) | 0x800000u;
+        const auto shift = 126u - exponent; //14..24
+        auto half = mantissa >> shift;
+        const auto remainder = mantissa & ((1u << shift) - 1u);
+        const auto halfway = 1u << (shift - 1u);
+        if(remainder > halfway || (remainder==halfway && (half & 1u))) ++half;
+        return static_cast<std::uint16_t>(sign | half);
+    }
+
+    //Normal half: rebias the exponent and round the mantissa from 23 to 10 bits. A carry correctly bumps the exponent.
+    auto half = ((abs - 0x38000000u) >> 13);
+    const auto remainder = abs & 0x1fffu;
+    if(remainder > 0x1000u || (remainder==0x1000u && (half & 1u))) ++half;
+    return static_cast<std::uint16_t>(sign | half);
+}
+
+[[nodiscard]] inline float HalfToFloat(std::uint16_t h) {
+    const auto sign = static_cast<std::uint32_t>(h & 0x8000u) << 16;
+    const auto exponent = (h >> 10) & 0x1fu;
+    const auto mantissa = static_cast<std::uint32_t>(h & 0x3ffu);
+    if(exponent==0) {
+        //Zero or subnormal: mantissa * 2^-24
+        const auto magnitude = static_cast<float>(mantissa)*(1.f/16777216.f);
+        return sign ? -magnitude : magnitude;
+    }
+    if(exponent==31) return std::bit_cast<float>(sign | 0x7f800000u | (mantissa << 13));
+    return std::bit_cast<float>(sign | ((exponent + 112u) << 23) | (mantissa << 13));
+}
+
+/// @brief Maps a unit vector onto the octahedron |x|+|y|+|z| = 1 and unfolds that onto the square [-1,1]^2, stored as two snorm16 values.
+/// @brief Unlike storing x and y and reconstructing z, the precision is spread evenly over the sphere.
+[[nodiscard]] inline std::array<std::int16_t,2> EncodeOctahedral(const Norm3f& n) {
+    const auto l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    auto x = n.x/l1;
+    auto y = n.y/l1;
+    if(n.z < 0.f) {
+        //Fold the lower hemisphere over the diagonals
+        const auto fx = (1.f - std::abs(y))*(x >= 0.f ? 1.f : -1.f);
+        const auto fy = (1.f - std::abs(x))*(y >= 0.f ? 1.f : -1.f);
+        x = fx;
+        y = fy;
+    }
+    const auto snorm = [](float f) { return static_cast<std::int16_t>(std::lround(std::clamp(f, -1.f, 1.f)*32767.f)); };
+    return {snorm(x), snorm(y)};
+}
+
+[[nodiscard]] inline Norm3f DecodeOctahedral(const std::array<std::int16_t,2>& e) {
+    auto x = static_cast<float>(e[0])*(1.f/32767.f);
+    auto y = static_cast<float>(e[1])*(1.f/32767.f);
+    const auto z = 1.f - std::abs(x) - std::abs(y);
+    //Unfold the lower hemisphere: branchless form of the fold in EncodeOctahedral
+    const auto t = std::max(-z, 0.f);
+    x += x >= 0.f ? -t : t;
+    y += y >= 0.f ? -t : t;
+    return la::normalize(Vec3f{x, y, z});
+}
+
+
+/// @brief Positions quantized to 16 bits per axis over a box, in the padded structure-of-arrays layout of VertexStream.
+/// @brief Position i is min + step*q[i]. The decode is affine, so it is folded into the model-view matrix rather than done per vertex.
+struct QuantizedPositionStream {
+    std::vector<std::uint16_t> x;
+    std::vector<std::uint16_t> y;
+    std::vector<std::uint16_t> z;
+    std::size_t count{0}; //Number of real vertices
+    Vec3f min{0.f,0.f,0.f};
+    Vec3f step{0.f,0.f,0.f}; //Size of one quantization step along each axis
+
+    [[nodiscard]] Vec3f Position(std::size_t i) const noexcept {
+        return min + step*Vec3f{static_cast<float>(x[i]), static_cast<float>(y[i]), static_cast<float>(z[i])};
+    }
+
+    //Maps quantized coordinates to object space
+    [[nodiscard]] Mat44f Dequantization() const noexcept {
+        return Mat44f{
+            {step.x, 0.f,    0.f,    0.f},
+            {0.f,    step.y, 0.f,    0.f},
+            {0.f,    0.f,    step.z, 0.f},
+            {min.x,  min.y,  min.z,  1.f}
+        };
+    }
+};
+
+[[nodiscard]] inline QuantizedPositionStream QuantizePositions(std::span<const Vec3f> positions, const AABB& bounds) {
+    QuantizedPositionStream stream;
+    stream.count = positions.size();
+    const auto padded = (positions.size() + kVertexStreamWidth - 1)/kVertexStreamWidth*kVertexStreamWidth;
+    stream.x.assign(padded, 0);
+    stream.y.assign(padded, 0);
+    stream.z.assign(padded, 0);
+    if(bounds.Empty()) return stream;
+
+    stream.min = bounds.min;
+    stream.step = bounds.Extent()/kPositionQuantizationSteps;
+    //A flat axis has a zero step: every position on it quantizes to 0
+    const auto inverse = [](float step) { return step > 0.f ? 1.f/step : 0.f; };
+    const Vec3f inv_step{inverse(stream.step.x), inverse(stream.step.y), inverse(stream.step.z)};
+    const auto quantize = [](float f) { return static_cast<std::uint16_t>(std::lround(std::clamp(f, 0.f, kPositionQuantizationSteps))); };
+    for(std::size_t i = 0; i < positions.size(); ++i) {
+        const auto q = (positions[i] - stream.min)*inv_step;
+        stream.x[i] = quantize(q.x);
+        stream.y[i] = quantize(q.y);
+        stream.z[i] = quantize(q.z);
+    }
+    return stream;
+}
+
+/// @brief Runs the vertex stage over a quantized stream. The positions are converted to float in the kernel and dequantized by the
+/// @brief combined matrix, so this costs the same arithmetic as the float stream while reading half the bytes.
+inline void TransformVertexStream(const QuantizedPositionStream& in, const Mat44f& model_view, const Mat44f& projection, std::int32_t height, std::int32_t width, ScreenStream& out) {
+    TransformStreamComponents(in.x, in.y, in.z, la::mul(model_view, in.Dequantization()), projection, height, width, out);
+}
+
+
+/// @brief A model's vertex attributes in compact form: 14 bytes per unique position, normal and texture coordinate, instead of 32.
+/// @brief The arrays are indexed exactly like the model's (by Face::pos_idx, norm_idx and tex_idx), so the model's faces are used unchanged.
+struct QuantizedVertices {
+    QuantizedPositionStream positions;
+    std::vector<std::array<std::int16_t,2>> normals;    //Octahedral
+    std::vector<std::array<std::uint16_t,2>> tex_coords; //Half floats
+
+    [[nodiscard]] Vec3f Position(std::size_t i) const noexcept { return positions.Position(i); }
+    [[nodiscard]] Norm3f Normal(std::size_t i) const noexcept { return DecodeOctahedral(normals[i]); }
+    [[nodiscard]] Vec2f TexCoord(std::size_t i) const noexcept { return Vec2f{HalfToFloat(tex_coords[i][0]), HalfToFloat(tex_coords[i][1])}; }
+
+    //Bytes of attribute data, excluding the padding of the position stream
+    [[nodiscard]] std::size_t Bytes() const noexcept {
+        return 3*sizeof(std::uint16_t)*positions.count + sizeof(normals[0])*normals.size() + sizeof(tex_coords[0])*tex_coords.size();
+    }
+};
+
+[[nodiscard]] inline QuantizedVertices QuantizeVertices(const Model& model) {
+    QuantizedVertices out;
+    out.positions = QuantizePositions(model.Vertices(), model.Bounds());
+    out.normals.reserve(model.Normals().size());
+    for(const auto& n : model.Normals()) out.normals.push_back(EncodeOctahedral(la::normalize(n)));
+    out.tex_coords.reserve(model.TexCoords().size());
+    for(const auto& t : model.TexCoords()) out.tex_coords.push_back({FloatToHalf(t.x), FloatToHalf(t.y)});
+    return out;
+}
+
+/// @brief Largest error introduced by quantizing a model's vertices.
+struct QuantizationError {
+    float position{0.f};      //Object-space distance
+    float normal_degrees{0.f}; //Angle between the original and decoded normal
+    float tex_coord{0.f};     //Largest per-component difference
+};
+
+[[nodiscard]] inline QuantizationError MeasureQuantizationError(const Model& model, const QuantizedVertices& quantized) {
+    QuantizationError error;
+    for(std::size_t i = 0; i < model.Vertices().size(); ++i) {
+        error.position = std::max(error.position, la::length(model.Vertices()[i] - quantized.Position(i)));
+    }
+    for(std::size_t i = 0; i < model.Normals().size(); ++i) {
+        //atan2 of the sine and cosine stays accurate for tiny angles, where acos of a float cosine cannot resolve below ~0.02 degrees
+        const auto original = la::normalize(model.Normals()[i]);
+        const auto decoded = quantized.Normal(i);
+        const auto angle = std::atan2(la::length(la::cross(original, decoded)), la::dot(original, decoded));
+        error.normal_degrees = std::max(error.normal_degrees, angle*180.f/std::numbers::pi_v<float>);
+    }
+    for(std::size_t i = 0; i < model.TexCoords().size(); ++i) {
+        const auto d = la::abs(model.TexCoords()[i] - quantized.TexCoord(i));
+        error.tex_coord = std::max({error.tex_coord, d.x, d.y});
+    }
+    return error;
+}
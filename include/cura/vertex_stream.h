@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#include <cura/math.h>
+#include <cura/vertex.h>
+
+//Vertices transformed per iteration of the SIMD kernel. Streams are padded to a multiple of this.
+inline constexpr std::size_t kVertexStreamWidth{8};
+
+/// @brief Vertex positions in structure-of-arrays form: one array per coordinate, so that a batch of vertices is a single load per coordinate.
+/// @brief The arrays are padded with zeros to a multiple of kVertexStreamWidth, so kernels never need a remainder loop.
+struct VertexStream {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::size_t count{0}; //Number of real vertices
+};
+
+[[nodiscard]] inline VertexStream MakeVertexStream(std::span<const Vec3f> positions) {
+    VertexStream stream;
+    stream.count = positions.size();
+    const auto padded = (positions.size() + kVertexStreamWidth - 1)/kVertexStreamWidth*kVertexStreamWidth;
+    stream.x.assign(padded, 0.f);
+    stream.y.assign(padded, 0.f);
+    stream.z.assign(padded, 0.f);
+    for(std::size_t i = 0; i < positions.size(); ++i) {
+        stream.x[i] = positions[i].x;
+        stream.y[i] = positions[i].y;
+        stream.z[i] = positions[i].z;
+    }
+    return stream;
+}
+
+/// @brief Screen-space positions produced by TransformVertexStream, in the same padded layout as the input.
+struct ScreenStream {
+    std::vector<float> x;        //Pixel coordinates
+    std::vector<float> y;
+    std::vector<float> z;        //NDC depth
+    std::vector<float> camera_z; //Camera-space depth, used for perspective-correct interpolation (equals -w for a perspective projection)
+
+    //Vertex i, as the rasterizer takes it
+    [[nodiscard]] ClippedVertex Vertex(std::size_t i, const Vec2f& tex_coords) const {
+        return ClippedVertex{Vec3f{x[i], y[i], z[i]}, tex_coords, camera_z[i]};
+    }
+};
+
+//Loads kVertexStreamWidth consecutive components of a stream as floats.
+#if defined(__AVX2__) && defined(__FMA__)
+[[nodiscard]] inline __m256 LoadStreamLanes(const float* p) { return _mm256_loadu_ps(p); }
+[[nodiscard]] inline __m256 LoadStreamLanes(const std::uint16_t* p) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+}
+#endif
+
+/// @brief The kernel behind TransformVertexStream, for streams whose components are stored as T (float, or quantized uint16).
+/// @brief Components are converted to float as they are loaded; any dequantization must already be folded into 'model_view'.
+template<typename T>
+inline void TransformStreamComponents(const std::vector<T>& in_x, const std::vector<T>& in_y, const std::vector<T>& in_z,
+                                      const Mat44f& model_view, const Mat44f& projection, std::int32_t height, std::int32_t width, ScreenStream& out) {
+    const auto padded = in_x.size();
+    out.x.resize(padded);
+    out.y.resize(padded);
+    out.z.resize(padded);
+    out.camera_z.resize(padded);
+
+    const auto mvp = la::mul(projection, model_view);
+    const auto half_width = 0.5f*static_cast<float>(width);
+    const auto half_height = 0.5f*static_cast<float>(height);
+
+    std::size_t i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+    {
+        //Broadcast every matrix element once. m[c][r] is column c, row r.
+        const auto splat = [](float f) { return _mm256_set1_ps(f); };
+        __m256 m[4][4];
+        for(int c = 0; c < 4; ++c) {
+            for(int r = 0; r < 4; ++r) m[c][r] = splat(mvp[c][r]);
+        }
+        const __m256 v20 = splat(model_view[0][2]), v21 = splat(model_view[1][2]), v22 = splat(model_view[2][2]), v23 = splat(model_view[3][2]);
+        const __m256 one = splat(1.f), hw = splat(half_width), hh = splat(half_height);
+
+        for(; i < padded; i += kVertexStreamWidth) {
+            const auto px = LoadStreamLanes(in_x.data() + i);
+            const auto py = LoadStreamLanes(in_y.data() + i);
+            const auto pz = LoadStreamLanes(in_z.data() + i);
+            const auto row = [&](int r) { return _mm256_fmadd_ps(m[0][r], px, _mm256_fmadd_ps(m[1][r], py, _mm256_fmadd_ps(m[2][r], pz, m[3][r]))); };
+            const auto cx = row(0);
+            const auto cy = row(1);
+            const auto cz = row(2);
+            const auto inv_w = _mm256_div_ps(one, row(3));
+
+            //Viewport: x = (ndc_x+1)*width/2, y = (1-ndc_y)*height/2
+            _mm256_storeu_ps(out.x.data() + i, _mm256_mul_ps(_mm256_fmadd_ps(cx, inv_w, one), hw));
+            _mm256_storeu_ps(out.y.data() + i, _mm256_mul_ps(_mm256_fnmadd_ps(cy, inv_w, one), hh));
+            _mm256_storeu_ps(out.z.data() + i, _mm256_mul_ps(cz, inv_w));
+            _mm256_storeu_ps(out.camera_z.data() + i, _mm256_fmadd_ps(v20, px, _mm256_fmadd_ps(v21, py, _mm256_fmadd_ps(v22, pz, v23))));
+        }
+    }
+#endif
+    const float m00 = mvp[0][0], m10 = mvp[1][0], m20 = mvp[2][0], m30 = mvp[3][0];
+    const float m01 = mvp[0][1], m11 = mvp[1][1], m21 = mvp[2][1], m31 = mvp[3][1];
+    const float m02 = mvp[0][2], m12 = mvp[1][2], m22 = mvp[2][2], m32 = mvp[3][2];
+    const float m03 = mvp[0][3], m13 = mvp[1][3], m23 = mvp[2][3], m33 = mvp[3][3];
+    const float v02 = model_view[0][2], v12 = model_view[1][2], v22 = model_view[2][2], v32 = model_view[3][2];
+    for(; i < padded; ++i) {
+        const auto px = static_cast<float>(in_x[i]), py = static_cast<float>(in_y[i]), pz = static_cast<float>(in_z[i]);
+        const auto inv_w = 1.f/(m03*px + m13*py + m23*pz + m33);
+        out.x[i] = ((m00*px + m10*py + m20*pz + m30)*inv_w + 1.f)*half_width;
+        out.y[i] = (1.f - (m01*px + m11*py + m21*pz + m31)*inv_w)*half_height;
+        out.z[i] = (m02*px + m12*py + m22*pz + m32)*inv_w;
+        out.camera_z[i] = v02*px + v12*py + v22*pz + v32;
+    }
+}
+
+/// @brief Runs the fixed-function vertex stage (see ProcessVertex) over a whole stream.
+/// @brief The model-view and projection matrices are combined, so each vertex costs one matrix-vector product plus the camera-space z row.
+/// @brief Built with AVX2 and FMA, 8 vertices are transformed per iteration; otherwise a scalar loop is used (which compilers
+/// @brief vectorize to the baseline instruction set).
+/// @param out Resized to match 'in'.
+inline void TransformVertexStream(const VertexStream& in, const Mat44f& model_view, const Mat44f& projection, std::int32_t height, std::int32_t width, ScreenStream& out) {
+    TransformStreamComponents(in.x, in.y, in.z, model_view, projection, height, width, out);
+}
@@ -0,0 +1,95 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <cura/bounds.h>
+#include <cura/buffer.h>
+#include <cura/math.h>
+#include <cura/model.h>
+#include <cura/rasterizer.h>
+
+
+//A face of the model projected onto the screen, along with how elongated it is.
+struct ScreenTriangle {
+    FixedTriangle tri;
+    float aspect; //Longest edge squared over twice the area. An equilateral triangle is ~1.15; slivers are much larger.
+};
+
+//Projects the faces of a model orthographically onto the xy plane, scaled so that the model fills an image of the given size.
+std::vector<ScreenTriangle> ProjectFaces(const Model& model, std::int32_t size) {
+    const auto& bounds = model.Bounds();
+    const auto scale = static_cast<float>(size)/std::max(bounds.Extent().x, bounds.Extent().y);
+    const auto to_screen = [&](const Vec3f& p) { return Vec2f{(p.x-bounds.min.x)*scale, (bounds.max.y-p.y)*scale}; };
+
+    std::vector<ScreenTriangle> out;
+    for(const auto& face : model.Faces()) {
+        const auto v0 = to_screen(model.Vertices()[face.pos_idx[0]]);
+        const auto v1 = to_screen(model.Vertices()[face.pos_idx[1]]);
+        const auto v2 = to_screen(model.Vertices()[face.pos_idx[2]]);
+
+        //Rasterize both windings, since there is no depth test to hide the back faces
+        auto tri = SetupTriangle(v0, v1, v2);
+        if(!tri) tri = SetupTriangle(v0, v2, v1);
+        if(!tri) continue;
+
+        const auto longest = std::max({la::length2(v1-v0), la::length2(v2-v1), la::length2(v0-v2)});
+        const auto area = static_cast<float>(tri->area)/static_cast<float>(kSubpixelOne*kSubpixelOne);
+        out.push_back(ScreenTriangle{*tri, longest/area});
+    }
+    return out;
+}
+
+//Rasterizes every triangle with one traversal and reports the work done.
+template<typename Traversal>
+void Run(const char* name, const std::vector<ScreenTriangle>& triangles, std::int32_t size, float min_aspect, Traversal&& traverse) {
+    std::vector<float> depths(static_cast<std::size_t>(size)*size, 0.f);
+    const Tile screen{0, 0, size, size};
+    RasterStats stats;
+    std::size_t count = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    for(const auto& [tri, aspect] : triangles) {
+        if(aspect < min_aspect) continue;
+        ++count;
+        const auto bounds = PixelBounds(tri, screen);
+        if(bounds.Empty()) continue;
+        //The cheapest possible fragment stage, so that the timings are dominated by the traversal
+        traverse(tri, bounds, [&](std::int32_t x, std::int32_t y, std::int64_t, std::int64_t, std::int64_t) { depths[y*size + x] += 1.f; }, &stats);
+    }
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout<<"  "<<std::left<<std::setw(13)<<name<<std::right
+             <<std::setw(7)<<count<<" tris"
+             <<std::setw(12)<<stats.pixels_tested<<" tested"
+             <<std::setw(12)<<stats.pixels_covered<<" covered"
+             <<std::fixed<<std::setprecision(2)
+             <<std::setw(8)<<static_cast<double>(stats.pixels_tested)/std::max<std::uint64_t>(stats.pixels_covered, 1)<<" tested/covered"
+             <<std::setw(9)<<elapsed<<"ms";
+    if(stats.blocks_outside + stats.blocks_partial + stats.blocks_inside > 0) {
+        std::cout<<"  blocks out/partial/in "<<stats.blocks_outside<<"/"<<stats.blocks_partial<<"/"<<stats.blocks_inside;
+    }
+    std::cout<<"\n";
+}
+
+
+//Compares testing every pixel of a triangle's bounding box against classifying 8x8 blocks first.
+//The triangle shapes come from a real mesh, drawn at several sizes: the larger the image, the larger the triangles.
+//Thin triangles (large aspect ratio) are reported separately, since their bounding boxes are mostly empty.
+int main() {
+    const Model model("/home/sc2046/Projects/Graphics/CuRa/assets/models/diablo3_pose.obj");
+
+    for(const std::int32_t size : {512, 2048, 8192}) {
+        const auto triangles = ProjectFaces(model, size);
+        for(const float min_aspect : {0.f, 8.f}) {
+            std::cout<<size<<"x"<<size<<", "<<(min_aspect==0.f ? "all triangles" : "thin triangles (aspect >= 8)")<<"\n";
+            Run("bounding box", triangles, size, min_aspect, [](const auto& tri, const Tile& bounds, auto&& fragment, RasterStats* stats) {
+                RasterizeBoundingBox(tri, bounds, fragment, stats);
+            });
+            Run("8x8 blocks", triangles, size, min_aspect, [](const auto& tri, const Tile& bounds, auto&& fragment, RasterStats* stats) {
+                Rasterize(tri, bounds, fragment, stats);
+            });
+        }
+    }
+}
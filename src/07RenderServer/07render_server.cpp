@@ -0,0 +1,51 @@
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <string_view>
+
+#include <cura/render_server.h>
+#include <cura/thread_pool.h>
+
+
+//A render daemon: keeps parsed models and textures resident and renders JSON jobs sent over stdin or a socket (see render_server.h).
+//Usage: render_server [--socket PATH|HOST:PORT] [--jobs N] [--queue N] [--cache DIR] [--output DIR]
+//Jobs received over a socket write their images under --output, by default the current directory.
+int main(int argc, char** argv) {
+    RenderServerOptions options;
+    std::optional<std::string_view> socket_address;
+
+    for(int i = 1; i < argc; ++i) {
+        const std::string_view arg{argv[i]};
+        if(i + 1 >= argc) {
+            std::cerr<<"Error: missing value for "<<arg<<"\n";
+            return 1;
+        }
+        const std::string_view value{argv[++i]};
+        if(arg=="--socket") socket_address = value;
+        else if(arg=="--jobs") options.concurrent_jobs = std::strtoul(value.data(), nullptr, 10);
+        else if(arg=="--queue") options.queue_capacity = std::strtoul(value.data(), nullptr, 10);
+        else if(arg=="--cache") options.cache_directory = value;
+        else if(arg=="--output") options.output_directory = value;
+        else {
+            std::cerr<<"Error: unknown option "<<arg<<"\n";
+            return 1;
+        }
+    }
+
+    if(socket_address && !options.output_directory) options.output_directory = std::filesystem::current_path();
+
+    //Rendering, shadow maps and asset loading of every job share one pool.
+    ThreadPool pool;
+    RenderServer server(pool, options);
+
+    if(socket_address) {
+        #if defined(__unix__) || defined(__APPLE__)
+        return ServeSocket(server, *socket_address) ? 0 : 1;
+        #else
+        std::cerr<<"Error: sockets are not supported on this platform\n";
+        return 1;
+        #endif
+    }
+    ServeStream(server, std::cin, std::cout);
+}
@@ -0,0 +1,83 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cura/distributed_render.h>
+#include <cura/json.h>
+#include <cura/render_server.h>
+
+
+//Coordinates a render over render_server processes. Reads jobs (see render_server.h), one per line, from stdin and writes each frame to
+//its "output" once every part of it has come back.
+//Usage: distributed_render --worker PATH|HOST:PORT [--worker ...] [--split frames|tiles] [--tile N] [--in-flight N] [--attempts N]
+//                          [--timeout MS]
+int main(int argc, char** argv) {
+    std::vector<std::string> workers;
+    DistributedOptions options;
+
+    for(int i = 1; i < argc; ++i) {
+        const std::string_view arg{argv[i]};
+        if(i + 1 >= argc) {
+            std::cerr<<"Error: missing value for "<<arg<<"\n";
+            return 1;
+        }
+        const std::string_view value{argv[++i]};
+        if(arg=="--worker") workers.emplace_back(value);
+        else if(arg=="--split" && (value=="frames" || value=="tiles")) options.split = value=="tiles" ? WorkSplit::kTiles : WorkSplit::kFrames;
+        else if(arg=="--tile") options.tile_size = static_cast<std::int32_t>(std::strtol(value.data(), nullptr, 10));
+        else if(arg=="--in-flight") options.in_flight = std::strtoul(value.data(), nullptr, 10);
+        else if(arg=="--attempts") options.max_attempts = std::strtoul(value.data(), nullptr, 10);
+        else if(arg=="--timeout") options.reply_timeout = std::chrono::milliseconds{std::strtol(value.data(), nullptr, 10)};
+        else {
+            std::cerr<<"Error: unknown option "<<arg<<" "<<value<<"\n";
+            return 1;
+        }
+    }
+    if(workers.empty()) {
+        std::cerr<<"Error: at least one --worker is required\n";
+        return 1;
+    }
+    if(options.tile_size <= 0 || options.tile_size%kDefaultTileSize!=0) {
+        std::cerr<<"Error: --tile must be a multiple of "<<kDefaultTileSize<<"\n";
+        return 1;
+    }
+
+    std::vector<JsonValue> jobs;
+    std::vector<std::string> outputs;
+    for(std::string line; std::getline(std::cin, line);) {
+        if(line.find_first_not_of(" \t\r")==std::string::npos) continue;
+        auto job = ParseJson(line);
+        if(!job) return 1;
+        const auto* output = job->Find("output");
+        if(!output || !output->String()) {
+            std::cerr<<"Error: job "<<jobs.size()<<" has no \"output\"\n";
+            return 1;
+        }
+        outputs.push_back(*output->String());
+        jobs.push_back(std::move(*job));
+    }
+
+    DistributedRenderer renderer(workers, options);
+    bool written = true;
+    const auto ok = renderer.Render(jobs, [&](std::size_t frame, FrameBuffer& image) {
+        std::ofstream out(outputs[frame], std::ios::binary);
+        RenderServer::WritePPM(out, image);
+        if(!out) {
+            std::cerr<<"Error writing "<<outputs[frame]<<"\n";
+            written = false;
+        }
+    });
+
+    const auto& stats = renderer.Stats();
+    std::printf("%zu items in %.1f ms, %zu retries, pixels compressed %.1f:1\n", stats.items, stats.wall_ms, stats.retries, stats.CompressionRatio());
+    for(const auto& w : stats.workers) {
+        std::printf("  %-24s %4zu items %3zu failed %8.2f Mpixel/s %9.1f ms rendering%s\n", w.address.c_str(), w.items, w.failures,
+                    w.PixelsPerSecond(stats.wall_ms)/1e6, w.render_ms, w.lost ? " (lost)" : "");
+    }
+    return ok && written ? 0 : 1;
+}
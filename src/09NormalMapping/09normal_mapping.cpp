@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numbers>
+
+#include <cura/buffer.h>
+#include <cura/camera.h>
+#include <cura/light.h>
+#include <cura/math.h>
+#include <cura/model.h>
+#include <cura/normal_mapping.h>
+#include <cura/rasterizer.h>
+#include <cura/texture.h>
+#include <cura/thread_pool.h>
+#include <cura/transforms.h>
+
+
+//Bakes a model's interpolated vertex normals into an object-space normal map, by rasterizing each face at its texture coordinates.
+//Texels no face covers keep a normal facing +z.
+FrameBuffer BakeNormalMap(const Model& model, std::int32_t size) {
+    FrameBuffer map{size, size};
+    std::fill(map.colors.begin(), map.colors.end(), Color3f{0.5f,0.5f,1.f});
+    const Tile texture{0, 0, size, size};
+    //Matches the row flip of TextureLookup
+    const auto to_texel = [&](const Vec2f& uv) { return Vec2f{uv.x*size, size - uv.y*size}; };
+
+    for(const auto& face : model.Faces()) {
+        std::array<Vec2f,3> uv;
+        std::array<Vec3f,3> normal;
+        for(int i = 0; i < 3; ++i) {
+            uv[i] = to_texel(model.TexCoords()[face.tex_idx[i]]);
+            normal[i] = model.Normals()[face.norm_idx[i]];
+        }
+        //Faces are laid out with either winding in texture space
+        auto tri = SetupTriangle(uv[0], uv[1], uv[2]);
+        if(!tri) {
+            std::swap(uv[1], uv[2]);
+            std::swap(normal[1], normal[2]);
+            tri = SetupTriangle(uv[0], uv[1], uv[2]);
+        }
+        if(!tri) continue;
+        const auto inv_area = 1.f/static_cast<float>(tri->area);
+        Rasterize(*tri, PixelBounds(*tri, texture), [&](std::int32_t x, std::int32_t y, std::int64_t w0, std::int64_t w1, std::int64_t w2) {
+            const auto n = la::normalize((static_cast<float>(w0)*normal[0] + static_cast<float>(w1)*normal[1] + static_cast<float>(w2)*normal[2])*inv_area);
+            map.Color(x,y) = 0.5f*n + Vec3f{0.5f,0.5f,0.5f};
+        });
+    }
+    return map;
+}
+
+
+//Lights a model with diffuse, normal and specular maps, shading fragments one at a time and then in 2x2 quads, and compares the two.
+int main() {
+    constexpr std::int32_t ksize{1000};
+    const Model model("/home/sc2046/Projects/Graphics/CuRa/assets/models/diablo3_pose.obj");
+    const auto diffuse_map = ParsePPMTexture("/home/sc2046/Projects/Graphics/CuRa/assets/textures/checker.ppm");
+    const auto normal_map = BakeNormalMap(model, 1024);
+    FrameBuffer specular_map{2, 2};
+    std::fill(specular_map.colors.begin(), specular_map.colors.end(), Color3f{0.5f,0.5f,0.5f});
+    const NormalMapMaterial material{diffuse_map, normal_map, specular_map};
+
+    const Camera camera(
+        {0.f,0.f,2.f}, //eye
+        {0.f,0.f,0.f}, //centre
+        {0.f,1.f,0.f}  //up
+    );
+    const auto projection = PerspectiveProjection(std::numbers::pi_v<float>/3.f, 1.f, -0.1f, -5.f);
+    const DistantLight sun{
+        la::normalize(Vec3f{-0.3f,-1.f,-0.4f}), //direction
+        {0.2f,0.2f,0.2f},                        //ambient
+        {0.8f,0.8f,0.8f},                        //diffuse
+        {0.6f,0.6f,0.6f}                         //specular
+    };
+
+    //One thread, so that the timings compare the shading paths rather than the scheduling
+    ThreadPool pool(1);
+    constexpr int kruns{10};
+    const auto render = [&](bool quads, FrameBuffer& image) {
+        double best = 1e30;
+        for(int run = 0; run < kruns; ++run) {
+            image = FrameBuffer{ksize, ksize};
+            const auto start = std::chrono::steady_clock::now();
+            DrawModelNormalMapped(model, material, sun, Mat44f{la::identity}, camera.view, projection, image, pool, quads);
+            best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        return best;
+    };
+
+    FrameBuffer scalar{ksize, ksize};
+    FrameBuffer quad{ksize, ksize};
+    const auto scalar_ms = render(false, scalar);
+    const auto quad_ms = render(true, quad);
+
+    float color_difference = 0.f;
+    bool same_depth = true;
+    for(std::size_t i = 0; i < scalar.colors.size(); ++i) {
+        const auto d = la::abs(scalar.colors[i] - quad.colors[i]);
+        color_difference = std::max({color_difference, d.x, d.y, d.z});
+        same_depth = same_depth && scalar.depths[i]==quad.depths[i];
+    }
+    std::cout<<std::fixed<<std::setprecision(1)<<ksize<<"x"<<ksize<<", best of "<<kruns<<": one fragment at a time "<<scalar_ms
+             <<"ms, 2x2 quads "<<quad_ms<<"ms\n"<<"depth "<<(same_depth ? "identical" : "differs")<<", largest color difference "
+             <<std::scientific<<color_difference<<"\n";
+
+    std::ofstream out_file{"/home/sc2046/Projects/Graphics/CuRa/scenes/09NormalMapping/normal-mapped.ppm"};
+    if(!out_file) {std::cerr<<"Error creating file\n"; return 1;};
+    quad.WriteColorsPPM(out_file);
+}
@@ -0,0 +1,115 @@
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <numbers>
+#include <string>
+#include <string_view>
+
+#include <cura/camera.h>
+#include <cura/model.h>
+#include <cura/renderer.h>
+#include <cura/transforms.h>
+#include <cura/vertex_quantization.h>
+
+//Checks the precision of the quantized vertex formats: half float conversion on its edge cases, and the error of quantizing the bundled
+//models, both in object space and after the vertex stage.
+//Usage: vertex_quantization_test MODEL_DIRECTORY
+
+namespace {
+
+int failures = 0;
+
+void Check(bool ok, std::string_view what) {
+    if(!ok) {
+        std::cerr<<"FAILED: "<<what<<"\n";
+        ++failures;
+    }
+}
+
+void TestHalfConversion() {
+    //Exact conversions of edge values, both ways
+    const struct { float f; std::uint16_t h; } kexact[] = {
+        {0.f, 0x0000}, {-0.f, 0x8000}, {1.f, 0x3c00}, {-2.f, 0xc000},
+        {std::ldexp(1.f, -24), 0x0001},           //Smallest subnormal
+        {1023.f*std::ldexp(1.f, -24), 0x03ff},    //Largest subnormal
+        {std::ldexp(1.f, -14), 0x0400},           //Smallest normal
+        {65504.f, 0x7bff},                        //Largest finite
+        {std::numeric_limits<float>::infinity(), 0x7c00}, {-std::numeric_limits<float>::infinity(), 0xfc00},
+    };
+    for(const auto& [f, h] : kexact) {
+        Check(FloatToHalf(f)==h, "FloatToHalf(" + std::to_string(f) + ")");
+        Check(std::bit_cast<std::uint32_t>(HalfToFloat(h))==std::bit_cast<std::uint32_t>(f), "HalfToFloat(" + std::to_string(h) + ")");
+    }
+
+    //Rounding at the ends of the range
+    Check(FloatToHalf(std::ldexp(1.f, -25))==0x0000, "half the smallest subnormal rounds to even (zero)");
+    Check(FloatToHalf(std::nextafter(std::ldexp(1.f, -25), 1.f))==0x0001, "just over half the smallest subnormal rounds up");
+    Check(FloatToHalf(std::ldexp(1.f, -26))==0x0000, "a quarter of the smallest subnormal flushes to zero");
+    Check(FloatToHalf(65519.f)==0x7bff, "65519 rounds to the largest finite half");
+    Check(FloatToHalf(65520.f)==0x7c00, "65520 rounds to infinity");
+    Check(FloatToHalf(1e10f)==0x7c00, "overflow becomes infinity");
+    Check(std::isnan(HalfToFloat(FloatToHalf(std::numeric_limits<float>::quiet_NaN()))), "NaN stays NaN");
+
+    //Every half other than NaN survives a round trip through float
+    for(std::uint32_t h = 0; h <= 0xffff; ++h) {
+        const auto half = static_cast<std::uint16_t>(h);
+        if((half & 0x7c00)==0x7c00 && (half & 0x03ff)!=0) continue;
+        if(FloatToHalf(HalfToFloat(half))!=half) {
+            Check(false, "round trip of half " + std::to_string(h));
+            break;
+        }
+    }
+}
+
+void TestModel(const std::string& path) {
+    const Model model(path);
+    Check(!model.Faces().empty(), "loading " + path);
+    if(model.Faces().empty()) return;
+    const auto quantized = QuantizeVertices(model);
+    const auto error = MeasureQuantizationError(model, quantized);
+
+    //A position is off by at most half a step along each axis
+    const auto step = model.Bounds().Extent()/kPositionQuantizationSteps;
+    Check(error.position <= 0.5f*la::length(step)*1.001f, path + ": position error " + std::to_string(error.position));
+    //snorm16 octahedral normals are good to a few thousandths of a degree
+    Check(error.normal_degrees <= 0.01f, path + ": normal error " + std::to_string(error.normal_degrees) + " degrees");
+    //Half floats keep 11 significant bits, so texture coordinates in [0,1] are off by at most 2^-12
+    Check(error.tex_coord <= std::ldexp(1.f, -12), path + ": texture coordinate error " + std::to_string(error.tex_coord));
+
+    //The quantized vertex stage lands within a small fraction of a pixel of the float one
+    constexpr std::int32_t ksize{800};
+    const Camera camera(Vec3f{0.f,0.f,3.f}, Vec3f{0.f,0.f,0.f}, Vec3f{0.f,1.f,0.f});
+    const auto projection = PerspectiveProjection(std::numbers::pi_v<float>/2.f, 1.f, -0.1f, -10.f);
+    const auto reference = ProcessVertices(model, camera.view, projection, ksize, ksize);
+    const auto decoded = ProcessVertices(model, quantized, camera.view, projection, ksize, ksize);
+    float pixel_error = 0.f;
+    float uv_error = 0.f;
+    for(std::size_t i = 0; i < reference.size(); ++i) {
+        const auto d = la::abs(reference[i].pixel_coords - decoded[i].pixel_coords);
+        const auto t = la::abs(reference[i].tex_coords - decoded[i].tex_coords);
+        pixel_error = std::max({pixel_error, d.x, d.y});
+        uv_error = std::max({uv_error, t.x, t.y});
+    }
+    Check(reference.size()==decoded.size(), path + ": vertex count");
+    Check(pixel_error <= 0.05f, path + ": screen position error " + std::to_string(pixel_error) + " pixels");
+    Check(uv_error <= std::ldexp(1.f, -12), path + ": vertex stage texture coordinate error " + std::to_string(uv_error));
+
+    std::cout<<path<<": "<<quantized.Bytes()<<" bytes, position error "<<error.position<<", normal error "<<error.normal_degrees
+             <<" degrees, texture coordinate error "<<error.tex_coord<<", screen error "<<pixel_error<<" pixels\n";
+}
+
+} //namespace
+
+int main(int argc, char** argv) {
+    if(argc!=2) {
+        std::cerr<<"Usage: vertex_quantization_test MODEL_DIRECTORY\n";
+        return EXIT_FAILURE;
+    }
+    const std::string directory{argv[1]};
+    TestHalfConversion();
+    for(const auto* name : {"head.obj", "diablo3_pose.obj", "floor.obj"}) TestModel(directory + "/" + name);
+    return failures==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}